@@ -0,0 +1,628 @@
+/* ast.c - syntax trees kept in one block of memory */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+/*
+ *  The parser builds a tree top down: a node is opened when the parser
+ *  knows what it starts, its children are added after it, and it is
+ *  closed, which sets its size, when they are all there.  A node whose
+ *  first child is only known to be one once that child is complete, as
+ *  the left operand of a binary operator is, is put in front of it by
+ *  ast_wrap(), which moves the child's nodes up to make room.
+ *
+ *  In a chain such as a + b + c + d each operator wraps all that went
+ *  before, so rather than move those nodes up one for each, ast_wrap()
+ *  leaves a gap in front of them for the parents to come, doubling it
+ *  when it is full, and fills it from the back.  What is left of a gap
+ *  is closed up before a node that encloses it is closed, or one in
+ *  front of it is wrapped, so the tree has no holes in it once the
+ *  node it is in is complete.
+ *
+ *  Each entry in ast_text is its length as an unsigned int, then its
+ *  characters and a NUL, padded to a multiple of 4; a node's an_value
+ *  is the offset of the entry.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "c_lex.h"
+#include "ast.h"
+
+static const char *Kind_names[AST_KINDS] = {
+	"none", "translation_unit", "declaration", "function", "body",
+	"specifiers", "keyword", "struct", "enum", "enumerator", "field",
+	"init_declarator", "declarator", "pointer", "array", "parameters",
+	"parameter", "ellipsis", "type_name", "initializer_list",
+	"designation",
+	"compound", "if", "switch", "while", "do", "for", "break",
+	"continue", "goto", "return", "label", "case", "default",
+	"expression_statement", "empty",
+	"name", "constant", "string", "unary", "postfix", "binary", "assign",
+	"conditional", "comma", "call", "index", "member", "cast", "sizeof",
+	"compound_literal"
+};
+
+void
+ast_init(ast_t *t)
+{
+	memset(t, 0, sizeof *t);
+}
+
+void
+ast_free(ast_t *t)
+{
+	if (t->ast_mapped != NULL)
+		munmap(t->ast_mapped, t->ast_maplen);
+	else {
+		free(t->ast_nodes);
+		free(t->ast_text);
+	}
+	free(t->ast_open);
+	free(t->ast_gaps);
+	free(t->ast_names);
+	free(t->ast_literals);
+	ast_init(t);
+}
+
+/*
+ *  Empty t to build another tree in, keeping its memory.
+ */
+void
+ast_reset(ast_t *t)
+{
+	t->ast_count = 0;
+	t->ast_textlen = 0;
+	t->ast_nopen = 0;
+	t->ast_ngaps = 0;
+	if (t->ast_nnames > 0)
+		memset(t->ast_names, 0, t->ast_nnames * sizeof *t->ast_names);
+	if (t->ast_nliterals > 0)
+		memset(t->ast_literals, 0,
+			t->ast_nliterals * sizeof *t->ast_literals);
+}
+
+/*
+ *  Make room for n more nodes.
+ */
+static void
+reserve(ast_t *t, unsigned int n)
+{
+	if (t->ast_size - t->ast_count >= n)
+		return;
+	do
+		t->ast_size = t->ast_size ? t->ast_size * 2 : 4096;
+	while (t->ast_size - t->ast_count < n);
+	t->ast_nodes = safe_realloc(t->ast_nodes,
+				t->ast_size * sizeof *t->ast_nodes);
+}
+
+static ast_node_t *
+new_node(ast_t *t)
+{
+	reserve(t, 1);
+	return &t->ast_nodes[t->ast_count++];
+}
+
+static void
+push_open(ast_t *t, unsigned int i)
+{
+	if (t->ast_nopen == t->ast_opensize) {
+		t->ast_opensize = t->ast_opensize ? t->ast_opensize * 2 : 64;
+		t->ast_open = safe_realloc(t->ast_open,
+					t->ast_opensize * sizeof *t->ast_open);
+	}
+	t->ast_open[t->ast_nopen++] = i;
+}
+
+/*
+ *  Add a node with no children.
+ */
+void
+ast_leaf(ast_t *t, int kind, int op, unsigned int start, unsigned int end,
+		unsigned int value)
+{
+	ast_node_t *n = new_node(t);
+
+	n->an_kind = kind;
+	n->an_op = op;
+	n->an_size = 1;
+	n->an_start = start;
+	n->an_end = end;
+	n->an_value = value;
+}
+
+/*
+ *  Add a node, to which the nodes added until it is closed belong.
+ */
+void
+ast_open(ast_t *t, int kind, int op, unsigned int start)
+{
+	ast_leaf(t, kind, op, start, start, 0);
+	push_open(t, t->ast_count - 1);
+}
+
+/*
+ *  Move the nodes from first up by n, to leave n unused in front of
+ *  them.  None of them may be open.
+ */
+static void
+make_room(ast_t *t, unsigned int first, unsigned int n)
+{
+	reserve(t, n);
+	memmove(&t->ast_nodes[first + n], &t->ast_nodes[first],
+			(t->ast_count - first) * sizeof *t->ast_nodes);
+	t->ast_count += n;
+}
+
+/*
+ *  Close up the unused part of the innermost gap.
+ */
+static void
+close_gap(ast_t *t)
+{
+	ast_gap_t *g = &t->ast_gaps[--t->ast_ngaps];
+	unsigned int from = g->ag_first + g->ag_free;
+	unsigned int i;
+
+	if (g->ag_free == 0)
+		return;
+	memmove(&t->ast_nodes[g->ag_first], &t->ast_nodes[from],
+			(t->ast_count - from) * sizeof *t->ast_nodes);
+	t->ast_count -= g->ag_free;
+	for (i = t->ast_nopen; i > 0 && t->ast_open[i - 1] >= from; --i)
+		t->ast_open[i - 1] -= g->ag_free;
+}
+
+/*
+ *  Close up the gaps that start after node i.
+ */
+static void
+close_gaps(ast_t *t, unsigned int i)
+{
+	while (t->ast_ngaps > 0 && t->ast_gaps[t->ast_ngaps - 1].ag_first > i)
+		close_gap(t);
+}
+
+/*
+ *  Open a node in front of node first, which must be complete, so that
+ *  first and the nodes after it belong to the new one.
+ */
+void
+ast_wrap(ast_t *t, unsigned int first, int kind, int op, unsigned int start)
+{
+	ast_gap_t *g;
+	ast_node_t *n;
+
+	close_gaps(t, first);
+	g = t->ast_ngaps > 0 ? &t->ast_gaps[t->ast_ngaps - 1] : NULL;
+	if (g == NULL || g->ag_first != first) {
+		if (t->ast_ngaps == t->ast_gapsize) {
+			t->ast_gapsize = t->ast_gapsize ?
+						t->ast_gapsize * 2 : 64;
+			t->ast_gaps = safe_realloc(t->ast_gaps,
+					t->ast_gapsize * sizeof *t->ast_gaps);
+		}
+		g = &t->ast_gaps[t->ast_ngaps++];
+		g->ag_first = first;
+		g->ag_size = g->ag_free = 0;
+	}
+	if (g->ag_free == 0) {
+		g->ag_free = g->ag_size ? g->ag_size : 1;
+		g->ag_size += g->ag_free;
+		make_room(t, first, g->ag_free);
+	}
+	n = &t->ast_nodes[first + --g->ag_free];
+	n->an_kind = kind;
+	n->an_op = op;
+	n->an_start = n->an_end = start;
+	n->an_value = 0;
+	push_open(t, n - t->ast_nodes);
+}
+
+/*
+ *  Complete the node opened last, which ends at end, or where it
+ *  starts if it turned out to be empty.
+ */
+void
+ast_close(ast_t *t, unsigned int end)
+{
+	ast_node_t *n;
+
+	close_gaps(t, t->ast_open[t->ast_nopen - 1]);
+	n = &t->ast_nodes[t->ast_open[--t->ast_nopen]];
+	n->an_size = &t->ast_nodes[t->ast_count] - n;
+	n->an_end = end > n->an_start ? end : n->an_start;
+}
+
+void
+ast_close_all(ast_t *t, unsigned int end)
+{
+	while (t->ast_nopen > 0)
+		ast_close(t, end);
+}
+
+/*
+ *  Change the kind of the node opened last.
+ */
+void
+ast_retag(ast_t *t, int kind)
+{
+	t->ast_nodes[t->ast_open[t->ast_nopen - 1]].an_kind = kind;
+}
+
+/*
+ *  Drop the nodes from count on, which must be complete.
+ */
+void
+ast_cut(ast_t *t, unsigned int count)
+{
+	while (t->ast_ngaps > 0 &&
+			t->ast_gaps[t->ast_ngaps - 1].ag_first >= count)
+		--t->ast_ngaps;
+	t->ast_count = count;
+}
+
+/*
+ *  Drop the nodes from count on, and open the root again, so that the
+ *  tree can go on from there.
+ */
+void
+ast_truncate(ast_t *t, unsigned int count)
+{
+	ast_cut(t, count);
+	t->ast_nopen = 0;
+	if (count > 0)
+		push_open(t, 0);
+}
+
+static unsigned int
+add_text(ast_t *t, const char *s, unsigned int len)
+{
+	unsigned int need, v;
+
+	need = (sizeof len + len + 1 + 3) & ~3u;
+	if (t->ast_textsize - t->ast_textlen < need) {
+		do
+			t->ast_textsize = t->ast_textsize ?
+						t->ast_textsize * 2 : 4096;
+		while (t->ast_textsize - t->ast_textlen < need);
+		t->ast_text = safe_realloc(t->ast_text, t->ast_textsize);
+	}
+	v = t->ast_textlen;
+	memcpy(t->ast_text + v, &len, sizeof len);
+	memcpy(t->ast_text + v + sizeof len, s, len);
+	memset(t->ast_text + v + sizeof len + len, 0,
+				need - sizeof len - len);
+	t->ast_textlen += need;
+	return v;
+}
+
+/*
+ *  The offset of atom's text in the tree, with extra characters of the
+ *  NUL after it, which is added the first time the atom is; map is
+ *  indexed by at_id.
+ */
+static unsigned int
+intern(ast_t *t, unsigned int **map, unsigned int *n, const atom_t *atom,
+		int extra)
+{
+	unsigned int size;
+
+	if (atom->at_id >= *n) {
+		size = *n ? *n : 1024;
+		while (size <= atom->at_id)
+			size *= 2;
+		*map = safe_realloc(*map, size * sizeof **map);
+		memset(*map + *n, 0, (size - *n) * sizeof **map);
+		*n = size;
+	}
+	if ((*map)[atom->at_id] == 0)
+		(*map)[atom->at_id] = add_text(t, atom->at_name,
+						atom->at_len + extra) + 1;
+	return (*map)[atom->at_id] - 1;
+}
+
+unsigned int
+ast_name(ast_t *t, const atom_t *atom)
+{
+	return intern(t, &t->ast_names, &t->ast_nnames, atom, 0);
+}
+
+unsigned int
+ast_literal(ast_t *t, const atom_t *literal)
+{
+	return intern(t, &t->ast_literals, &t->ast_nliterals, literal, 1);
+}
+
+/*
+ *  Let go of what was only needed to build the tree, and of the room
+ *  to grow, so that as little memory as possible is held while it is
+ *  kept.
+ */
+void
+ast_done(ast_t *t)
+{
+	while (t->ast_ngaps > 0)
+		close_gap(t);
+	free(t->ast_open);
+	free(t->ast_gaps);
+	free(t->ast_names);
+	free(t->ast_literals);
+	t->ast_open = t->ast_names = t->ast_literals = NULL;
+	t->ast_gaps = NULL;
+	t->ast_nopen = t->ast_opensize = 0;
+	t->ast_ngaps = t->ast_gapsize = 0;
+	t->ast_nnames = t->ast_nliterals = 0;
+	if (t->ast_count > 0 && t->ast_count < t->ast_size) {
+		t->ast_nodes = safe_realloc(t->ast_nodes,
+				t->ast_count * sizeof *t->ast_nodes);
+		t->ast_size = t->ast_count;
+	}
+	if (t->ast_textlen > 0 && t->ast_textlen < t->ast_textsize) {
+		t->ast_text = safe_realloc(t->ast_text, t->ast_textlen);
+		t->ast_textsize = t->ast_textlen;
+	}
+}
+
+/*
+ *  The name or string constant at value, and its length, which for a
+ *  string counts its NUL.
+ */
+const char *
+ast_string(const ast_t *t, unsigned int value, size_t *lenp)
+{
+	unsigned int len;
+
+	memcpy(&len, t->ast_text + value, sizeof len);
+	if (lenp != NULL)
+		*lenp = len;
+	return t->ast_text + value + sizeof len;
+}
+
+const char *
+ast_kind_name(int kind)
+{
+	return kind >= 0 && kind < AST_KINDS ? Kind_names[kind] : "?";
+}
+
+/*
+ *  Check that t is a tree that the other functions here can be let
+ *  loose on, as one from ast_map() of a file that may be damaged might
+ *  not be: that every kind is known, that each subtree lies within its
+ *  parent's and the root's is the whole tree, and that the text of
+ *  every name and string is inside ast_text.  Returns 0, or -1 with
+ *  errno set to EINVAL.
+ */
+int
+ast_check(const ast_t *t)
+{
+	unsigned int *ends;
+	const ast_node_t *n;
+	unsigned int i, len;
+	int depth, ok;
+
+	if (t->ast_count == 0)
+		return 0;
+	ends = NEW_ARRAY(unsigned int, t->ast_count + 1);
+	ends[0] = t->ast_count;
+	depth = 1;
+	ok = t->ast_nodes[0].an_size == t->ast_count;
+	for (i = 0; ok && i < t->ast_count; ++i) {
+		n = &t->ast_nodes[i];
+		while (ends[depth - 1] <= i)
+			--depth;
+		if (n->an_kind >= AST_KINDS || n->an_size == 0 ||
+				n->an_size > ends[depth - 1] - i) {
+			ok = 0;
+			break;
+		}
+		if (n->an_kind == AST_NAME || n->an_kind == AST_STRING) {
+			/* The length, the text, then a NUL */
+			if (n->an_value % 4 != 0 ||
+				n->an_value > t->ast_textlen ||
+				t->ast_textlen - n->an_value <= sizeof len) {
+				ok = 0;
+				break;
+			}
+			memcpy(&len, t->ast_text + n->an_value, sizeof len);
+			if (n->an_kind == AST_STRING)
+				--len;	/* its NUL is counted */
+			if (len >= t->ast_textlen - n->an_value - sizeof len ||
+				t->ast_text[n->an_value + sizeof len + len]
+								!= '\0') {
+				ok = 0;
+				break;
+			}
+		}
+		ends[depth++] = i + n->an_size;
+	}
+	free(ends);
+	if (!ok) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  Print the tree, a node to a line, indented by depth.
+ */
+void
+ast_print(const ast_t *t, FILE *fp)
+{
+	unsigned int *ends;
+	const ast_node_t *n;
+	const char *s;
+	size_t len, k;
+	unsigned int i;
+	int depth;
+
+	ends = NEW_ARRAY(unsigned int, t->ast_count + 1);
+	depth = 0;
+	for (i = 0; i < t->ast_count; ++i) {
+		n = &t->ast_nodes[i];
+		while (depth > 0 && ends[depth - 1] <= i)
+			--depth;
+		fprintf(fp, "%*s%s", depth * 2, "", ast_kind_name(n->an_kind));
+		switch (n->an_kind) {
+		case AST_NAME:
+			s = ast_string(t, n->an_value, &len);
+			fprintf(fp, " %.*s", (int)len, s);
+			break;
+		case AST_STRING:
+			s = ast_string(t, n->an_value, &len);
+			fputs(" \"", fp);
+			for (k = 0; k + 1 < len; ++k) {
+				if (s[k] == '"' || s[k] == '\\')
+					fprintf(fp, "\\%c", s[k]);
+				else if (s[k] < ' ' || s[k] > '~')
+					fprintf(fp, "\\%03o", s[k] & 0xff);
+				else
+					putc(s[k], fp);
+			}
+			putc('"', fp);
+			break;
+		case AST_KEYWORD:
+		case AST_STRUCT:
+		case AST_CONSTANT:
+		case AST_UNARY:
+		case AST_POSTFIX:
+		case AST_BINARY:
+		case AST_ASSIGN:
+		case AST_MEMBER:
+			fprintf(fp, " %s", tokname(n->an_op));
+			break;
+		}
+		fprintf(fp, " %u-%u\n", n->an_start, n->an_end);
+		ends[depth++] = i + n->an_size;
+	}
+	free(ends);
+}
+
+/*
+ *  Write t, the tree of the input named source, to filename, in the
+ *  form described in ast.h.  Returns 0, or -1 with errno set.
+ */
+int
+ast_save(const ast_t *t, const char *source, const char *filename)
+{
+	static const char zeros[AST_ALIGN];
+	ast_file_t af;
+	size_t nodesize;
+	FILE *fp;
+	int err;
+
+	memset(&af, 0, sizeof af);
+	af.af_magic = AST_MAGIC;
+	af.af_version = AST_VERSION;
+	af.af_nodesize = sizeof (ast_node_t);
+	af.af_kinds = AST_KINDS;
+	af.af_count = t->ast_count;
+	af.af_nodes = (sizeof af + AST_ALIGN - 1) & ~(AST_ALIGN - 1);
+	nodesize = (size_t)t->ast_count * sizeof (ast_node_t);
+	af.af_textlen = t->ast_textlen;
+	af.af_text = (af.af_nodes + nodesize + AST_ALIGN - 1) &
+							~(AST_ALIGN - 1);
+	af.af_sourcelen = source != NULL ? strlen(source) : 0;
+	af.af_source = af.af_text + af.af_textlen;
+	if (af.af_nodes + nodesize + AST_ALIGN + af.af_textlen +
+				af.af_sourcelen + 1 > 0xffffffffu) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	if ((fp = fopen(filename, "wb")) == NULL)
+		return -1;
+	fwrite(&af, sizeof af, 1, fp);
+	fwrite(zeros, af.af_nodes - sizeof af, 1, fp);
+	fwrite(t->ast_nodes, 1, nodesize, fp);
+	fwrite(zeros, 1, af.af_text - af.af_nodes - nodesize, fp);
+	fwrite(t->ast_text, 1, af.af_textlen, fp);
+	fwrite(source != NULL ? source : "", 1, af.af_sourcelen + 1, fp);
+	err = ferror(fp);
+	if (fclose(fp) != 0 || err) {
+		if (err)
+			errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  Map the tree file filename into memory as t, which may then be used
+ *  at once, as read-only, until ast_free() unmaps it.  Nothing is read
+ *  but the header, which is checked; the nodes are trusted to be as
+ *  ast_save() wrote them, unless the caller has ast_check() look at
+ *  them.  The name of the input is put in *sourcep if
+ *  sourcep is not NULL.  Returns 0, or -1 with errno set, to EINVAL for
+ *  a file that is not a tree of this version.
+ */
+int
+ast_map(ast_t *t, const char *filename, const char **sourcep)
+{
+	const ast_file_t *af;
+	struct stat st;
+	char *base;
+	size_t size;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY)) == -1)
+		return -1;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+	size = st.st_size;
+	if (size < sizeof *af) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return -1;
+
+	af = (const ast_file_t *)base;
+	if (af->af_magic != AST_MAGIC || af->af_version != AST_VERSION ||
+		af->af_nodesize != sizeof (ast_node_t) ||
+		af->af_kinds != AST_KINDS ||
+		af->af_nodes % AST_ALIGN != 0 || af->af_nodes > size ||
+		(size - af->af_nodes) / sizeof (ast_node_t) < af->af_count ||
+		af->af_text > size || size - af->af_text < af->af_textlen ||
+		af->af_source > size ||
+		size - af->af_source <= af->af_sourcelen ||
+		base[af->af_source + af->af_sourcelen] != '\0') {
+		munmap(base, size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	ast_init(t);
+	t->ast_nodes = (ast_node_t *)(base + af->af_nodes);
+	t->ast_count = t->ast_size = af->af_count;
+	t->ast_text = base + af->af_text;
+	t->ast_textlen = t->ast_textsize = af->af_textlen;
+	t->ast_mapped = base;
+	t->ast_maplen = size;
+	if (sourcep != NULL)
+		*sourcep = base + af->af_source;
+	return 0;
+}
@@ -0,0 +1,193 @@
+/* ast.h - syntax trees kept in one block of memory */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+/*
+ *  A tree is an array of nodes in preorder: each node is followed by
+ *  its children, and each child by its own.  A node is named by its
+ *  index, the root is node 0, and the subtree of node i is the an_size
+ *  nodes from i, so its first child, if an_size is more than 1, is
+ *  i + 1, and the child after child c is c + an_size of c.  Names and
+ *  the values of string constants are kept once each in ast_text, and
+ *  nodes refer to them by offset, so a tree holds no pointers and can
+ *  be kept, copied or written out as it is.
+ *
+ *  an_start and an_end are the offsets in the input of the first
+ *  character of a node's first token and of the one after its last.
+ *  They are 0 for input that was not in memory.
+ *
+ *  What the children of each kind are is given beside it.  "[x]" is a
+ *  child that may be missing, and "x..." any number of them.
+ */
+
+#ifndef ast_h
+#define ast_h
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "atom.h"
+
+typedef enum {
+	AST_NONE,		/* an expression left out, as in "for (;;)" */
+	AST_TRANSLATION_UNIT,	/* DECLARATION or FUNCTION... */
+	AST_DECLARATION,	/* SPECIFIERS, declarator or INIT_DECLARATOR... */
+	AST_FUNCTION,		/* SPECIFIERS, DECLARATOR, DECLARATION..., body */
+	AST_BODY,		/* none: a function body a lazy parse skipped */
+	AST_SPECIFIERS,		/* KEYWORD, NAME, STRUCT or ENUM... */
+	AST_KEYWORD,		/* none: an_op is the keyword */
+	AST_STRUCT,		/* [NAME], DECLARATION...; an_op STRUCT or UNION */
+	AST_ENUM,		/* [NAME], ENUMERATOR... */
+	AST_ENUMERATOR,		/* NAME, [expression] */
+	AST_FIELD,		/* [DECLARATOR], expression: a bit field */
+	AST_INIT_DECLARATOR,	/* DECLARATOR, initializer */
+	AST_DECLARATOR,		/* POINTER..., NAME or DECLARATOR, ARRAY or
+				 * PARAMETERS..., all in the order written */
+	AST_POINTER,		/* KEYWORD...: its qualifiers */
+	AST_ARRAY,		/* [expression]; also a "[x]" designator */
+	AST_PARAMETERS,		/* PARAMETER... [ELLIPSIS], or NAME... */
+	AST_PARAMETER,		/* SPECIFIERS, DECLARATOR */
+	AST_ELLIPSIS,		/* none */
+	AST_TYPE_NAME,		/* SPECIFIERS, DECLARATOR */
+	AST_INITIALIZER_LIST,	/* initializer... */
+	AST_DESIGNATION,	/* ARRAY or NAME..., initializer */
+
+	AST_COMPOUND,		/* declaration or statement... */
+	AST_IF,			/* expression, statement, [statement] */
+	AST_SWITCH,		/* expression, statement */
+	AST_WHILE,		/* expression, statement */
+	AST_DO,			/* statement, expression */
+	AST_FOR,		/* DECLARATION or expression, expression,
+				 * expression, statement */
+	AST_BREAK,		/* none */
+	AST_CONTINUE,		/* none */
+	AST_GOTO,		/* NAME */
+	AST_RETURN,		/* [expression] */
+	AST_LABEL,		/* NAME, statement */
+	AST_CASE,		/* expression, statement */
+	AST_DEFAULT,		/* statement */
+	AST_EXPRESSION_STATEMENT, /* expression */
+	AST_EMPTY,		/* none: ";" */
+
+	AST_NAME,		/* none: an_value is the name */
+	AST_CONSTANT,		/* none: an_op is the kind of constant */
+	AST_STRING,		/* none: an_value is its value */
+	AST_UNARY,		/* expression; an_op is the operator */
+	AST_POSTFIX,		/* expression; an_op is "++" or "--" */
+	AST_BINARY,		/* expression, expression; and an_op */
+	AST_ASSIGN,		/* expression, expression; and an_op */
+	AST_CONDITIONAL,	/* expression, expression, expression */
+	AST_COMMA,		/* expression... */
+	AST_CALL,		/* expression, argument... */
+	AST_INDEX,		/* expression, expression */
+	AST_MEMBER,		/* expression, NAME; an_op is "." or "->" */
+	AST_CAST,		/* TYPE_NAME, expression */
+	AST_SIZEOF,		/* TYPE_NAME or expression */
+	AST_COMPOUND_LITERAL,	/* TYPE_NAME, INITIALIZER_LIST */
+	AST_KINDS
+} ast_kind_t;
+
+typedef struct {
+	unsigned short an_kind;		/* an ast_kind_t */
+	unsigned short an_op;		/* a token_t, for some kinds */
+	unsigned int an_size;		/* nodes in its subtree, itself too */
+	unsigned int an_start;		/* its text in the input */
+	unsigned int an_end;
+	unsigned int an_value;		/* for NAME and STRING, in ast_text */
+} ast_node_t;
+
+/* Room made in front of a node for ast_wrap() to put parents in */
+typedef struct {
+	unsigned int ag_first;		/* where it starts */
+	unsigned int ag_size;
+	unsigned int ag_free;		/* the slots from ag_first not used */
+} ast_gap_t;
+
+typedef struct {
+	ast_node_t *ast_nodes;
+	unsigned int ast_count;
+	unsigned int ast_size;		/* room in ast_nodes */
+	char *ast_text;			/* names and strings, see ast_string() */
+	unsigned int ast_textlen;
+	unsigned int ast_textsize;
+	char *ast_mapped;		/* the file, for a tree from ast_map() */
+	size_t ast_maplen;
+
+	/* Only while the tree is being built */
+	unsigned int *ast_open;		/* nodes that are not yet complete */
+	unsigned int ast_nopen;
+	unsigned int ast_opensize;
+	ast_gap_t *ast_gaps;		/* innermost last */
+	unsigned int ast_ngaps;
+	unsigned int ast_gapsize;
+	unsigned int *ast_names;	/* by at_id, offset in ast_text + 1 */
+	unsigned int ast_nnames;
+	unsigned int *ast_literals;	/* the same for string constants */
+	unsigned int ast_nliterals;
+} ast_t;
+
+void ast_init(ast_t *t);
+void ast_free(ast_t *t);
+void ast_reset(ast_t *t);
+void ast_open(ast_t *t, int kind, int op, unsigned int start);
+void ast_wrap(ast_t *t, unsigned int first, int kind, int op,
+		unsigned int start);
+void ast_close(ast_t *t, unsigned int end);
+void ast_close_all(ast_t *t, unsigned int end);
+void ast_retag(ast_t *t, int kind);
+void ast_leaf(ast_t *t, int kind, int op, unsigned int start,
+		unsigned int end, unsigned int value);
+void ast_truncate(ast_t *t, unsigned int count);
+void ast_cut(ast_t *t, unsigned int count);
+unsigned int ast_name(ast_t *t, const atom_t *atom);
+unsigned int ast_literal(ast_t *t, const atom_t *literal);
+void ast_done(ast_t *t);
+const char *ast_string(const ast_t *t, unsigned int value, size_t *lenp);
+const char *ast_kind_name(int kind);
+int ast_check(const ast_t *t);
+void ast_print(const ast_t *t, FILE *fp);
+int ast_save(const ast_t *t, const char *source, const char *filename);
+int ast_map(ast_t *t, const char *filename, const char **sourcep);
+
+/*
+ *  A tree file, from ast_save(), is an ast_file_t, the nodes and the
+ *  text as they are in memory, and the name of the input the tree is
+ *  of, with a NUL.  The offsets are from the start of the file, and
+ *  the nodes start on a multiple of AST_ALIGN, so that ast_map() can
+ *  map the file and use it where it lies.  Like a prefix file it is
+ *  in the byte order of the machine that wrote it.  AST_VERSION goes
+ *  up whenever the kinds or the layout of a node change.
+ *
+ *  ast_map() checks the header but not the nodes, so that using a tree
+ *  costs nothing until it is walked.  A file that may have been damaged
+ *  or come from elsewhere should be passed through ast_check(), which
+ *  looks at each node once, before anything else is done with it.
+ */
+#define AST_MAGIC	0x43415354	/* "CAST" */
+#define AST_VERSION	1
+#define AST_ALIGN	16
+
+typedef struct {
+	unsigned int af_magic;
+	unsigned int af_version;
+	unsigned int af_nodesize;	/* sizeof (ast_node_t) */
+	unsigned int af_kinds;		/* AST_KINDS */
+	unsigned int af_count;
+	unsigned int af_nodes;
+	unsigned int af_textlen;
+	unsigned int af_text;
+	unsigned int af_sourcelen;
+	unsigned int af_source;
+} ast_file_t;
+
+#endif
@@ -0,0 +1,147 @@
+/* atom.c - interned identifier names */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+/*
+ *  Atoms are kept in a chained hash table that doubles when it is
+ *  full, and are carved out of large blocks rather than malloc'ed
+ *  one by one.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "c_lex.h"
+#include "atom.h"
+
+enum {
+	ATOM_BLOCK_SIZE = 64 * 1024,
+	ATOM_INITIAL_SIZE = 1024
+};
+
+struct atom_block_t {
+	atom_block_t *ab_next;
+	double ab_align;		/* start of the atoms */
+};
+
+#define ATOM_ALIGN(n)	(((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+void
+atom_table_init(atom_table_t *atab)
+{
+	atab->atab_size = ATOM_INITIAL_SIZE;
+	atab->atab_buckets = NEW_ARRAY(atom_t *, atab->atab_size);
+	atab->atab_count = 0;
+	atab->atab_free = NULL;
+	atab->atab_left = 0;
+	atab->atab_blocks = NULL;
+}
+
+void
+atom_table_free(atom_table_t *atab)
+{
+	atom_block_t *ab, *next;
+
+	for (ab = atab->atab_blocks; ab != NULL; ab = next) {
+		next = ab->ab_next;
+		free(ab);
+	}
+	free(atab->atab_buckets);
+	atab->atab_buckets = NULL;
+	atab->atab_blocks = NULL;
+	atab->atab_size = atab->atab_count = 0;
+}
+
+unsigned int
+atom_hash(const char *s, int len)
+{
+	unsigned int h = ATOM_HASH_INIT;
+
+	while (len-- > 0)
+		h = ATOM_HASH_STEP(h, *s++);
+	return h;
+}
+
+static void *
+atom_alloc(atom_table_t *atab, size_t size)
+{
+	atom_block_t *ab;
+	size_t blocksize;
+	char *p;
+
+	size = ATOM_ALIGN(size);
+	if (size > atab->atab_left) {
+		blocksize = size > ATOM_BLOCK_SIZE ? size : ATOM_BLOCK_SIZE;
+		ab = safe_calloc(1, offsetof(atom_block_t, ab_align) + blocksize);
+		ab->ab_next = atab->atab_blocks;
+		atab->atab_blocks = ab;
+		atab->atab_free = (char *)&ab->ab_align;
+		atab->atab_left = blocksize;
+	}
+	p = atab->atab_free;
+	atab->atab_free += size;
+	atab->atab_left -= size;
+	return p;
+}
+
+static void
+atom_grow(atom_table_t *atab)
+{
+	atom_t **buckets, *at, *next;
+	unsigned int i, size;
+
+	size = atab->atab_size * 2;
+	buckets = NEW_ARRAY(atom_t *, size);
+	for (i = 0; i < atab->atab_size; ++i) {
+		for (at = atab->atab_buckets[i]; at != NULL; at = next) {
+			next = at->at_next;
+			at->at_next = buckets[at->at_hash & (size - 1)];
+			buckets[at->at_hash & (size - 1)] = at;
+		}
+	}
+	free(atab->atab_buckets);
+	atab->atab_buckets = buckets;
+	atab->atab_size = size;
+}
+
+/*  Return the atom for the len characters at s, creating it if this
+ *  is the first time the name has been seen.  hash must be
+ *  atom_hash(s, len).
+ */
+const atom_t *
+atom_intern(atom_table_t *atab, const char *s, int len, unsigned int hash)
+{
+	atom_t **p_at, *at;
+
+	p_at = &atab->atab_buckets[hash & (atab->atab_size - 1)];
+	for (at = *p_at; at != NULL; at = at->at_next) {
+		if (at->at_hash == hash && at->at_len == len &&
+						memcmp(at->at_name, s, len) == 0)
+			return at;
+	}
+
+	at = atom_alloc(atab, offsetof(atom_t, at_name) + len + 1);
+	at->at_hash = hash;
+	at->at_id = atab->atab_count++;
+	at->at_len = len;
+	memcpy(at->at_name, s, len);
+	at->at_name[len] = '\0';
+	at->at_next = *p_at;
+	*p_at = at;
+
+	if (atab->atab_count > atab->atab_size)
+		atom_grow(atab);
+	return at;
+}
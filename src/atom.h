@@ -0,0 +1,59 @@
+/* atom.h - interned identifier names */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+/*
+ *  An atom is the single stored copy of a name.  Two names are the
+ *  same exactly when their atoms are the same pointer, so the symbol
+ *  table never needs to compare strings.  Atoms live until the table
+ *  that made them is freed.
+ */
+
+#ifndef atom_h
+#define atom_h
+
+#include <stddef.h>
+
+typedef struct atom_t {
+	struct atom_t *at_next;		/* hash chain */
+	unsigned int at_hash;
+	unsigned int at_id;		/* 0, 1, 2 ... in order of creation */
+	int at_len;
+	char at_name[1];		/* at_len chars plus a NUL */
+} atom_t;
+
+typedef struct atom_block_t atom_block_t;
+
+typedef struct {
+	atom_t **atab_buckets;
+	unsigned int atab_size;		/* number of buckets, a power of 2 */
+	unsigned int atab_count;	/* number of atoms */
+	char *atab_free;		/* free space in the current block */
+	size_t atab_left;
+	atom_block_t *atab_blocks;
+} atom_table_t;
+
+/*  FNV-1a, one character at a time.  The lexer finds the end of a
+ *  name with its scanning loops, and only then, once lex_keyword()
+ *  has said it is not a keyword, hashes it with atom_hash().
+ */
+#define ATOM_HASH_INIT		2166136261u
+#define ATOM_HASH_STEP(h, c)	(((h) ^ (unsigned char)(c)) * 16777619u)
+
+void atom_table_init(atom_table_t *atab);
+void atom_table_free(atom_table_t *atab);
+unsigned int atom_hash(const char *s, int len);
+const atom_t *atom_intern(atom_table_t *atab, const char *s, int len,
+			unsigned int hash);
+
+#endif
@@ -0,0 +1,248 @@
+/* batch.c - parse many files on a pool of threads */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+/*
+ *  The files are sorted largest first and dealt out round robin to one
+ *  queue per worker, so every worker starts on the biggest files it
+ *  has.  A worker whose own queue runs dry steals the largest file
+ *  then waiting at the head of any other queue, so the big files are
+ *  started early, though not strictly in order of size, and no worker
+ *  is left holding a large file at the end.  Each worker keeps one
+ *  parser session for all its files; when there are fewer files than
+ *  threads, each file is itself split between its share of the
+ *  threads.  Results are stored by input position and printed only
+ *  when every file is done, so the report does not depend on which
+ *  thread parsed what; so are the messages about each file, which are
+ *  held back until then.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "c_parser.h"
+#include "c_lex.h"
+
+typedef struct {
+	const char *filename;
+	off_t size;
+	int status;		/* 0 or -1, as from parser_parse_file() */
+	char *errmsg;
+	char *messages;		/* what the parse said about the file */
+	size_t msgsize;
+} batch_job_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	int *jobs;		/* indexes into batch_t.jobs, largest first */
+	int head, tail;
+} batch_queue_t;
+
+typedef struct {
+	batch_job_t *jobs;
+	batch_queue_t *queues;
+	int nqueues;
+	int nsplit;		/* threads for each file */
+} batch_t;
+
+typedef struct {
+	batch_t *batch;
+	int id;
+	pthread_t thread;
+} batch_worker_t;
+
+typedef struct {
+	off_t size;
+	int job;
+} batch_order_t;
+
+static int
+by_size(const void *a, const void *b)
+{
+	const batch_order_t *oa = a;
+	const batch_order_t *ob = b;
+
+	if (oa->size != ob->size)
+		return oa->size < ob->size ? 1 : -1;
+	return oa->job - ob->job;
+}
+
+/*  Take the largest job left in queue q, or return -1.
+ */
+static int
+take_job(batch_queue_t *q)
+{
+	int job = -1;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->head < q->tail)
+		job = q->jobs[q->head++];
+	pthread_mutex_unlock(&q->lock);
+	return job;
+}
+
+/*  Take the largest job waiting in any queue but self's, or return
+ *  -1 if they are all empty.  Each queue's largest job is at its head.
+ */
+static int
+steal_job(batch_t *b, int self)
+{
+	batch_queue_t *q;
+	off_t size, best_size;
+	int i, best, job;
+
+	for (;;) {
+		best = -1;
+		best_size = -1;
+		for (i = 0; i < b->nqueues; ++i) {
+			if (i == self)
+				continue;
+			q = &b->queues[i];
+			pthread_mutex_lock(&q->lock);
+			size = q->head < q->tail ? b->jobs[q->jobs[q->head]].size : -1;
+			pthread_mutex_unlock(&q->lock);
+			if (size > best_size) {
+				best = i;
+				best_size = size;
+			}
+		}
+		if (best == -1)
+			return -1;
+		/* another worker may have taken it meanwhile; look again */
+		if ((job = take_job(&b->queues[best])) != -1)
+			return job;
+	}
+}
+
+static void *
+batch_worker(void *arg)
+{
+	batch_worker_t *w = arg;
+	batch_t *b = w->batch;
+	batch_job_t *job;
+	parser_t *p;
+	FILE *fp;
+	int j;
+
+	p = parser_create();
+	if (b->nsplit > 1)
+		parser_set_threads(p, b->nsplit);
+	for (;;) {
+		if ((j = take_job(&b->queues[w->id])) == -1)
+			j = steal_job(b, w->id);
+		if (j == -1)
+			break;	/* nothing is ever added, so we are done */
+
+		job = &b->jobs[j];
+		fp = open_memstream(&job->messages, &job->msgsize);
+		parser_set_errors(p, fp);
+		job->status = parser_parse_file(p, job->filename);
+		if (job->status != 0)
+			job->errmsg = string_copy(parser_error(p),
+						strlen(parser_error(p)));
+		if (fp != NULL)
+			fclose(fp);
+	}
+	parser_destroy(p);
+	return NULL;
+}
+
+/*
+ * Parse each of the nfiles files on nthreads threads and write one
+ * line per file to out, in the order the files were given, followed
+ * by the parse's messages about the file.  The calling thread is one
+ * of the nthreads.  Returns the number of files that failed.
+ */
+int
+parser_batch(const char **files, int nfiles, int nthreads, FILE *out)
+{
+	batch_t b;
+	batch_worker_t *workers;
+	batch_order_t *order;
+	struct stat st;
+	int i, n, nfailed;
+
+	if (nthreads < 1)
+		nthreads = 1;
+	/* With fewer files than threads, each file gets a share */
+	b.nsplit = nfiles > 0 ? nthreads / nfiles : 1;
+	if (nthreads > nfiles)
+		nthreads = nfiles > 0 ? nfiles : 1;
+
+	b.jobs = NEW_ARRAY(batch_job_t, nfiles);
+	order = NEW_ARRAY(batch_order_t, nfiles);
+	for (i = 0; i < nfiles; ++i) {
+		b.jobs[i].filename = files[i];
+		b.jobs[i].size = stat(files[i], &st) == 0 ? st.st_size : 0;
+		order[i].size = b.jobs[i].size;
+		order[i].job = i;
+	}
+	qsort(order, nfiles, sizeof *order, by_size);
+
+	b.nqueues = nthreads;
+	b.queues = NEW_ARRAY(batch_queue_t, nthreads);
+	for (i = 0; i < nthreads; ++i) {
+		pthread_mutex_init(&b.queues[i].lock, NULL);
+		b.queues[i].jobs = NEW_ARRAY(int, nfiles / nthreads + 1);
+	}
+	for (i = 0; i < nfiles; ++i) {
+		batch_queue_t *q = &b.queues[i % nthreads];
+		q->jobs[q->tail++] = order[i].job;
+	}
+
+	/* Worker 0 is this thread.  The queues of any workers that
+	 * could not be started are emptied by the others.
+	 */
+	workers = NEW_ARRAY(batch_worker_t, nthreads);
+	for (i = 0; i < nthreads; ++i) {
+		workers[i].batch = &b;
+		workers[i].id = i;
+	}
+	for (n = 1; n < nthreads; ++n) {
+		if (pthread_create(&workers[n].thread, NULL, batch_worker,
+							&workers[n]) != 0)
+			break;
+	}
+	batch_worker(&workers[0]);
+	for (i = 1; i < n; ++i)
+		pthread_join(workers[i].thread, NULL);
+
+	nfailed = 0;
+	for (i = 0; i < nfiles; ++i) {
+		if (b.jobs[i].status == 0)
+			fprintf(out, "%s: ok\n", b.jobs[i].filename);
+		else {
+			fprintf(out, "%s: failed: %s\n", b.jobs[i].filename,
+							b.jobs[i].errmsg);
+			++nfailed;
+		}
+		if (b.jobs[i].messages != NULL)
+			fputs(b.jobs[i].messages, out);
+		free(b.jobs[i].messages);
+		free(b.jobs[i].errmsg);
+	}
+
+	for (i = 0; i < nthreads; ++i) {
+		pthread_mutex_destroy(&b.queues[i].lock);
+		free(b.queues[i].jobs);
+	}
+	free(b.queues);
+	free(workers);
+	free(order);
+	free(b.jobs);
+	return nfailed;
+}
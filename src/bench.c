@@ -0,0 +1,1611 @@
+/* bench.c - micro benchmarks for the lexer and parser */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+/*
+ * Usage: bench test [file]
+ *
+ * Each test prints its timings on stdout.  Where a test compares an
+ * old and a new implementation it also checks that they agree, and
+ * exits non-zero if they do not.
+ *
+ *   keywords   keyword/identifier split: linear Keytab scan vs hash
+ *   symtab     name lookup as the global scope grows to 100000 names:
+ *              list walk with strcmp vs the hashed symbol table
+ *   lex        lexer throughput on file, then the same file lexed by
+ *              nthreads independent lexers at once (bench lex file n)
+ *   prelex     file lexed into a token buffer, then parsed from the
+ *              lexer directly and from the buffer
+ *   scan       lexer throughput with each set of scanning loops the
+ *              CPU supports, on file if given, and on generated text
+ *              heavy with comments and long identifiers
+ *   styles     lexer throughput on generated code in several styles:
+ *              dense operators, spread out, long names, comments,
+ *              numbers and string constants
+ *   expr       parse time with expressions by recursive descent and by
+ *              precedence climbing, on file if given, and on generated
+ *              code that is mostly expressions
+ *   lazy       time to lex, to parse, and to parse skipping function
+ *              bodies, on file if given, and on generated code that is
+ *              mostly function bodies; then each skipped body is parsed
+ *              on its own to check that it can be
+ *   edit       parse time after a one character edit, against parsing
+ *              everything again: inside a function body half way
+ *              through file if given, or through generated code of
+ *              50000 lines, and in a declaration there between bodies
+ *   prefix     parse time of a file that starts with 40000 lines of
+ *              generated header, with and without a prefix file saved
+ *              from the header, and the time to load that file
+ *   parallel   parse time on one thread and on nthreads (bench parallel
+ *              file n, default 4), on file if given, and on generated
+ *              code whose typedefs are used all through it; checks that
+ *              the outcome is the same
+ *   index      structural index throughput with each set of scanning
+ *              loops, against lexing and against reading the text with
+ *              memchr(), on file if given, and on generated code with
+ *              comments and constants; checks that the indexes agree
+ *   splitlex   time to lex into a token buffer on one thread and split
+ *              between 2 to nthreads (bench splitlex file n, default 4),
+ *              on file if given, and on generated code; checks that the
+ *              tokens are the same
+ *   ast        parse time with and without building a syntax tree, its
+ *              size, and the time to walk it, on file if given, and on
+ *              generated code, and on a chain of 100000 operands;
+ *              checks that descent and climbing build the same tree
+ *   astfile    parse time against the time to map the tree file saved
+ *              from the parse, and to map it and walk it, on file if
+ *              given, and on 32MB of generated code; checks that the
+ *              tree mapped is the one saved
+ *   events     parse time with no event callbacks, by recursive descent
+ *              without them, and with callbacks that count the rules
+ *              and tokens, on file if given, and on generated code;
+ *              checks that the tokens counted are those matched
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "c_lex.h"
+#include "c_parser.h"
+#include "symtab.h"
+#include "tokbuf.h"
+#include "structidx.h"
+
+typedef struct {
+	const char *name;
+	int len;
+} word_t;
+
+/* The keywords as they were scanned before Keyhash existed. */
+static const char *Oldkeys[] = {
+	"_Bool", "_Complex", "_Imaginary", "auto", "break", "case", "char",
+	"const", "continue", "default", "do", "double", "else", "enum",
+	"extern", "float", "for", "goto", "if", "inline", "int", "long",
+	"register", "restrict", "return", "short", "signed", "sizeof",
+	"static", "struct", "switch", "typedef", "union", "unsigned",
+	"void", "volatile", "while"
+};
+#define NOLDKEYS (sizeof Oldkeys / sizeof *Oldkeys)
+
+static const char Sample[] =
+	"static int count ; unsigned long hash_value ( const char * s , "
+	"size_t len ) { register unsigned long h = 0 ; while ( len -- ) "
+	"h = h * 31 + * s ++ ; return h ; } typedef struct node { int key ; "
+	"struct node * next ; } node_t ; void list_insert ( node_t * head , "
+	"int key ) { node_t * n = malloc ( sizeof * n ) ; if ( n == NULL ) "
+	"return ; n -> key = key ; n -> next = head -> next ; head -> next "
+	"= n ; for ( i = 0 ; i < nitems ; i ++ ) do_something ( items , i ) ; "
+	"else if double float char short enum union switch case default break";
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *
+read_file(const char *filename, size_t *p_len)
+{
+	FILE *fp;
+	char *buf;
+	long len;
+
+	if ((fp = fopen(filename, "rb")) == NULL) {
+		perror(filename);
+		exit(1);
+	}
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	rewind(fp);
+	buf = NEW_ARRAY(char, len + 1);
+	if (fread(buf, 1, len, fp) != (size_t)len) {
+		perror(filename);
+		exit(1);
+	}
+	fclose(fp);
+	*p_len = len;
+	return buf;
+}
+
+/*  Split text into identifier-like words.  The words point into
+ *  text, which must stay NUL terminated for lex_keyword().
+ */
+static word_t *
+split_words(const char *text, int *p_nwords)
+{
+	word_t *words;
+	const char *s, *start;
+	int n, max;
+
+	max = 1024;
+	words = NEW_ARRAY(word_t, max);
+	n = 0;
+	for (s = text; *s != '\0'; ) {
+		if (!isalpha((unsigned char)*s) && *s != '_') {
+			++s;
+			continue;
+		}
+		for (start = s; isalnum((unsigned char)*s) || *s == '_'; ++s)
+			;
+		if (n == max) {
+			max *= 2;
+			words = realloc(words, max * sizeof *words);
+		}
+		words[n].name = start;
+		words[n].len = s - start;
+		++n;
+	}
+	*p_nwords = n;
+	return words;
+}
+
+static int
+old_is_keyword(const char *s, int len)
+{
+	int i;
+
+	for (i = 0; i < NOLDKEYS; ++i)
+		if (memcmp(Oldkeys[i], s, len) == 0 && Oldkeys[i][len] == '\0')
+			return 1;
+	return 0;
+}
+
+static int
+bench_keywords(const char *filename)
+{
+	word_t *words;
+	char *text;
+	size_t len;
+	int nwords, i, pass, npasses;
+	long nkeys_old, nkeys_new;
+	double t0, t_old, t_new;
+
+	for (i = 0; i < NOLDKEYS; ++i) {
+		if (lex_keyword(Oldkeys[i], strlen(Oldkeys[i])) == IDENTIFIER) {
+			printf("keywords: Keyhash does not find \"%s\"\n",
+				Oldkeys[i]);
+			return 1;
+		}
+	}
+
+	if (filename != NULL)
+		text = read_file(filename, &len);
+	else
+		text = string_copy(Sample, sizeof Sample - 1);
+	words = split_words(text, &nwords);
+	if (nwords == 0)
+		return 0;
+	npasses = 20000000 / nwords + 1;
+
+	nkeys_old = 0;
+	t0 = now();
+	for (pass = 0; pass < npasses; ++pass)
+		for (i = 0; i < nwords; ++i)
+			nkeys_old += old_is_keyword(words[i].name, words[i].len);
+	t_old = now() - t0;
+
+	nkeys_new = 0;
+	t0 = now();
+	for (pass = 0; pass < npasses; ++pass)
+		for (i = 0; i < nwords; ++i)
+			nkeys_new += lex_keyword(words[i].name,
+					words[i].len) != IDENTIFIER;
+	t_new = now() - t0;
+
+	printf("keywords: %d words x %d passes, %.1f%% keywords\n", nwords,
+		npasses, 100.0 * nkeys_new / ((double)nwords * npasses));
+	printf("  linear scan  %8.1f Mwords/s\n",
+		nwords * (double)npasses / t_old / 1e6);
+	printf("  perfect hash %8.1f Mwords/s\n",
+		nwords * (double)npasses / t_new / 1e6);
+	if (nkeys_old != nkeys_new) {
+		printf("keywords: MISMATCH %ld vs %ld\n", nkeys_old, nkeys_new);
+		return 1;
+	}
+	return 0;
+}
+
+/* A symbol as find_symbol() used to keep them: on a list, by name. */
+typedef struct {
+	link_t link;
+	const char *name;
+} oldsym_t;
+
+static const char *
+old_find_symbol(list_t *symbols, const char *name)
+{
+	oldsym_t *sym;
+
+	for (sym = list_first(symbols); sym != 0; sym = list_next(symbols, sym))
+		if (strcmp(sym->name, name) == 0)
+			return sym->name;
+	return 0;
+}
+
+static int
+bench_symtab_size(int nglobals)
+{
+	enum { NLOOKUPS = 4000000, NOLDLOOKUPS = 2000, NLOCALS = 16 };
+	atom_table_t atoms;
+	symtab_t st;
+	list_t oldsyms;
+	oldsym_t *oldsym;
+	const atom_t **names;
+	char buf[32];
+	int i, nfound, noldfound, ok;
+	double t0, t_old, t_new;
+
+	atom_table_init(&atoms);
+	symtab_init(&st);
+	list_init(&oldsyms);
+	names = NEW_ARRAY(const atom_t *, nglobals);
+	for (i = 0; i < nglobals; ++i) {
+		sprintf(buf, "global_%d", i);
+		names[i] = atom_intern(&atoms, buf, strlen(buf),
+					atom_hash(buf, strlen(buf)));
+		symtab_install(&st, names[i], EXTERN, 0);
+		oldsym = NEW(oldsym_t);
+		oldsym->name = names[i]->at_name;
+		list_append(&oldsyms, oldsym);
+	}
+	/* A function body's worth of locals, hiding some of the globals. */
+	symtab_enter_scope(&st, 1);
+	for (i = 0; i < NLOCALS; ++i)
+		symtab_install(&st, names[i * 7 % nglobals], AUTO, 0);
+
+	srand(1);
+	nfound = 0;
+	t0 = now();
+	for (i = 0; i < NLOOKUPS; ++i)
+		nfound += symtab_lookup(&st, names[rand() % nglobals]) != 0;
+	t_new = now() - t0;
+
+	noldfound = 0;
+	t0 = now();
+	for (i = 0; i < NOLDLOOKUPS; ++i)
+		noldfound += old_find_symbol(&oldsyms,
+				names[rand() % nglobals]->at_name) != 0;
+	t_old = now() - t0;
+
+	printf("  %6d globals  list %10.1f ns/lookup  hash %6.1f ns/lookup\n",
+		nglobals, t_old / NOLDLOOKUPS * 1e9, t_new / NLOOKUPS * 1e9);
+	ok = nfound == NLOOKUPS && noldfound == NOLDLOOKUPS;
+
+	symtab_exit_scope(&st);
+	for (i = 0; i < NLOCALS; ++i)
+		if (symtab_lookup(&st, names[i * 7 % nglobals])->storage_class
+								!= EXTERN)
+			ok = 0;
+
+	while ((oldsym = list_pop(&oldsyms)) != 0)
+		free(oldsym);
+	free(names);
+	symtab_free(&st);
+	atom_table_free(&atoms);
+	return ok;
+}
+
+static int
+bench_symtab(void)
+{
+	int n;
+
+	printf("symtab: random lookups of declared names\n");
+	for (n = 100; n <= 100000; n *= 10) {
+		if (!bench_symtab_size(n)) {
+			printf("symtab: lookup returned the wrong symbol\n");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+typedef struct {
+	const char *filename;
+	long ntokens;
+	double seconds;
+} lexjob_t;
+
+/*  Lex a whole file with a lexer of its own, counting tokens.
+ */
+static void *
+lex_file(void *arg)
+{
+	lexjob_t *job = arg;
+	lex_env_t le;
+	atom_table_t atoms;
+	double t0;
+
+	lex_init(&le);
+	atom_table_init(&atoms);
+	le.le_atoms = &atoms;
+	if (lex_map_file(&le, job->filename) != 0) {
+		perror(job->filename);
+		exit(1);
+	}
+	le.le_filename = job->filename;
+	job->ntokens = 0;
+	t0 = now();
+	while (lex_get_token(&le) != 0)
+		++job->ntokens;
+	job->seconds = now() - t0;
+	lex_unmap_file(&le);
+	lex_free(&le);
+	atom_table_free(&atoms);
+	return NULL;
+}
+
+static int
+bench_lex(const char *filename, int nthreads)
+{
+	lexjob_t one, *jobs;
+	pthread_t *threads;
+	double t0, elapsed;
+	int i, ok;
+
+	if (filename == NULL) {
+		fprintf(stderr, "bench lex: need a file\n");
+		return 2;
+	}
+	one.filename = filename;
+	lex_file(&one);
+	printf("lex: %ld tokens in %.3fs, %.1f Mtokens/s\n", one.ntokens,
+		one.seconds, one.ntokens / one.seconds / 1e6);
+
+	jobs = NEW_ARRAY(lexjob_t, nthreads);
+	threads = NEW_ARRAY(pthread_t, nthreads);
+	t0 = now();
+	for (i = 0; i < nthreads; ++i) {
+		jobs[i].filename = filename;
+		pthread_create(&threads[i], NULL, lex_file, &jobs[i]);
+	}
+	ok = 1;
+	for (i = 0; i < nthreads; ++i) {
+		pthread_join(threads[i], NULL);
+		if (jobs[i].ntokens != one.ntokens)
+			ok = 0;
+	}
+	elapsed = now() - t0;
+	printf("lex: %d threads in %.3fs, %.1f Mtokens/s\n", nthreads,
+		elapsed, one.ntokens * (double)nthreads / elapsed / 1e6);
+	free(jobs);
+	free(threads);
+	if (!ok) {
+		printf("lex: threads disagree on the token count\n");
+		return 1;
+	}
+	return 0;
+}
+
+/*  Time the lexer on its own by filling a token buffer, and the parser
+ *  reading tokens from the lexer and from the buffer; the difference
+ *  between the last and the lexing time is the parser's share.
+ */
+static int
+bench_prelex(const char *filename)
+{
+	lex_env_t le;
+	atom_table_t atoms;
+	tokbuf_t tb;
+	parser_t *p;
+	char *text;
+	size_t len;
+	double t0, lex_time, direct_time, prelex_time;
+	int ntokens, ok;
+
+	if (filename == NULL) {
+		fprintf(stderr, "bench prelex: need a file\n");
+		return 2;
+	}
+	text = read_file(filename, &len);
+
+	lex_init(&le);
+	atom_table_init(&atoms);
+	tokbuf_init(&tb);
+	le.le_atoms = &atoms;
+	le.le_buf = text;
+	le.le_buflen = len;
+	le.le_filename = filename;
+	t0 = now();
+	ntokens = tokbuf_fill(&tb, &le);
+	lex_time = now() - t0;
+	printf("prelex: %d tokens in %.3fs, %.1f Mtokens/s, %.1f bytes/token\n",
+		ntokens, lex_time, ntokens / lex_time / 1e6,
+		(double)tb.tb_size * (1 + 3 * sizeof(unsigned int)) / ntokens);
+	tokbuf_free(&tb);
+	lex_free(&le);
+	atom_table_free(&atoms);
+
+	p = parser_create();
+	parser_set_debug(p, 0);
+	t0 = now();
+	ok = parser_parse_buffer(p, text, len, filename) == 0;
+	direct_time = now() - t0;
+	parser_set_prelex(p, 1);
+	t0 = now();
+	ok &= parser_parse_buffer(p, text, len, filename) == 0;
+	prelex_time = now() - t0;
+	parser_destroy(p);
+	free(text);
+
+	printf("parse: from lexer %.3fs, from token buffer %.3fs "
+		"(lex %.3fs + parse %.3fs)\n", direct_time, prelex_time,
+		lex_time, prelex_time - lex_time);
+	if (!ok) {
+		printf("parse: %s did not parse\n", filename);
+		return 1;
+	}
+	return 0;
+}
+
+/*  Lex text once with the scanning loops ls, returning the token count.
+ */
+static long
+lex_text(const lex_scan_t *ls, const char *text, size_t len)
+{
+	lex_env_t le;
+	atom_table_t atoms;
+	long ntokens;
+
+	lex_init(&le);
+	le.le_scan = ls;
+	atom_table_init(&atoms);
+	le.le_atoms = &atoms;
+	le.le_buf = text;
+	le.le_buflen = len;
+	le.le_filename = "bench";
+	ntokens = 0;
+	while (lex_get_token(&le) != 0)
+		++ntokens;
+	lex_free(&le);
+	atom_table_free(&atoms);
+	return ntokens;
+}
+
+/*  Lex text reps times with each set of scanners and report the best
+ *  time, as the quickest run is the one least disturbed.
+ */
+static int
+scan_text(const char *what, const char *text, size_t len, int reps)
+{
+	const lex_scan_t *ls;
+	long ntokens, first;
+	double t0, elapsed;
+	int i, r, ok;
+
+	ok = 1;
+	first = -1;
+	for (i = 0; (ls = lex_scan_list(i)) != NULL; ++i) {
+		elapsed = 0;
+		for (r = 0; r < reps; ++r) {
+			t0 = now();
+			ntokens = lex_text(ls, text, len);
+			t0 = now() - t0;
+			if (r == 0 || t0 < elapsed)
+				elapsed = t0;
+		}
+		printf("scan: %-10s %-6s %8ld tokens %8.3fms %7.1f MB/s\n",
+			what, ls->ls_name, ntokens, elapsed * 1e3,
+			len / elapsed / 1e6);
+		if (first == -1)
+			first = ntokens;
+		else if (ntokens != first)
+			ok = 0;
+	}
+	if (!ok)
+		printf("scan: %s: token counts differ\n", what);
+	return ok;
+}
+
+static int
+bench_scan(const char *filename)
+{
+	static const char header[] =
+		"/*\n"
+		" *  This program is free software; you can redistribute it\n"
+		" *  and/or modify it under the terms of the GNU General Public\n"
+		" *  License as published by the Free Software Foundation.\n"
+		" */\n";
+	static const char decl[] =
+		"static const struct generated_register_description_table_t\n"
+		"\tgenerated_register_description_table_for_device_%05d = {\n"
+		"\t\tGENERATED_REGISTER_DESCRIPTION_DEFAULT_INITIALIZER_VALUE\n"
+		"\t};\n";
+	char *text, *s;
+	size_t len;
+	int i, n, ok;
+
+	ok = 1;
+	if (filename != NULL) {
+		text = read_file(filename, &len);
+		ok &= scan_text("file", text, len, 20);
+		free(text);
+	}
+
+	n = 20000;
+	text = NEW_ARRAY(char, n * (sizeof header + sizeof decl + 8) + 1);
+	for (s = text, i = 0; i < n; ++i) {
+		strcpy(s, header);
+		s += strlen(s);
+		s += sprintf(s, decl, i);
+	}
+	len = s - text;
+	ok &= scan_text("generated", text, len, 20);
+	free(text);
+	return ok ? 0 : 1;
+}
+
+static const struct {
+	const char *name;
+	const char *text;
+} Styles[] = {
+	{ "dense",
+	  "a[i]+=b[j]<<2;x->y=p&&q||!r;k>>=1;m%=n--;z=(c?d:e)^~f;"
+	  "if(u<=v&&w!=t)s|=1<<k;g=h->i.j*-k/l;o&=~p;q<<=r>=s;\n" },
+	{ "spread",
+	  "\tif ( count >= limit )\n\t{\n\t\ttotal = total + value ;\n"
+	  "\t\tindex ++ ;\n\t}\n\telse\n\t\treturn ( total ) ;\n\n" },
+	{ "names",
+	  "generated_register_description_table_for_device = "
+	  "GENERATED_REGISTER_DESCRIPTION_DEFAULT_INITIALIZER_VALUE ; "
+	  "another_rather_long_function_name ( first_argument_name , "
+	  "second_argument_name ) ;\n" },
+	{ "comments",
+	  "/* This function does something quite ordinary and this\n"
+	  " * comment says so at some length. */\n"
+	  "x = y ; /* and a short one */\n" },
+	{ "numbers",
+	  "1234567, 0x7fffffff, 42, 0, 1000000UL, 0755, 3.14159, "
+	  "2.5e-10, 17L, 99999, 0xdeadbeef, 65535, 1e6, 8, 16, 32,\n" },
+	{ "strings",
+	  "error(\"%s: cannot open file for reading, giving up\\n\", name);\n"
+	  "usage = \"usage: prog [-v] [-o output] \"\n"
+	  "\t\"[-I directory] file ...\\n\";\n"
+	  "puts(\"\\tdone\"); msg = \"\"; s = \"ok\";\n" },
+};
+#define NSTYLES	(sizeof Styles / sizeof *Styles)
+
+/*  The same amount of each style of code, lexed with the best scanners.
+ *  A lexer whose speed does not depend much on how the code is written
+ *  shows roughly the same MB/s on each.
+ */
+static int
+bench_styles(void)
+{
+	const lex_scan_t *ls;
+	char *text, *s;
+	size_t len, n;
+	long ntokens;
+	double t0, elapsed;
+	unsigned int i;
+	int r;
+
+	ls = lex_scan_select(NULL);
+	for (i = 0; i < NSTYLES; ++i) {
+		n = strlen(Styles[i].text);
+		text = NEW_ARRAY(char, 4 * 1024 * 1024 + n + 1);
+		for (s = text; s - text < 4 * 1024 * 1024; s += n)
+			memcpy(s, Styles[i].text, n);
+		*s = '\0';
+		len = s - text;
+		elapsed = 0;
+		for (r = 0; r < 10; ++r) {
+			t0 = now();
+			ntokens = lex_text(ls, text, len);
+			t0 = now() - t0;
+			if (r == 0 || t0 < elapsed)
+				elapsed = t0;
+		}
+		printf("styles: %-8s %8ld tokens %8.3fms %7.1f MB/s "
+			"%6.1f Mtokens/s\n", Styles[i].name, ntokens,
+			elapsed * 1e3, len / elapsed / 1e6,
+			ntokens / elapsed / 1e6);
+		free(text);
+	}
+	return 0;
+}
+
+/*  Parse text reps times with each expression engine and report the
+ *  best times.
+ */
+static int
+parse_engines(const char *what, const char *text, size_t len, int reps)
+{
+	parser_t *p;
+	double t0, best[2];
+	int descent, r, ok;
+
+	p = parser_create();
+	parser_set_debug(p, 0);
+	ok = 1;
+	for (descent = 0; descent < 2; ++descent) {
+		parser_set_descent(p, descent);
+		for (r = 0; r < reps; ++r) {
+			t0 = now();
+			ok &= parser_parse_buffer(p, text, len, what) == 0;
+			t0 = now() - t0;
+			if (r == 0 || t0 < best[descent])
+				best[descent] = t0;
+		}
+	}
+	parser_destroy(p);
+	printf("expr: %-10s descent %8.3fms climbing %8.3fms %5.2fx\n", what,
+		best[1] * 1e3, best[0] * 1e3, best[1] / best[0]);
+	if (!ok)
+		printf("expr: %s did not parse\n", what);
+	return ok;
+}
+
+static int
+bench_expr(const char *filename)
+{
+	static const char body[] =
+		"\tr = a * b + c[i] - (d << 2) / e % f & g | h ^ ~k;\n"
+		"\tx += g(a, b + 1) * sizeof(int) - (long)y->z;\n"
+		"\tif (m && !n || p >= q && s.t != 0)\n"
+		"\t\tw = u ? v : -w;\n"
+		"\tn = i++ < j-- ? *q : t[2 * i + 1];\n";
+	char *text, *s;
+	size_t len, n;
+	int ok;
+
+	ok = 1;
+	if (filename != NULL) {
+		text = read_file(filename, &len);
+		ok &= parse_engines(filename, text, len, 10);
+		free(text);
+	}
+
+	n = strlen(body);
+	text = NEW_ARRAY(char, 4 * 1024 * 1024 + n + 64);
+	s = text + sprintf(text, "void f(void)\n{\n");
+	while (s - text < 4 * 1024 * 1024) {
+		memcpy(s, body, n);
+		s += n;
+	}
+	s += sprintf(s, "}\n");
+	len = s - text;
+	ok &= parse_engines("generated", text, len, 10);
+	free(text);
+	return ok ? 0 : 1;
+}
+
+static int
+parse_lazily(const char *what, const char *text, size_t len, int reps)
+{
+	parser_t *p;
+	double t0, best[3];
+	int lazy, r, i, n, ok;
+
+	for (r = 0; r < reps; ++r) {
+		t0 = now();
+		lex_text(lex_scan_select(NULL), text, len);
+		t0 = now() - t0;
+		if (r == 0 || t0 < best[2])
+			best[2] = t0;
+	}
+	p = parser_create();
+	parser_set_debug(p, 0);
+	ok = 1;
+	for (lazy = 0; lazy < 2; ++lazy) {
+		parser_set_lazy(p, lazy);
+		for (r = 0; r < reps; ++r) {
+			t0 = now();
+			ok &= parser_parse_buffer(p, text, len, what) == 0;
+			t0 = now() - t0;
+			if (r == 0 || t0 < best[lazy])
+				best[lazy] = t0;
+		}
+	}
+	n = parser_body_count(p);
+	for (i = 0; i < n; ++i)
+		ok &= parser_parse_body(p, i) == 0;
+	parser_destroy(p);
+	printf("lazy: %-10s lex %8.3fms parse %8.3fms lazy %8.3fms, "
+		"%d bodies\n", what, best[2] * 1e3, best[0] * 1e3,
+		best[1] * 1e3, n);
+	if (!ok)
+		printf("lazy: %s did not parse\n", what);
+	return ok;
+}
+
+static int
+bench_lazy(const char *filename)
+{
+	static const char func[] =
+		"int\nf%d(int a, int b, const char *s)\n{\n"
+		"\tint i, n = 0;\n\n"
+		"\tfor (i = 0; s[i] != '\\0'; ++i) {\n"
+		"\t\tif (s[i] == '{' || s[i] == '}')\n"
+		"\t\t\tn += a * i - b;\n"
+		"\t\telse {\n"
+		"\t\t\t/* not a brace */\n"
+		"\t\t\tn ^= (n << 3) + strlen(\"}\");\n"
+		"\t\t}\n"
+		"\t}\n"
+		"\treturn n;\n}\n\n";
+	char *text, *s;
+	size_t len;
+	int i, ok;
+
+	ok = 1;
+	if (filename != NULL) {
+		text = read_file(filename, &len);
+		ok &= parse_lazily(filename, text, len, 10);
+		free(text);
+	}
+
+	text = NEW_ARRAY(char, 4 * 1024 * 1024 + sizeof func + 64);
+	s = text + sprintf(text, "int strlen(const char *s);\n");
+	for (i = 0; s - text < 4 * 1024 * 1024; ++i)
+		s += sprintf(s, func, i);
+	len = s - text;
+	ok &= parse_lazily("generated", text, len, 10);
+	free(text);
+	return ok ? 0 : 1;
+}
+
+/*
+ * Time reps edits at offset, each putting in a space and then taking it
+ * out again, and check that the outcome is that of a full parse.
+ */
+static int
+time_edits(parser_t *p, const char *what, char *text, size_t len,
+		size_t offset, int reps)
+{
+	parser_t *full;
+	double t0, best;
+	int r, status;
+
+	full = parser_create();
+	parser_set_debug(full, 0);
+	best = 0;
+	for (r = 0; r < reps; ++r) {
+		t0 = now();
+		status = parser_edit(p, offset, 0, " ", 1);
+		t0 = now() - t0;
+		if (r == 0 || t0 < best)
+			best = t0;
+		if (parser_edit(p, offset, 1, "", 0) != status)
+			break;
+	}
+	memmove(text + offset + 1, text + offset, len - offset + 1);
+	text[offset] = ' ';
+	r = r == reps && parser_parse_buffer(full, text, len + 1, what) ==
+									status;
+	memmove(text + offset, text + offset + 1, len - offset + 1);
+	parser_destroy(full);
+	printf("edit: %-10s %8.3fms\n", what, best * 1e3);
+	if (!r)
+		printf("edit: %s does not agree with a full parse\n", what);
+	return r;
+}
+
+static int
+bench_edit(const char *filename)
+{
+	static const char func[] =
+		"int\nf%d(int a, int b, const char *s)\n{\n"
+		"\tint i, n = 0;\n\n"
+		"\tfor (i = 0; s[i] != '\\0'; ++i) {\n"
+		"\t\tif (s[i] == '{' || s[i] == '}')\n"
+		"\t\t\tn += a * i - b;\n"
+		"\t}\n"
+		"\treturn n;\n}\n\n"
+		"static int v%d;\n\n";
+	parser_body_t body;
+	parser_t *p;
+	char *text, *s;
+	size_t len;
+	double t0;
+	int i, lines, ok;
+
+	if (filename != NULL) {
+		text = read_file(filename, &len);
+		text = safe_realloc(text, len + 2);
+	}
+	else {
+		text = NEW_ARRAY(char, 50000 * 30);
+		s = text;
+		for (i = 0, lines = 0; lines < 50000; ++i, lines += 12)
+			s += sprintf(s, func, i, i);
+		len = s - text;
+	}
+
+	p = parser_create();
+	parser_set_debug(p, 0);
+	parser_set_incremental(p, 1);
+	t0 = now();
+	ok = parser_parse_buffer(p, text, len, "edit") == 0;
+	printf("edit: full parse %8.3fms\n", (now() - t0) * 1e3);
+
+	/* Just inside the function body half way through, and just after
+	 * it, which is outside any body.
+	 */
+	if (parser_body_count(p) > 0) {
+		body = *parser_body(p, parser_body_count(p) / 2);
+		ok &= time_edits(p, "body", text, len, body.pb_start + 1, 100);
+		ok &= time_edits(p, "top level", text, len, body.pb_end, 10);
+	}
+	parser_destroy(p);
+	free(text);
+	return ok ? 0 : 1;
+}
+
+/*
+ * Write 40000 lines of typedefs and prototypes, in the form of
+ * preprocessor output from headers, to s as though for unit; returns
+ * the end.
+ */
+static char *
+gen_header(char *s, const char *unit)
+{
+	int i;
+
+	s += sprintf(s, "# 1 \"%s\"\n", unit);
+	for (i = 0; i < 10000; ++i) {
+		if (i % 100 == 0)
+			s += sprintf(s, "# 1 \"/usr/include/gen%d.h\" 1\n", i);
+		s += sprintf(s, "typedef struct s%d { int a; long b; } T%d;\n"
+			"extern T%d *f%d(const T%d *p, int n);\n"
+			"extern int v%d;\n\n", i, i, i, i, i, i);
+	}
+	return s + sprintf(s, "# 2 \"%s\" 2\n", unit);
+}
+
+static int
+bench_prefix(void)
+{
+	static const char tail[] =
+		"T9999 *\nuse(T1 *p)\n{\n\treturn (T9999 *) f1(p, v2);\n}\n";
+	char header[] = "/tmp/benchXXXXXX";
+	char pfx[sizeof header + 4];
+	parser_t *p;
+	FILE *fp;
+	char *text, *s;
+	size_t len;
+	double t0, best[3];
+	int r, ok;
+
+	text = NEW_ARRAY(char, 4 * 1024 * 1024);
+	s = gen_header(text, "header.c");
+	if ((r = mkstemp(header)) == -1 || (fp = fdopen(r, "w")) == NULL ||
+		fwrite(text, 1, s - text, fp) != (size_t)(s - text) ||
+		fclose(fp) != 0) {
+		perror(header);
+		return 2;
+	}
+	sprintf(pfx, "%s.pfx", header);
+	p = parser_create();
+	parser_set_debug(p, 0);
+	ok = parser_save_prefix(p, header, pfx) == 0;
+
+	s = gen_header(text, "unit.c");
+	s += sprintf(s, "%s", tail);
+	len = s - text;
+	for (r = 0; r < 10; ++r) {
+		t0 = now();
+		ok &= parser_parse_buffer(p, text, len, "unit.c") == 0;
+		t0 = now() - t0;
+		if (r == 0 || t0 < best[0])
+			best[0] = t0;
+
+		t0 = now();
+		ok &= parser_load_prefix(p, pfx) == 0;
+		t0 = now() - t0;
+		if (r == 0 || t0 < best[1])
+			best[1] = t0;
+
+		t0 = now();
+		ok &= parser_parse_buffer(p, text, len, "unit.c") == 0;
+		t0 = now() - t0;
+		if (r == 0 || t0 < best[2])
+			best[2] = t0;
+		parser_load_prefix(p, NULL);
+	}
+	printf("prefix: parse %8.3fms load %8.3fms parse with prefix %8.3fms\n",
+		best[0] * 1e3, best[1] * 1e3, best[2] * 1e3);
+	if (!ok)
+		printf("prefix: %s\n", parser_error(p));
+	parser_destroy(p);
+	remove(pfx);
+	remove(header);
+	free(text);
+	return ok ? 0 : 1;
+}
+
+static int
+parse_threaded(const char *what, const char *text, size_t len, int nthreads,
+		int reps)
+{
+	parser_t *p;
+	double t0, best[2];
+	char *errmsg;
+	int i, r, status[2], ok;
+
+	p = parser_create();
+	parser_set_debug(p, 0);
+	errmsg = NULL;
+	for (i = 0; i < 2; ++i) {
+		parser_set_threads(p, i == 0 ? 1 : nthreads);
+		for (r = 0; r < reps; ++r) {
+			t0 = now();
+			status[i] = parser_parse_buffer(p, text, len, what);
+			t0 = now() - t0;
+			if (r == 0 || t0 < best[i])
+				best[i] = t0;
+		}
+		if (i == 0)
+			errmsg = string_copy(parser_error(p),
+						strlen(parser_error(p)));
+	}
+	ok = status[0] == status[1] && strcmp(errmsg, parser_error(p)) == 0;
+	printf("parallel: %-10s 1 thread %8.3fms %d threads %8.3fms%s\n",
+		what, best[0] * 1e3, nthreads, best[1] * 1e3,
+		status[0] == 0 ? "" : " (failed)");
+	if (!ok)
+		printf("parallel: %s: \"%s\" on one thread, \"%s\" on %d\n",
+			what, errmsg, parser_error(p), nthreads);
+	free(errmsg);
+	parser_destroy(p);
+	return ok;
+}
+
+static int
+bench_parallel(const char *filename, int nthreads)
+{
+	static const char func[] =
+		"typedef struct s%d { T%d *next; int a; } T%d;\n"
+		"static T%d *\nf%d(T%d *p, int n)\n{\n"
+		"\tT%d *q = (T%d *) p->next;\n\n"
+		"\twhile (n-- > 0 && q != 0)\n"
+		"\t\tq = (T%d *) q->next;\n"
+		"\treturn (T%d *) q;\n}\n\n";
+	char *text, *s;
+	size_t len;
+	int i, ok;
+
+	ok = 1;
+	if (filename != NULL) {
+		text = read_file(filename, &len);
+		ok &= parse_threaded(filename, text, len, nthreads, 10);
+		free(text);
+	}
+
+	text = NEW_ARRAY(char, 8 * 1024 * 1024 + sizeof func + 64);
+	s = text + sprintf(text, "typedef int T0;\n");
+	for (i = 1; s - text < 8 * 1024 * 1024; ++i)
+		s += sprintf(s, func, i, i - 1, i, i - 1, i, i, i - 1, i - 1,
+				i - 1, i - 1);
+	len = s - text;
+	ok &= parse_threaded("generated", text, len, nthreads, 10);
+	free(text);
+	return ok ? 0 : 1;
+}
+
+/*  Index text reps times with each set of scanners, reporting the best
+ *  times as scan_text() does, after those for lexing it and for a
+ *  memchr() that finds nothing, which reads it as fast as anything.
+ */
+static int
+index_text(const char *what, const char *text, size_t len, int reps)
+{
+	const lex_scan_t *ls;
+	structidx_t si;
+	size_t first;
+	double t0, best;
+	int i, r, ok;
+
+	best = 0;
+	for (r = 0; r < reps; ++r) {
+		t0 = now();
+		if (memchr(text, '\1', len) != NULL)
+			printf("index: %s has a \\1 in it\n", what);
+		t0 = now() - t0;
+		if (r == 0 || t0 < best)
+			best = t0;
+	}
+	printf("index: %-10s memchr %8.3fms %7.1f MB/s\n", what,
+		best * 1e3, len / best / 1e6);
+	for (r = 0; r < reps; ++r) {
+		t0 = now();
+		lex_text(lex_scan_select(NULL), text, len);
+		t0 = now() - t0;
+		if (r == 0 || t0 < best)
+			best = t0;
+	}
+	printf("index: %-10s lex    %8.3fms %7.1f MB/s\n", what,
+		best * 1e3, len / best / 1e6);
+
+	ok = 1;
+	first = 0;
+	structidx_init(&si);
+	for (i = 0; (ls = lex_scan_list(i)) != NULL; ++i) {
+		for (r = 0; r < reps; ++r) {
+			t0 = now();
+			structidx_build(&si, text, len, ls);
+			t0 = now() - t0;
+			if (r == 0 || t0 < best)
+				best = t0;
+		}
+		printf("index: %-10s %-6s %8.3fms %7.1f MB/s, %lu entries\n",
+			what, ls->ls_name, best * 1e3, len / best / 1e6,
+			(unsigned long)si.si_count);
+		if (i == 0)
+			first = si.si_count;
+		else if (si.si_count != first)
+			ok = 0;
+	}
+	structidx_free(&si);
+	if (!ok)
+		printf("index: %s: entry counts differ\n", what);
+	return ok;
+}
+
+static int
+bench_index(const char *filename)
+{
+	static const char func[] =
+		"/*\n * f%d - count the braces in s, \"{\" or '}'\n */\n"
+		"int\nf%d(int a, int b, const char *s)\n{\n"
+		"\tint i, n = 0, v[4] = { 1, 2, 3, 4 };\n\n"
+		"\tfor (i = 0; s[i] != '\\0'; ++i) {\n"
+		"\t\tif (s[i] == '{' || s[i] == '}')\n"
+		"\t\t\tn += a * v[i & 3] - b;\n"
+		"\t\telse\n"
+		"\t\t\tn ^= (n << 3) + printf(\"%%d;\\n\", i);\n"
+		"\t}\n"
+		"\treturn n;\n}\n\n";
+	char *text, *s;
+	size_t len;
+	int i, ok;
+
+	ok = 1;
+	if (filename != NULL) {
+		text = read_file(filename, &len);
+		ok &= index_text(filename, text, len, 20);
+		free(text);
+	}
+
+	text = NEW_ARRAY(char, 16 * 1024 * 1024 + sizeof func + 64);
+	for (s = text, i = 0; s - text < 16 * 1024 * 1024; ++i)
+		s += sprintf(s, func, i, i);
+	len = s - text;
+	ok &= index_text("generated", text, len, 20);
+	free(text);
+	return ok ? 0 : 1;
+}
+
+/*  Lex text into a token buffer on nthreads threads, best of reps runs,
+ *  and check the tokens against ref unless it is NULL.
+ */
+static int
+split_text(const char *what, const char *text, size_t len, int nthreads,
+		tokbuf_t *ref, tokbuf_t *tb, int reps)
+{
+	lex_env_t le;
+	atom_table_t atoms;
+	double t0, best;
+	int r, ok;
+
+	best = 0;
+	for (r = 0; r < reps; ++r) {
+		lex_init(&le);
+		atom_table_init(&atoms);
+		le.le_atoms = &atoms;
+		le.le_buf = text;
+		le.le_buflen = len;
+		le.le_filename = what;
+		tokbuf_free(tb);
+		tokbuf_init(tb);
+		t0 = now();
+		tokbuf_fill_split(tb, &le, nthreads);
+		t0 = now() - t0;
+		if (r == 0 || t0 < best)
+			best = t0;
+		lex_free(&le);
+		atom_table_free(&atoms);
+	}
+	printf("splitlex: %-10s %d thread%s %8.3fms %7.1f MB/s, %u tokens\n",
+		what, nthreads, nthreads == 1 ? " " : "s", best * 1e3,
+		len / best / 1e6, tb->tb_count);
+	if (ref == NULL)
+		return 1;
+	ok = ref->tb_count == tb->tb_count &&
+		memcmp(ref->tb_kind, tb->tb_kind, tb->tb_count) == 0 &&
+		memcmp(ref->tb_offset, tb->tb_offset,
+			tb->tb_count * sizeof *tb->tb_offset) == 0 &&
+		memcmp(ref->tb_length, tb->tb_length,
+			tb->tb_count * sizeof *tb->tb_length) == 0 &&
+		memcmp(ref->tb_index, tb->tb_index,
+			tb->tb_count * sizeof *tb->tb_index) == 0;
+	if (!ok)
+		printf("splitlex: %s: %d threads disagree with one\n", what,
+			nthreads);
+	return ok;
+}
+
+static int
+splitlex_text(const char *what, const char *text, size_t len, int nthreads)
+{
+	tokbuf_t ref, tb;
+	int n, ok;
+
+	tokbuf_init(&ref);
+	tokbuf_init(&tb);
+	ok = split_text(what, text, len, 1, NULL, &ref, 5);
+	for (n = 2; n <= nthreads; ++n)
+		ok &= split_text(what, text, len, n, &ref, &tb, 5);
+	tokbuf_free(&ref);
+	tokbuf_free(&tb);
+	return ok;
+}
+
+static int
+bench_splitlex(const char *filename, int nthreads)
+{
+	static const char func[] =
+		"/* f%d - a function\n * in a comment; { */\n"
+		"static const char *s%d = \"a string; {\";\n"
+		"int\nf%d(int a, int b)\n{\n"
+		"\tint i, n = 0;\n\n"
+		"\tfor (i = 0; i < a; ++i)\n"
+		"\t\tn += b * i - 0x%x;\n"
+		"\treturn n;\n}\n\n";
+	char *text, *s;
+	size_t len;
+	int i, ok;
+
+	ok = 1;
+	if (filename != NULL) {
+		text = read_file(filename, &len);
+		ok &= splitlex_text(filename, text, len, nthreads);
+		free(text);
+	}
+
+	text = NEW_ARRAY(char, 16 * 1024 * 1024 + sizeof func + 64);
+	for (s = text, i = 0; s - text < 16 * 1024 * 1024; ++i)
+		s += sprintf(s, func, i, i, i, i);
+	len = s - text;
+	ok &= splitlex_text("generated", text, len, nthreads);
+	free(text);
+	return ok ? 0 : 1;
+}
+
+/*
+ * Visit every node of t in order, keeping the end of each subtree that
+ * is open, as a pass over the tree would.  Returns how deep it goes,
+ * and counts the names.
+ */
+static int
+walk_tree(const ast_t *t, unsigned int *nnames)
+{
+	unsigned int *ends;
+	unsigned int i;
+	int depth, deepest, size;
+
+	size = 1024;
+	ends = NEW_ARRAY(unsigned int, size);
+	deepest = depth = 0;
+	*nnames = 0;
+	for (i = 0; i < t->ast_count; ++i) {
+		while (depth > 0 && ends[depth - 1] <= i)
+			--depth;
+		if (t->ast_nodes[i].an_kind == AST_NAME)
+			++*nnames;
+		if (t->ast_nodes[i].an_size > 1) {
+			if (depth == size) {
+				size *= 2;
+				ends = safe_realloc(ends, size * sizeof *ends);
+			}
+			ends[depth++] = i + t->ast_nodes[i].an_size;
+			if (depth > deepest)
+				deepest = depth;
+		}
+	}
+	free(ends);
+	return deepest;
+}
+
+static int
+ast_text(const char *what, const char *text, size_t len, int reps)
+{
+	parser_t *p;
+	ast_t t, d;
+	double t0, best[3];
+	unsigned int nnames;
+	int r, on, ok, deepest;
+
+	p = parser_create();
+	parser_set_debug(p, 0);
+	ok = 1;
+	for (on = 0; on < 2; ++on) {
+		parser_set_ast(p, on);
+		for (r = 0; r < reps; ++r) {
+			t0 = now();
+			ok &= parser_parse_buffer(p, text, len, what) == 0;
+			t0 = now() - t0;
+			if (r == 0 || t0 < best[on])
+				best[on] = t0;
+		}
+	}
+	ok &= parser_take_ast(p, &t) == 0;
+	parser_set_descent(p, 1);
+	ok &= parser_parse_buffer(p, text, len, what) == 0;
+	ok &= parser_take_ast(p, &d) == 0;
+	parser_destroy(p);
+	if (!ok) {
+		printf("ast: %s did not parse\n", what);
+		return 0;
+	}
+	ok = t.ast_count == d.ast_count && t.ast_textlen == d.ast_textlen &&
+		memcmp(t.ast_nodes, d.ast_nodes,
+			t.ast_count * sizeof *t.ast_nodes) == 0 &&
+		memcmp(t.ast_text, d.ast_text, t.ast_textlen) == 0;
+	if (!ok)
+		printf("ast: %s: descent and climbing build different trees\n",
+			what);
+
+	deepest = 0;
+	for (r = 0; r < reps; ++r) {
+		t0 = now();
+		deepest = walk_tree(&t, &nnames);
+		t0 = now() - t0;
+		if (r == 0 || t0 < best[2])
+			best[2] = t0;
+	}
+	printf("ast: %-10s parse %8.3fms with tree %8.3fms walk %8.3fms, "
+		"%u nodes (%u names, depth %d), %.1fMB\n", what,
+		best[0] * 1e3, best[1] * 1e3, best[2] * 1e3, t.ast_count,
+		nnames, deepest, (t.ast_count * sizeof *t.ast_nodes +
+						t.ast_textlen) / 1048576.0);
+	ast_free(&t);
+	ast_free(&d);
+	return ok;
+}
+
+/*  At least size characters of code for the tree tests.
+ */
+static char *
+gen_tree_code(size_t size, size_t *lenp)
+{
+	static const char func[] =
+		"struct s%d { int a, b[4]; char *name; };\n"
+		"int\nf%d(struct s%d *p, int n)\n{\n"
+		"\tint i, sum = 0;\n\n"
+		"\tfor (i = 0; i < n && p[i].name != 0; ++i) {\n"
+		"\t\tsum += p[i].a * 3 + (p[i].b[i & 3] << 2);\n"
+		"\t\tif (sum > 1000)\n"
+		"\t\t\tsum = sum %% 7 ? -sum : sum / 2;\n"
+		"\t}\n"
+		"\treturn sum + (int)sizeof(struct s%d);\n}\n\n";
+	char *text, *s;
+	int i;
+
+	text = NEW_ARRAY(char, size + sizeof func + 64);
+	for (s = text, i = 0; (size_t)(s - text) < size; ++i)
+		s += sprintf(s, func, i, i, i, i);
+	*lenp = s - text;
+	return text;
+}
+
+/*  One declaration whose initializer is a chain of n operands, each
+ *  with postfix operators, joined by binary operators of each level.
+ */
+static char *
+gen_chain_code(int n, size_t *lenp)
+{
+	static const char *const ops[] = {
+		" * ", " + ", " << ", " < ", " == ", " & ", " ^ ", " | ",
+		" && ", " || "
+	};
+	char *text, *s;
+	int i;
+
+	text = NEW_ARRAY(char, 32 * (size_t)n + 64);
+	s = text + sprintf(text, "int x = ");
+	for (i = 0; i < n; ++i) {
+		if (i > 0)
+			s += sprintf(s, "%s", ops[i % 10]);
+		s += sprintf(s, "a[%d].b(c)++", i % 100);
+	}
+	s += sprintf(s, ";\n");
+	*lenp = s - text;
+	return text;
+}
+
+static int
+bench_ast(const char *filename)
+{
+	char *text;
+	size_t len;
+	int ok;
+
+	ok = 1;
+	if (filename != NULL) {
+		text = read_file(filename, &len);
+		ok &= ast_text(filename, text, len, 10);
+		free(text);
+	}
+
+	text = gen_tree_code(4 * 1024 * 1024, &len);
+	ok &= ast_text("generated", text, len, 10);
+	free(text);
+
+	/* Each operator wraps all of the chain before it */
+	text = gen_chain_code(100000, &len);
+	ok &= ast_text("chain", text, len, 3);
+	free(text);
+	return ok ? 0 : 1;
+}
+
+/*
+ * Time parsing file, or 32MB of generated code, against mapping the
+ * tree file saved from the parse, and against mapping it and walking
+ * the whole tree; check that the tree mapped is the one saved.
+ */
+static int
+bench_astfile(const char *filename)
+{
+	char input[] = "/tmp/benchXXXXXX";
+	char saved[sizeof input + 4];
+	parser_t *p;
+	ast_t t;
+	const ast_t *ref;
+	const char *source;
+	unsigned int nnames;
+	FILE *fp;
+	char *text;
+	size_t len;
+	double t0, best[3];
+	int r, ok;
+
+	if (filename != NULL)
+		text = read_file(filename, &len);
+	else
+		text = gen_tree_code(32 * 1024 * 1024, &len);
+	if ((r = mkstemp(input)) == -1 || (fp = fdopen(r, "w")) == NULL ||
+		fwrite(text, 1, len, fp) != len || fclose(fp) != 0) {
+		perror(input);
+		return 2;
+	}
+	free(text);
+	sprintf(saved, "%s.ast", input);
+
+	p = parser_create();
+	parser_set_debug(p, 0);
+	parser_set_ast_save(p, ".ast");
+	ok = 1;
+	for (r = 0; r < 3; ++r) {
+		t0 = now();
+		ok &= parser_parse_file(p, input) == 0;
+		t0 = now() - t0;
+		if (r == 0 || t0 < best[0])
+			best[0] = t0;
+	}
+	ref = parser_ast(p);
+	if (!ok || ref == NULL) {
+		printf("astfile: %s\n", parser_error(p));
+		parser_destroy(p);
+		remove(input);
+		return 1;
+	}
+
+	for (r = 0; r < 10; ++r) {
+		t0 = now();
+		ok &= ast_map(&t, saved, &source) == 0;
+		t0 = now() - t0;
+		if (r == 0 || t0 < best[1])
+			best[1] = t0;
+		ast_free(&t);
+
+		t0 = now();
+		ok &= ast_map(&t, saved, &source) == 0;
+		walk_tree(&t, &nnames);
+		t0 = now() - t0;
+		if (r == 0 || t0 < best[2])
+			best[2] = t0;
+		if (r == 0)
+			ok &= t.ast_count == ref->ast_count &&
+				t.ast_textlen == ref->ast_textlen &&
+				memcmp(t.ast_nodes, ref->ast_nodes,
+				t.ast_count * sizeof *t.ast_nodes) == 0 &&
+				memcmp(t.ast_text, ref->ast_text,
+						t.ast_textlen) == 0 &&
+				strcmp(source, input) == 0;
+		ast_free(&t);
+	}
+	printf("astfile: %-10s parse %8.3fms map %8.3fms map and walk %8.3fms, "
+		"%u nodes, %.1fMB\n", filename != NULL ? filename : "generated",
+		best[0] * 1e3, best[1] * 1e3, best[2] * 1e3, ref->ast_count,
+		(ref->ast_count * sizeof *ref->ast_nodes + ref->ast_textlen) /
+								1048576.0);
+	if (!ok)
+		printf("astfile: the tree mapped is not the one saved\n");
+	parser_destroy(p);
+	remove(saved);
+	remove(input);
+	return ok ? 0 : 1;
+}
+
+typedef struct {
+	unsigned long begins, ends, tokens, names;
+} counts_t;
+
+static void
+count_begin(void *arg, const char *rule)
+{
+	((counts_t *)arg)->begins++;
+}
+
+static void
+count_end(void *arg, const char *rule)
+{
+	((counts_t *)arg)->ends++;
+}
+
+static void
+count_token(void *arg, const parser_token_t *token)
+{
+	counts_t *c = arg;
+
+	c->tokens++;
+	c->names += token->pt_name != NULL;
+}
+
+static int
+events_text(const char *what, const char *text, size_t len, int reps)
+{
+	static const parser_events_t counters = {
+		count_begin, count_end, count_token
+	};
+	parser_t *p;
+	counts_t c;
+	double t0, best[3];
+	int r, k, ok;
+
+	p = parser_create();
+	parser_set_debug(p, 0);
+	ok = 1;
+	for (k = 0; k < 3; ++k) {
+		parser_set_descent(p, k == 1);
+		parser_set_events(p, k == 2 ? &counters : NULL, &c);
+		for (r = 0; r < reps; ++r) {
+			memset(&c, 0, sizeof c);
+			t0 = now();
+			ok &= parser_parse_buffer(p, text, len, what) == 0;
+			t0 = now() - t0;
+			if (r == 0 || t0 < best[k])
+				best[k] = t0;
+		}
+	}
+	parser_destroy(p);
+	if (!ok) {
+		printf("events: %s did not parse\n", what);
+		return 0;
+	}
+	printf("events: %-10s none %8.3fms descent %8.3fms counted %8.3fms, "
+		"%lu rules, %lu tokens, %lu names\n", what, best[0] * 1e3,
+		best[1] * 1e3, best[2] * 1e3, c.begins, c.tokens, c.names);
+	ok = c.begins == c.ends && c.tokens == (unsigned long)
+			lex_text(lex_scan_select(NULL), text, len);
+	if (!ok)
+		printf("events: %s: %lu rules ended, %lu tokens counted\n",
+			what, c.ends, c.tokens);
+	return ok;
+}
+
+static int
+bench_events(const char *filename)
+{
+	static const char func[] =
+		"static int t%d[] = { 1, 2, 3 };\n"
+		"int\nf%d(int *a, int n)\n{\n"
+		"\tint i, sum = 0;\n\n"
+		"\tfor (i = 0; i < n; ++i)\n"
+		"\t\tsum += a[i] * t%d[i %% 3] - (sum >> 4);\n"
+		"\treturn sum;\n}\n\n";
+	char *text, *s;
+	size_t len;
+	int i, ok;
+
+	ok = 1;
+	if (filename != NULL) {
+		text = read_file(filename, &len);
+		ok &= events_text(filename, text, len, 10);
+		free(text);
+	}
+
+	text = NEW_ARRAY(char, 4 * 1024 * 1024 + sizeof func + 64);
+	for (s = text, i = 0; s - text < 4 * 1024 * 1024; ++i)
+		s += sprintf(s, func, i, i, i);
+	len = s - text;
+	ok &= events_text("generated", text, len, 10);
+	free(text);
+	return ok ? 0 : 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *filename;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: bench test [file]\n");
+		exit(2);
+	}
+	filename = argc > 2 ? argv[2] : NULL;
+
+	if (strcmp(argv[1], "keywords") == 0)
+		return bench_keywords(filename);
+	if (strcmp(argv[1], "symtab") == 0)
+		return bench_symtab();
+	if (strcmp(argv[1], "lex") == 0)
+		return bench_lex(filename, argc > 3 ? atoi(argv[3]) : 4);
+	if (strcmp(argv[1], "prelex") == 0)
+		return bench_prelex(filename);
+	if (strcmp(argv[1], "scan") == 0)
+		return bench_scan(filename);
+	if (strcmp(argv[1], "styles") == 0)
+		return bench_styles();
+	if (strcmp(argv[1], "expr") == 0)
+		return bench_expr(filename);
+	if (strcmp(argv[1], "lazy") == 0)
+		return bench_lazy(filename);
+	if (strcmp(argv[1], "edit") == 0)
+		return bench_edit(filename);
+	if (strcmp(argv[1], "prefix") == 0)
+		return bench_prefix();
+	if (strcmp(argv[1], "parallel") == 0)
+		return bench_parallel(filename, argc > 3 ? atoi(argv[3]) : 4);
+	if (strcmp(argv[1], "index") == 0)
+		return bench_index(filename);
+	if (strcmp(argv[1], "splitlex") == 0)
+		return bench_splitlex(filename, argc > 3 ? atoi(argv[3]) : 4);
+	if (strcmp(argv[1], "ast") == 0)
+		return bench_ast(filename);
+	if (strcmp(argv[1], "astfile") == 0)
+		return bench_astfile(filename);
+	if (strcmp(argv[1], "events") == 0)
+		return bench_events(filename);
+
+	fprintf(stderr, "bench: unknown test %s\n", argv[1]);
+	return 2;
+}
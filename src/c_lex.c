@@ -18,74 +18,67 @@
  * 21 Jan 2001 Added support for inline, restrict, _Bool, _Complex, and _Imaginary.
  */
 
+#include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "c_lex.h"
-static bool Want_debugging_output;
+#include "keytab.h"
+#include "keyhash.h"
 
 /* static const char *tokname (token_t token); */
 static const char *parse_hash_directive (const char *line, lex_env_t *le);
 static const char *skip_whitespace (lex_env_t *le, const char *line);
-static int get_float_constant (lex_env_t *le, const char *line,
-					const char **p_end, constant_t *co);
 static const char *get_line (lex_env_t *le);
+static const char *next_line (lex_env_t *le, const char *line);
 static int get_string (lex_env_t *le, const char *line, constant_t *co);
+static void message (lex_env_t *le, const char *fmt, ...);
 
-static struct {
-	const char *name;
-	token_t token;
-	bool need_lexinfo;
-} Keytab[] = {
-	{"_Bool",	BOOL,		FALSE},
-	{"_Complex",	COMPLEX,	FALSE},
-	{"_Imaginary",	IMAGINARY,	FALSE},
-	{"auto",	AUTO,		FALSE},
-	{"break",	BREAK,		TRUE},
-	{"case",	CASE,		FALSE},
-	{"char",	CHAR,		FALSE},
-	{"const",	CONST,		FALSE},
-	{"continue",	CONTINUE,	TRUE},
-	{"default",	DEFAULT,	FALSE},
-	{"do",		DO,		FALSE},
-	{"double",	DOUBLE,		FALSE},
-	{"else",	ELSE,		FALSE},
-	{"enum",	ENUM,		FALSE},
-	{"extern",	EXTERN,		FALSE},
-	{"float",	FLOAT,		FALSE},
-	{"for",		FOR,		TRUE},
-	{"goto",	GOTO,		FALSE},
-	{"if",		IF,		FALSE},
-	{"inline",	INLINE,		FALSE},
-	{"int",		INT,		FALSE},
-	{"long",	LONG,		FALSE},
-	{"register",	REGISTER,	FALSE},
-	{"restrict",	RESTRICT,	FALSE},
-	{"return",	RETURN,		TRUE},
-	{"short",	SHORT,		FALSE},
-	{"signed",	SIGNED,		FALSE},
-	{"sizeof",	SIZEOF,		FALSE},
-	{"static",	STATIC,		FALSE},
-	{"struct",	STRUCT,		FALSE},
-	{"switch",	SWITCH,		FALSE},
-	{"typedef",	TYPEDEF,	FALSE},
-	{"union",	UNION,		FALSE},
-	{"unsigned",	UNSIGNED,	FALSE},
-	{"void",	VOID,		FALSE},
-	{"volatile",	VOLATILE,	FALSE},
-	{"while",	WHILE,		FALSE}
-};
-#define NKEYS (sizeof Keytab / sizeof *Keytab)
+char *string_copy(const char *string, int len);
 
-lex_env_t *Lex_env;
-lexeme_t *Lexeme;
+/*  Return the keyword token for the len characters at s, or
+ *  IDENTIFIER if they do not spell a keyword.  Keyhash, built from
+ *  Keytab by mkkeyhash, sends each keyword to a slot of its own, so
+ *  an identifier costs one probe and at most one compare.
+ */
+token_t
+lex_keyword(const char *s, int len)
+{
+	int i;
 
-constant_t Constant;
-identifier_t Identifier;
+	if (len < KEY_MINLEN || len > KEY_MAXLEN)
+		return IDENTIFIER;
+	if ((i = Keyhash[KEYHASH(s, len)]) == 0)
+		return IDENTIFIER;
+	--i;
+	if (strncmp(Keytab[i].name, s, len) != 0 || Keytab[i].name[len] != '\0')
+		return IDENTIFIER;
+	return Keytab[i].token;
+}
 
-char *string_copy(const char *string, int len);
+/*  Return le's copy of the file name name, making one the first time
+ *  it is seen.  The copies are freed with the lexer, so a file name
+ *  taken from another lexer should be passed through this before the
+ *  other lexer is freed.
+ */
+const char *
+lex_filename(lex_env_t *le, const char *name)
+{
+	int len;
+
+	if (le->le_filenames.atab_buckets == NULL)
+		atom_table_init(&le->le_filenames);
+	len = strlen(name);
+	return atom_intern(&le->le_filenames, name, len,
+				atom_hash(name, len))->at_name;
+}
 
 void
 lex_error(const char *s)
@@ -93,50 +86,62 @@ lex_error(const char *s)
 	fprintf(stderr, "Error: %s", s);
 }
 
+/*  Print a message about the input to le_errors, and count it.
+ */
+static void
+message(lex_env_t *le, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(le->le_errors, fmt, ap);
+	va_end(ap);
+	++le->le_nmessages;
+}
+
 static const char *
 parse_hash_directive(const char *line, lex_env_t *le)
 {
 	int lnum, nitems;
 	char name[256];
+	const char *eol;
 
-	for (; isspace(*line) && *line != '\0'; ++line)
+	for (; *line != '\n' && isspace(*line); ++line)
 		;
-	if (*line == '\0')
+	/*  A directive ends at the newline, which is left for the caller
+	 *  so that a mapped buffer counts it like any other line.
+	 */
+	eol = line + strcspn(line, "\n");
+	if (line == eol)
 		return line;
 
 	if (strncmp(line, "pragma", 6) == 0 && isspace(line[6])) {
-		for (line += 7; *line != '\0' && isspace(*line); ++line)
+		for (line += 7; line < eol && isspace(*line); ++line)
 			;
-		fprintf(stderr, "#pragma `%.*s' ignored",
-							strlen(line) - 1, line);
-		return line + strlen(line);
+		message(le, "#pragma `%.*s' ignored",
+							(int)(eol - line), line);
+		return eol;
 	}
 	if (strncmp(line, "line", 4) == 0) {
 		line += 4;
 	}
 
-	nitems = sscanf(line, "%d \"%[^\"]\"", &lnum, name);
+	nitems = sscanf(line, "%d \"%255[^\"\n]\"", &lnum, name);
 	if (nitems < 1) {
-		fprintf(stderr, "Bad # directive \"%s\"", line);
-		return "";
-	}
-	if (nitems == 2) {
-		char *buf;
-		int len;
-
-		len = strlen(name);
-		buf = NEW_ARRAY(char, len + 1);
-		(void) memcpy(buf, name, len + 1);
-		le->le_filename = buf;
+		message(le, "Bad # directive \"%.*s\"", (int)(eol - line), line);
+		return eol;
 	}
+	if (nitems == 2)
+		le->le_filename = lex_filename(le, name);
 
 	/*  Subtract 1 because we number internally from 0,
 	 *  and 1 because we are just about to bump the
 	 *  line number.
 	 */
 	le->le_lnum = lnum - 2;
+	++le->le_nmarkers;
 
-	return line + strlen(line);
+	return eol;
 }
 
 
@@ -198,9 +203,48 @@ ci_translate_escape(const char *s, int *p_res)
 	return s;
 }
 
-/*  Based on K&P's hoc follow() function.
+/*  The operator DFA.  Opstart gives the token for the first character
+ *  of an operator, and each token's row of Optrans says which token
+ *  it becomes if the next character is one of the few that can carry
+ *  an operator on (their columns are given by Opcol); 0 means it is
+ *  complete.  '.' is not here, as it may start a number or "...".
  */
-#define follow(s, ch, ifyes, ifno) ((*(s) == (ch)) ? (++(s), (ifyes)) : (ifno))
+enum {
+	OPC_NONE, OPC_EQ, OPC_AND, OPC_OR, OPC_PLUS, OPC_MINUS, OPC_LT, OPC_GT,
+	NOPCOLS
+};
+
+static const unsigned char Opcol[256] = {
+	['='] = OPC_EQ, ['&'] = OPC_AND, ['|'] = OPC_OR, ['+'] = OPC_PLUS,
+	['-'] = OPC_MINUS, ['<'] = OPC_LT, ['>'] = OPC_GT,
+};
+
+static const unsigned char Opstart[256] = {
+	['!'] = NOT, ['%'] = PERCENT, ['&'] = AND, ['('] = LPAREN,
+	[')'] = RPAREN, ['*'] = STAR, ['+'] = PLUS, [','] = COMMA,
+	['-'] = MINUS, ['/'] = SLASH, [':'] = COLON, [';'] = SEMI,
+	['<'] = LESSTHAN, ['='] = EQUALS, ['>'] = GREATERTHAN, ['?'] = QUERY,
+	['['] = LBRAC, [']'] = RBRAC, ['^'] = XOR, ['{'] = LBRACE,
+	['|'] = OR, ['}'] = RBRACE, ['~'] = TILDE,
+};
+
+static const unsigned char Optrans[BADTOK][NOPCOLS] = {
+	[NOT] =		{ [OPC_EQ] = NOTEQ },
+	[EQUALS] =	{ [OPC_EQ] = EQEQ },
+	[PERCENT] =	{ [OPC_EQ] = PERCENT_EQUALS },
+	[SLASH] =	{ [OPC_EQ] = SLASH_EQUALS },
+	[STAR] =	{ [OPC_EQ] = STAR_EQUALS },
+	[XOR] =		{ [OPC_EQ] = XOR_EQUALS },
+	[PLUS] =	{ [OPC_EQ] = PLUS_EQUALS, [OPC_PLUS] = PLUSPLUS },
+	[MINUS] =	{ [OPC_EQ] = MINUS_EQUALS, [OPC_MINUS] = MINUSMINUS,
+			  [OPC_GT] = ARROW },
+	[AND] =		{ [OPC_EQ] = AND_EQUALS, [OPC_AND] = ANDAND },
+	[OR] =		{ [OPC_EQ] = OR_EQUALS, [OPC_OR] = OROR },
+	[LESSTHAN] =	{ [OPC_EQ] = LESSEQ, [OPC_LT] = LSHIFT },
+	[LSHIFT] =	{ [OPC_EQ] = LSHIFT_EQUALS },
+	[GREATERTHAN] =	{ [OPC_EQ] = GTEQ, [OPC_GT] = RSHIFT },
+	[RSHIFT] =	{ [OPC_EQ] = RSHIFT_EQUALS },
+};
 
 static const char *
 get_line(lex_env_t *le)
@@ -208,10 +252,34 @@ get_line(lex_env_t *le)
 	if (le->le_abort_parse)
 		return NULL;
 
+	if (le->le_buf != NULL) {
+		/*  The whole mapped buffer is handed out as one "line";
+		 *  the newlines in it are counted by next_line().
+		 */
+		if (le->le_line != NULL)
+			return NULL;
+		++le->le_lnum;
+		return le->le_line = le->le_buf;
+	}
+
 	++le->le_lnum;
 	return le->le_line = (*le->le_getline)(le->le_getline_arg);
 }
 
+/*  Step over the newline at line.  With a getline function this
+ *  fetches the next line; with a mapped buffer it just bumps the
+ *  line number and carries on in place.
+ */
+static const char *
+next_line(lex_env_t *le, const char *line)
+{
+	if (le->le_buf == NULL)
+		return get_line(le);
+
+	++le->le_lnum;
+	return le->le_line = line + 1;
+}
+
 /*  Skip white space and comments.
  */
 static const char *
@@ -226,12 +294,23 @@ skip_whitespace(lex_env_t *le, const char *line)
 	if (line == NULL) {
 		if ((line = get_line(le)) == NULL)
 			return line;
+		if (*line == '#')
+			line = parse_hash_directive(line + 1, le);
 	}
 
 	for (;;) {
 		for(;;) {
-			while (*line != '\0' && isspace(*line))
-				++line;
+			while (*(line = le->le_scan->ls_blanks(line)) == '\n') {
+				if (le->le_buf != NULL) {
+					line = next_line(le, line);
+					read_another_line = TRUE;
+					if (*line == '#')
+						line = parse_hash_directive(line + 1,
+									le);
+				}
+				else
+					++line;
+			}
 			if (*line != '\0')
 				break;
 
@@ -243,16 +322,17 @@ skip_whitespace(lex_env_t *le, const char *line)
 		}
 		if (incomment) {
 			if (line == NULL) {
-				fprintf(stderr, 
-						"Hit EOF while in a comment");
+				message(le, "Hit EOF while in a comment");
 				break;
 			}
 			else if (*line == '*' && line[1] == '/') {
 				line += 2;
 				incomment = FALSE;
 			}
-			else
+			else if (*line == '*')
 				++line;
+			else
+				line = le->le_scan->ls_comment(line);
 		}
 		else {
 			if (line != NULL && *line == '/' && line[1] == '*') {
@@ -264,12 +344,13 @@ skip_whitespace(lex_env_t *le, const char *line)
 		}
 	}
 
-	if (Want_debugging_output && read_another_line) {
+	if (le->le_debug && read_another_line && line != NULL) {
 #if 0
 		putchar('\n');
 		printf("\n\"%s\", %d: %s", le->le_filename, le->le_lnum, line);
 #endif
-		printf("\"%s\", %d: %s\n", le->le_filename, le->le_lnum, line);
+		printf("\"%s\", %d: %.*s\n", le->le_filename, le->le_lnum,
+					(int)strcspn(line, "\n"), line);
 	}
 	return line;
 }
@@ -323,178 +404,587 @@ is_decl_specifier(token_t token)
 	||     token == TYPEDEF_NAME;
 }
 
-static token_t Prev_token = 0;	/* remember last token */
-static bool Colon_follows = FALSE;
+/*  Set up a lexer with no input.  The caller then either maps a file
+ *  with lex_map_file() or supplies le_getline, and should set
+ *  le_atoms and le_name_type.  All of the lexer's state lives in le,
+ *  so separate lexers can run at the same time on different threads
+ *  as long as they do not share an atom table.
+ */
+void
+lex_init(lex_env_t *le)
+{
+	memset(le, 0, sizeof *le);
+	le->le_errors = stderr;
+	le->le_debug = getenv("LEX_DEBUG") != NULL;
+	/* LEX_SCAN=scalar, sse2 or avx2 overrides the choice of loops */
+	if ((le->le_scan = lex_scan_select(getenv("LEX_SCAN"))) == NULL)
+		le->le_scan = lex_scan_select(NULL);
+}
+
+void
+lex_free(lex_env_t *le)
+{
+	free(le->le_strbuf);
+	le->le_strbuf = NULL;
+	le->le_strbufsize = 0;
+	atom_table_free(&le->le_literals);
+	atom_table_free(&le->le_filenames);
+}
 
 token_t
-lex_prev_token(void)
+lex_prev_token(lex_env_t *le)
 {
-	return Prev_token;
+	return le->le_prev_token;
 }
 
-bool
-lex_colon_follows(void)
+/*  Skip blanks and newlines, but not a newline before a '#' line.
+ */
+static const char *
+skip_blank_lines(lex_env_t *le, const char *s)
 {
-	return Colon_follows;
+	for (;;) {
+		s = le->le_scan->ls_blanks(s);
+		if (*s != '\n' || s[1] == '#')
+			return s;
+		++s;
+	}
 }
 
-token_t
-lex_get_token()
+/*
+ *  Called when lex_get_token() has just returned a constant, to race
+ *  through a list of plain numbers in an initializer.  If the next
+ *  token is ',' or '}' this consumes as many ", number" pairs as are
+ *  each followed by ',' or '}' and returns the count of constants,
+ *  the first one included; the constant last consumed is then the
+ *  current one and the lexer goes on with the ',' or '}' after it.
+ *  Otherwise it returns 0 and does nothing.  Only blanks and newlines
+ *  may come between the tokens; a comment or a '#' line just ends the
+ *  run early.
+ */
+int
+lex_constant_list(lex_env_t *le)
+{
+	const char *s, *num, *end, *next;
+	unsigned long long val;
+	token_t t;
+	int n;
+
+	if (le->le_buf == NULL || le->le_debug || le->le_lptr == NULL ||
+						le->le_nahead > 0)
+		return 0;
+	s = skip_blank_lines(le, le->le_lptr);
+	if (*s != ',' && *s != '}')
+		return 0;
+
+	for (n = 1; *s == ','; ++n) {
+		num = skip_blank_lines(le, s + 1);
+		if (!LEX_IS_DIGIT(*num) &&
+				!(*num == '.' && LEX_IS_DIGIT(num[1])))
+			break;
+		end = lex_number(num, &t, &val);
+		if (t == BADTOK)
+			break;
+		next = skip_blank_lines(le, end);
+		if (*next != ',' && *next != '}')
+			break;
+
+		for (s = le->le_lptr; s < num; ++s) {
+			if (*s == '\n') {
+				++le->le_lnum;
+				le->le_line = s + 1;
+			}
+		}
+		le->le_tokstart = num;
+		le->le_lptr = le->le_tokend = end;
+		le->le_constant.co_val = num;
+		le->le_constant.co_size = end - num;
+		le->le_constant.co_ival = val;
+		le->le_lexeme.constant = &le->le_constant;
+		le->le_prev_token = t;
+		s = next;
+	}
+	return n;
+}
+
+/*  Step over the newline at s in a mapped buffer, handling a '#' line
+ *  after it as skip_whitespace() would.
+ */
+static const char *
+skim_newline(lex_env_t *le, const char *s)
+{
+	s = next_line(le, s);
+	if (*s == '#')
+		s = parse_hash_directive(s + 1, le);
+	return s;
+}
+
+/*  Skip the string or character constant whose quote is at s.  One
+ *  that is not closed on its line ends there, and the newline is left.
+ */
+static const char *
+skim_quoted(lex_env_t *le, const char *s)
+{
+	char quote = *s++;
+
+	for (;;) {
+		if (quote == '"')
+			s = le->le_scan->ls_string(s);
+		if (*s == quote)
+			return s + 1;
+		if (*s == '\\' && s[1] == '\n')
+			s = next_line(le, s + 1);
+		else if (*s == '\\' && s[1] != '\0')
+			s += 2;
+		else if (*s == '\n' || *s == '\0')
+			return s;
+		else
+			++s;
+	}
+}
+
+/*  Skip the rest of the comment whose text starts at s.
+ */
+static const char *
+skim_comment(lex_env_t *le, const char *s)
+{
+	for (;;) {
+		s = le->le_scan->ls_comment(s);
+		if (*s == '*' && s[1] == '/')
+			return s + 2;
+		if (*s == '\n')
+			s = skim_newline(le, s);
+		else if (*s == '\0')
+			return s;
+		else
+			++s;
+	}
+}
+
+/*
+ *  Called when lex_get_token() has just returned '{', to skip to the
+ *  matching '}' without lexing anything in between.  ls_block finds
+ *  the characters that matter: braces, the quotes and comments that
+ *  could hide one, and newlines, which are counted, with '#' lines
+ *  handled as usual.  The '}' then becomes the current token and 0 is
+ *  returned.  If the input ends first, or is not in memory, or tokens
+ *  have been peeked at, nothing is skipped and -1 is returned.
+ */
+int
+lex_skip_block(lex_env_t *le)
+{
+	const char *s, *line, *filename;
+	int depth, lnum;
+
+	if (le->le_buf == NULL || le->le_lptr == NULL || le->le_nahead > 0)
+		return -1;
+	lnum = le->le_lnum;
+	line = le->le_line;
+	filename = le->le_filename;
+
+	s = le->le_lptr;
+	for (depth = 1; ; ) {
+		s = le->le_scan->ls_block(s);
+		switch (*s) {
+		case '{':
+			++depth;
+			++s;
+			break;
+		case '}':
+			if (--depth == 0) {
+				le->le_tokstart = s;
+				le->le_lptr = le->le_tokend = s + 1;
+				le->le_prev_token = RBRACE;
+				return 0;
+			}
+			++s;
+			break;
+		case '"':
+		case '\'':
+			s = skim_quoted(le, s);
+			break;
+		case '/':
+			if (s[1] == '*')
+				s = skim_comment(le, s + 2);
+			else
+				++s;
+			break;
+		case '\n':
+			s = skim_newline(le, s);
+			break;
+		default:
+			le->le_lnum = lnum;
+			le->le_line = line;
+			le->le_filename = filename;
+			return -1;
+		}
+	}
+}
+
+/*  Carry on lexing from s, which must be in the mapped buffer, at the
+ *  start of a token or of white space, and on line lnum.  Tokens peeked
+ *  at are dropped.
+ */
+void
+lex_seek(lex_env_t *le, const char *s, int lnum)
 {
-	static int pos = -1;
-	lex_env_t *le;
-	token_t token;
 	const char *line;
 
-	le = Lex_env;
+	/* Step back onto a newline just before s, so that a directive
+	 * at s is taken as one.
+	 */
+	if (s > le->le_buf && s[-1] == '\n') {
+		--s;
+		--lnum;
+	}
+	for (line = s; line > le->le_buf && line[-1] != '\n'; --line)
+		;
+	le->le_lptr = s;
+	le->le_line = line;
+	le->le_lnum = lnum;
+	le->le_nahead = 0;
+}
+
+/*  The split scan's versions of skim_quoted() and skim_comment(),
+ *  which count no lines and follow no directives.
+ */
+static const char *
+scan_quoted(const lex_scan_t *sc, const char *s)
+{
+	char quote = *s++;
 
-	if (pos == -1) {
-		Want_debugging_output = getenv("LEX_DEBUG") != NULL;
-		pos = 0;
+	for (;;) {
+		if (quote == '"')
+			s = sc->ls_string(s);
+		if (*s == quote)
+			return s + 1;
+		if (*s == '\\' && s[1] != '\0')
+			s += 2;
+		else if (*s == '\n' || *s == '\0')
+			return s;
+		else
+			++s;
 	}
-	if (le == NULL) {
-		if (Want_debugging_output)
-			puts("\n");
-		return 0;
+}
+
+static const char *
+scan_comment(const lex_scan_t *sc, const char *s)
+{
+	for (;;) {
+		s = sc->ls_comment(s);
+		if (*s == '*' && s[1] == '/')
+			return s + 2;
+		if (*s == '\0')
+			return s;
+		++s;
 	}
+}
 
-	if ((line = skip_whitespace(le, le->le_lptr)) == NULL) {
-		le->le_lptr = line;
-		return 0;	/* EOF */
+/*  Skip white space, comments and directive lines.
+ */
+static const char *
+scan_space(const lex_scan_t *sc, const char *s)
+{
+	for (;;) {
+		s = sc->ls_blanks(s);
+		if (*s == '\n') {
+			if (*++s == '#')
+				s += strcspn(s, "\n");
+		}
+		else if (*s == '/' && s[1] == '*')
+			s = scan_comment(sc, s + 2);
+		else
+			return s;
 	}
+}
 
-	switch (*line++) {
-	case '_': case '$':
+/*  Skip to just past the '}' that closes the block whose text starts
+ *  at s, or to the NUL.
+ */
+static const char *
+scan_block(const lex_scan_t *sc, const char *s)
+{
+	int depth;
+
+	for (depth = 1; ; ) {
+		s = sc->ls_block(s);
+		switch (*s) {
+		case '{':
+			++depth;
+			++s;
+			break;
+		case '}':
+			++s;
+			if (--depth == 0)
+				return s;
+			break;
+		case '"':
+		case '\'':
+			s = scan_quoted(sc, s);
+			break;
+		case '/':
+			s = s[1] == '*' ? scan_comment(sc, s + 2) : s + 1;
+			break;
+		case '\n':
+			if (*++s == '#')
+				s += strcspn(s, "\n");
+			break;
+		default:
+			return s;
+		}
+	}
+}
 
-	case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g':
-	case 'h': case 'i': case 'j': case 'k': case 'l': case 'm': case 'n':
-	case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
-	case 'v': case 'w': case 'x': case 'y': case 'z': 
+/*
+ *  Find places to split the mapped buffer, from offset start on, so
+ *  that its pieces can be parsed at the same time.  On entry at[0] to
+ *  at[n-1] are offsets in ascending order; each is moved on to the
+ *  first token of a top level declaration that begins at or after it
+ *  (and after the one before), or to the end of the buffer.  A
+ *  declaration is taken to begin after a ';' outside any braces or
+ *  parentheses, and after a function body, which is a block opened
+ *  just after a ')'.  That is a guess that may be wrong, for instance
+ *  after the parameter declarations of an old style definition, so the
+ *  pieces must be checked to fit together once they are parsed.
+ *
+ *  If typedef_name is not NULL it is called, in order, with each name
+ *  up to the last split that a typedef seems to declare: one followed
+ *  by a ';', ',' or '[' outside parentheses, or by a ')' just after a
+ *  '*' or '('.  That too is only a guess.
+ */
+void
+lex_split(lex_env_t *le, size_t start, size_t *at, int n,
+	void (*typedef_name)(void *arg, const char *s, int len), void *arg)
+{
+	const lex_scan_t *sc = le->le_scan;
+	const char *s = le->le_buf + start;
+	const char *end = le->le_buf + le->le_buflen;
+	const char *next, *name, *id;
+	int i, parens, namelen;
+	char last, namelast;
+	bool in_typedef;
+
+	i = 0;
+	parens = 0;
+	last = ';';
+	name = NULL;
+	namelen = 0;
+	namelast = 0;
+	in_typedef = FALSE;
+	while (i < n && *(s = scan_space(sc, s)) != '\0') {
+		next = NULL;
+		if (name != NULL) {
+			if (parens == 0 ? (*s == ';' || *s == ',' || *s == '[') :
+					(*s == ')' && (namelast == '*' ||
+							namelast == '(')))
+				(*typedef_name)(arg, name, namelen);
+			name = NULL;
+		}
+		switch (*s) {
+		case '"':
+		case '\'':
+			s = scan_quoted(sc, s);
+			break;
+		case '(':
+			++parens;
+			++s;
+			break;
+		case ')':
+			--parens;
+			++s;
+			break;
+		case ';':
+			if (parens == 0)
+				next = s + 1;
+			++s;
+			break;
+		case '{':
+			s = scan_block(sc, s + 1);
+			if (parens == 0 && last == ')')
+				next = s;
+			break;
+		default:
+			if (!LEX_IS_IDENT(*s)) {
+				++s;
+				break;
+			}
+			id = s;
+			s = sc->ls_ident(s);
+			if (typedef_name == NULL || isdigit((unsigned char)*id))
+				;
+			else if (s - id == 7 && memcmp(id, "typedef", 7) == 0)
+				in_typedef = parens == 0;
+			else if (in_typedef &&
+				    lex_keyword(id, s - id) == IDENTIFIER) {
+				name = id;
+				namelen = s - id;
+				namelast = last;
+			}
+			break;
+		}
+		last = s[-1];
+		if (next != NULL) {
+			in_typedef = FALSE;
+			s = scan_space(sc, next);
+			for (; i < n && at[i] <= (size_t)(s - le->le_buf); ++i)
+				at[i] = s - le->le_buf;
+		}
+	}
+	for (; i < n; ++i)
+		at[i] = end - le->le_buf;
+}
 
-	case 'A': case 'B': case 'C': case 'D': case 'E': case 'F': case 'G':
-	case 'H': case 'I': case 'J': case 'K': case 'L': case 'M': case 'N':
-	case 'O': case 'P': case 'Q': case 'R': case 'S': case 'T': case 'U':
-	case 'V': case 'W': case 'X': case 'Y': case 'Z':
-		{
-			const char *s;
-			int len, i;
+/*  Does the directive line at s, just after the '#', set the line
+ *  number, as "# 12 ..." and "#line 12 ..." do?
+ */
+static bool
+is_line_marker(const char *s)
+{
+	while (*s != '\n' && isspace((unsigned char)*s))
+		++s;
+	if (strncmp(s, "line", 4) == 0)
+		s += 4;
+	while (*s != '\n' && isspace((unsigned char)*s))
+		++s;
+	return isdigit((unsigned char)*s);
+}
 
+/*  Carry on lexing from offset len of the mapped buffer as though all
+ *  before it had been lexed, which is to say with the line number and
+ *  file name that the last line marker before it and the newlines
+ *  since give.  len must not be inside a token or a directive.
+ */
+void
+lex_skip(lex_env_t *le, size_t len)
+{
+	const char *s = le->le_buf + len;
+	const char *line;
+	int nlines;
+
+	if (len == 0)
+		return;
+	nlines = 0;
+	for (line = s; ; --line, ++nlines) {
+		while (line > le->le_buf && line[-1] != '\n')
 			--line;
-			for (s = line; isalnum(*s) || *s == '_' || *s == '$'; ++s)
-				;
-			len = s - line;
-
-			for (i = 0; i < NKEYS; ++i)
-				if (memcmp(Keytab[i].name, line, len) == 0 &&
-							Keytab[i].name[len] == '\0')
-					break;
-			if (i < NKEYS) {
-				token = Keytab[i].token;
-				line += len;
-				break;
+		if (line < s && *line == '#' && is_line_marker(line + 1)) {
+			parse_hash_directive(line + 1, le);
+			le->le_lnum += nlines;
+			break;
+		}
+		if (line == le->le_buf) {
+			le->le_lnum = 1 + nlines;
+			break;
+		}
+	}
+	lex_seek(le, s, le->le_lnum);
+}
+
+/*  Mix n characters at s into the hash h, a word at a time.
+ */
+static unsigned long long
+hash_span(unsigned long long h, const char *s, size_t n)
+{
+	unsigned long long w;
+
+	for (; n >= sizeof w; s += sizeof w, n -= sizeof w) {
+		memcpy(&w, s, sizeof w);
+		h = ((h << 5 | h >> 59) ^ w) * 0x9e3779b97f4a7c15ull;
+	}
+	w = 0;
+	memcpy(&w, s, n);
+	return ((h << 5 | h >> 59) ^ w ^ n) * 0x9e3779b97f4a7c15ull;
+}
+
+/*  Hash the text from s to end, for telling whether two inputs begin
+ *  alike.  What follows the '#' of a directive line is left out: line
+ *  markers name the file being compiled, and so differ between inputs
+ *  that are otherwise the same.  At most *np of the characters that
+ *  count are taken in; *np is set to the number that were, *hashp to
+ *  the hash, and where they end is returned.
+ */
+const char *
+lex_prefix_hash(const char *s, const char *end, size_t *np,
+		unsigned long long *hashp)
+{
+	const char *span, *line, *nl;
+	size_t n = *np, taken = 0, k;
+	unsigned long long h = 0;
+
+	span = s;
+	for (line = s; line < end; line = nl + 1) {
+		if ((size_t)(line - span) >= n - taken)
+			break;
+		if ((nl = memchr(line, '\n', end - line)) == NULL)
+			nl = end;
+		if (*line == '#') {
+			h = hash_span(h, span, line + 1 - span);
+			taken += line + 1 - span;
+			span = nl;
+		}
+	}
+	k = end - span;
+	if (k > n - taken)
+		k = n - taken;
+	*hashp = hash_span(h, span, k);
+	*np = taken + k;
+	return span + k;
+}
+
+/*  Lex the next token of the input, leaving what it was in le as
+ *  lex_get_token() would, except that names are always IDENTIFIER.
+ */
+static token_t
+scan_token(lex_env_t *le)
+{
+	token_t token;
+	const char *line;
+
+	if ((line = skip_whitespace(le, le->le_lptr)) == NULL) {
+		le->le_lptr = line;
+		return 0;	/* EOF */
+	}
+	le->le_tokstart = line;
+
+	switch (LEX_CLASS(*line)) {
+	case CC_LETTER:
+		{
+			int len;
+
+			len = le->le_scan->ls_ident(line) - line;
+			/* only a name that is not a keyword is hashed */
+			if ((token = lex_keyword(line, len)) == IDENTIFIER) {
+				le->le_identifier.id_atom = atom_intern(
+						le->le_atoms, line, len,
+						atom_hash(line, len));
+				le->le_lexeme.identifier = &le->le_identifier;
 			}
-					
-			if (len+1 > sizeof Identifier.id_name)
-				len = sizeof Identifier.id_name-1;
-			
-			strncpy(Identifier.id_name, line, len+1);
-			Identifier.id_name[len] = '\0';
-			Lexeme->identifier = &Identifier;
-
-			line = skip_whitespace(le, s);
-
-			/* The parser provides the function name_type() which is 
-			 * called here to determine whether a name is a potential 
-			 * TYPEDEF name. 
-			 */
-			token = name_type(Identifier.id_name);
-			Colon_follows = *line == ':';
+			line += len;
 		}
 		break;
-	case '0': case '1': case '2': case '3': case '4':
-	case '5': case '6': case '7': case '8': case '9':
+	case CC_DIGIT:
+	number:
 		{
-			char *end;
-			long val;
-			
-			val = strtol(line - 1, &end, 0);
-			if (end == line - 1) {
-				le->le_lptr = line;
-				fprintf(stderr,
-					"Badly formed integer constant \"%s\"",
-					line - 1);
-				token = BADTOK;
-			}
-			else if (*end == 'e' || *end == 'E' || *end == '.') {
-				token = get_float_constant(le, line-1, &line,
-								&Constant);
-				Lexeme->constant = &Constant;
+			const char *end;
+
+			end = lex_number(line, &token, &le->le_constant.co_ival);
+			if (token == BADTOK) {
+				message(le,
+					"Badly formed integer constant \"%.*s\"",
+					(int)(end - line), line);
 			}
 			else {
-				while (*end == 'L' || *end == 'l' || *end == 'u' || *end == 'U')
-					++end;
-				Constant.co_val = string_copy(line-1, end-(line-1));
-				Constant.co_size = end-(line-1);
-				line = end;
-
-				Lexeme->constant = &Constant;
-				token = INTEGER_CONSTANT;
+				le->le_constant.co_val = line;
+				le->le_constant.co_size = end - line;
+				le->le_lexeme.constant = &le->le_constant;
 			}
+			line = end;
 		}
 		break;
-	case '!':
-		token = follow(line, '=', NOTEQ, NOT);
-		break;
-	case '=':
-		token = follow(line, '=', EQEQ, EQUALS);
-		break;
-	case '%':
-		token = follow(line, '=', PERCENT_EQUALS, PERCENT);
-		break;
-	case '/':
-		token = follow(line, '=', SLASH_EQUALS, SLASH);
-		break;
-	case '^':
-		token = follow(line, '=', XOR_EQUALS, XOR);
-		break;
-	case '*':
-		token = follow(line, '=', STAR_EQUALS, STAR);
-		break;
-	case '[':
-		token = LBRAC;
-		break;
-	case ']':
-		token = RBRAC;
-		break;
-	case '{':
-		token = LBRACE;
-		break;
-	case '}':
-		token = RBRACE;
-		break;
-	case '(':
-		token = LPAREN;
-		break;
-	case ')':
-		token = RPAREN;
-		break;
-	case ',':
-		token = COMMA;
-		break;
-	case ';':
-		token = SEMI;
-		break;
-	case '?':
-		token = QUERY;
-		break;
-	case ':':
-		token = COLON;
-		break;
-	case '\'': {
+	case CC_QUOTE: {
 		/*  BUG: no escapes etc.
 		 */
 		int val;
-		const char *startp = line-1;
+		const char *startp = line++;
 		const char *endp = 0;
 
 		if (*line == '\\')
@@ -505,180 +995,218 @@ lex_get_token()
 
 		if (*line != '\'') {
 			le->le_lptr = line;
-			fprintf(stderr, "Unterminated char constant");
+			message(le, "Unterminated char constant");
 			token = BADTOK;
 		}
 		else {
 			endp = ++line;
-			Constant.co_val = string_copy(startp, endp-startp);
-			Constant.co_size = endp-startp;
-			Lexeme->constant = &Constant;
+			le->le_constant.co_val = startp;
+			le->le_constant.co_size = endp-startp;
+			le->le_lexeme.constant = &le->le_constant;
 			token = CHARACTER_CONSTANT;
 		}
 		break;
 	}
-	case '"': {
-		token = get_string(le, line, &Constant);
-		Lexeme->constant = &Constant;
+	case CC_DQUOTE: {
+		token = get_string(le, line + 1, &le->le_constant);
+		le->le_lexeme.constant = &le->le_constant;
 		line = le->le_lptr;
 		break;
 	}
-	case '.':
-		if (*line == '.' && line[1] == '.') {
-			line += 2;
+	case CC_DOT:
+		if (line[1] == '.' && line[2] == '.') {
+			line += 3;
 			token = ELLIPSIS;
 		}
-		else if (isdigit(*line)) {
-			token = get_float_constant(le, line-1, &line, &Constant);
-			Lexeme->constant = &Constant;
-		}
-		else
-			token = DOT;
-		break;
-	case '~':
-		token = TILDE;
-		break;
-	case '+':
-		if (*line == '+')
-			token = PLUSPLUS;
-		else if (*line == '=')
-			token = PLUS_EQUALS;
-		else {
-			token = PLUS;
-			--line;
-		}
-		++line;
-		break;
-	case '-':
-		if (*line == '>')
-			token = ARROW;
-		else if (*line == '-')
-			token = MINUSMINUS;
-		else if (*line == '=')
-			token = MINUS_EQUALS;
-		else {
-			token = MINUS;
-			--line;
-		}
-		++line;
-		break;
-	case '|':
-		if (*line == '|')
-			token = OROR;
-		else if (*line == '=')
-			token = OR_EQUALS;
-		else {
-			--line;
-			token = OR;
-		}
-		++line;
-		break;
-	case '&':
-		if (*line == '&')
-			token = ANDAND;
-		else if (*line == '=')
-			token = AND_EQUALS;
+		else if (LEX_IS_DIGIT(line[1]))
+			goto number;
 		else {
-			--line;
-			token = AND;
-		}
-		++line;
-		break;
-	case '>':
-		if (*line == '>') {
-			++line;
-			token = follow(line, '=', RSHIFT_EQUALS, RSHIFT);
-		}
-		else if (*line == '=') {
 			++line;
-			token = GTEQ;
+			token = DOT;
 		}
-		else
-			token = GREATERTHAN;
 		break;
-	case '<':
-		if (*line == '<') {
-			++line;
-			token = follow(line, '=', LSHIFT_EQUALS, LSHIFT);
-		}
-		else if (*line == '=') {
-			++line;
-			token = LESSEQ;
+	case CC_PUNCT:
+		{
+			token_t next;
+
+			/* Take the longest operator that starts here */
+			token = Opstart[(unsigned char)*line++];
+			while ((next = Optrans[token][Opcol[(unsigned char)*line]]) != 0) {
+				token = next;
+				++line;
+			}
 		}
-		else
-			token = LESSTHAN;
 		break;
-			
 	default:
+		++line;
 		le->le_lptr = line; /* because we are about to call diagf */
-		fprintf(stderr,
-			"Illegal character '%c' (0x%02x)", line[-1], line[-1]);
+		message(le, "Illegal character '%c' (0x%02x)", line[-1], line[-1]);
 		token = BADTOK;
 		break;
 	}
 	le->le_lptr = line;
+	return token;
+}
 
-#if 0
-	if (Want_debugging_output) {
-		const char *name;
+/*  Copy what the lexer says about its current token to la, or back.
+ */
+static void
+save_token(lex_env_t *le, lex_ahead_t *la)
+{
+	la->la_token = le->le_prev_token;
+	la->la_tokstart = le->le_tokstart;
+	la->la_tokend = le->le_tokend;
+	la->la_lexeme = le->le_lexeme;
+	la->la_constant = le->le_constant;
+	la->la_identifier = le->le_identifier;
+	la->la_literal = le->le_literal;
+}
 
-		if (pos > 70) {
-			putchar('\n');
-			pos = 0;
-		}
-		name = tokname(token);
-		printf("%s ", name);
-		pos += strlen(name) + 1;
-		fflush(stdout);
+static void
+load_token(lex_env_t *le, const lex_ahead_t *la)
+{
+	le->le_prev_token = la->la_token;
+	le->le_tokstart = la->la_tokstart;
+	le->le_tokend = la->la_tokend;
+	le->le_lexeme = la->la_lexeme;
+	le->le_constant = la->la_constant;
+	le->le_identifier = la->la_identifier;
+	le->le_literal = la->la_literal;
+}
+
+/*
+ *  Return the n'th token after the current one, 1 being the next,
+ *  without moving on: the current token, its lexeme included, stays
+ *  as it was.  n may be up to LEX_LOOKAHEAD.  A name comes back as
+ *  IDENTIFIER, as le_name_type is only asked about it once it is
+ *  reached, when the symbol table is up to date.
+ *
+ *  The tokens peeked at are kept in a ring and handed out by
+ *  lex_get_token() before any more of the input is read.  The text of
+ *  a number is only a view of the input, so when reading a line at a
+ *  time it may be lost if the lexer has to go on to another line to
+ *  peek further.
+ */
+token_t
+lex_peek_token(lex_env_t *le, int n)
+{
+	lex_ahead_t cur;
+	lex_ahead_t *la;
+
+	assert(n >= 1 && n <= LEX_LOOKAHEAD);
+	if (le->le_nahead < n) {
+		save_token(le, &cur);
+		do {
+			la = &le->le_ahead[(le->le_aheadpos + le->le_nahead) %
+							LEX_LOOKAHEAD];
+			le->le_prev_token = scan_token(le);
+			le->le_tokend = le->le_lptr;
+			save_token(le, la);
+		} while (++le->le_nahead < n);
+		load_token(le, &cur);
 	}
-#endif
+	return le->le_ahead[(le->le_aheadpos + n - 1) % LEX_LOOKAHEAD].la_token;
+}
+
+token_t
+lex_get_token(lex_env_t *le)
+{
+	token_t token;
 
-	Prev_token = token;
+	if (le == NULL)
+		return 0;
+
+	if (le->le_nahead > 0) {
+		load_token(le, &le->le_ahead[le->le_aheadpos]);
+		le->le_aheadpos = (le->le_aheadpos + 1) % LEX_LOOKAHEAD;
+		--le->le_nahead;
+		token = le->le_prev_token;
+	}
+	else {
+		token = scan_token(le);
+		le->le_tokend = le->le_lptr;
+	}
+
+	/* The parser provides the function le_name_type which is
+	 * called here to determine whether a name is a potential 
+	 * TYPEDEF name. 
+	 */
+	if (token == IDENTIFIER && le->le_name_type != NULL)
+		token = (*le->le_name_type)(le->le_name_type_arg,
+						le->le_identifier.id_atom);
+	le->le_prev_token = token;
 	return token;
 }
 
+/*  Make room for n more characters after the first used in le_strbuf.
+ */
+static void
+strbuf_reserve(lex_env_t *le, size_t used, size_t n)
+{
+	size_t size;
+
+	if (used + n <= le->le_strbufsize)
+		return;
+	size = le->le_strbufsize ? le->le_strbufsize : 256;
+	while (used + n > size)
+		size *= 2;
+	le->le_strbuf = safe_realloc(le->le_strbuf, size);
+	le->le_strbufsize = size;
+}
+
+/*  Hash a string constant for the literal pool.  All of it is taken
+ *  in, a word at a time, as long values that differ only in the middle
+ *  would otherwise all collide.
+ */
+static unsigned int
+literal_hash(const char *s, size_t len)
+{
+	unsigned long long h;
+
+	h = hash_span(0, s, len);
+	return (unsigned int)(h ^ h >> 32);
+}
+
+/*  Scan the string constant whose opening quote is just before line,
+ *  together with any that follow it with only white space between, as
+ *  "a" "b" is the same as "ab".  Runs of plain characters are found by
+ *  ls_string and copied whole; only escapes are translated one at a
+ *  time.  The value is then looked up in le_literals, so each distinct
+ *  string is stored once and co_val stays good until lex_free().
+ */
 static int
 get_string(lex_env_t *le, const char *line, constant_t *co)
 {
-	static const char badalloc[] =
-				"Unable to allocate memory for string constant";
-	static char *buf;
-	static int bufsize = 0;
-	int opos;
-	bool ok;
-
-	if (bufsize == 0) {
-		bufsize = 50;
-		if ((buf = malloc(bufsize + 1)) == NULL) {
-			fprintf(stderr, "%s", badalloc);
-			return BADTOK;
-		}
-	}
+	const atom_t *lit;
+	const char *end;
+	size_t opos;
+	int ch;
 
+	strbuf_reserve(le, 0, 1);	/* so le_strbuf is never NULL */
 	opos = 0;
-	ok = FALSE;		/* set to TRUE on success */
-
-	for (; *line != '\0'; ++line) {
-		int ch;
+	for (;;) {
+		end = (*le->le_scan->ls_string)(line);
+		if (end != line) {
+			strbuf_reserve(le, opos, end - line);
+			memcpy(le->le_strbuf + opos, line, end - line);
+			opos += end - line;
+			line = end;
+		}
 
 		if (*line == '"') {
-			const char *new_line;
-
-			new_line = skip_whitespace(le, line + 1);
-			if (new_line == NULL || *new_line != '"') {
-				ok = TRUE;
-				le->le_lptr = new_line;
+			end = skip_whitespace(le, line + 1);
+			if (end == NULL || *end != '"') {
+				le->le_lptr = end;
 				break;
 			}
-
-			line = new_line;
+			line = end + 1;
 			continue;
 		}
 
 		if (*line != '\\')
-			ch = *line;
+			ch = *line;		/* '\n' or NUL */
 		else if (*++line == '\n') {
-			line = get_line(le);
+			line = next_line(le, line);
 			ch = (line != NULL) ? *line : '\0';
 		}
 		else
@@ -686,52 +1214,143 @@ get_string(lex_env_t *le, const char *line, constant_t *co)
 
 		if (line == NULL || *line == '\n' || *line == '\0') {
 			le->le_lptr = line;
-			fprintf(stderr,
-						"Unterminated string constant");
-			break;
+			message(le, "Unterminated string constant");
+			return BADTOK;
 		}
 
-		if (opos == bufsize) {
-			bufsize *= 2;
-			if ((buf = realloc(buf, bufsize + 1)) == NULL) {
-				le->le_lptr = line;
-				fprintf(stderr,
-							"%s", badalloc);
-				break;
-			}
-		}
-		buf[opos++] = ch;
+		strbuf_reserve(le, opos, 1);
+		le->le_strbuf[opos++] = ch;
+		++line;
 	}
-	buf[opos++] = '\0';
-
-	if (!ok)
-		return BADTOK;
 
-	co->co_val = buf;
-	co->co_size = opos;
+	if (le->le_literals.atab_buckets == NULL)
+		atom_table_init(&le->le_literals);
+	lit = atom_intern(&le->le_literals, le->le_strbuf, (int)opos,
+					literal_hash(le->le_strbuf, opos));
+	le->le_literal = lit;
+	co->co_val = lit->at_name;
+	co->co_size = opos + 1;
 	return STRING_CONSTANT;
 }
 
 static int
-get_float_constant(lex_env_t *le, const char *line, const char **p_end, constant_t *co)
+hexval(int c)
 {
-	double val;
-	char *end;
+	if (LEX_IS_DIGIT(c))
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return 16;
+}
 
-	val = strtod(line, &end);
+/*  Skip an exponent at s ("e-12", "p+3"), if there is a well formed
+ *  one, starting with e or E (or p or P for hex).
+ */
+static const char *
+skip_exponent(const char *s, int e)
+{
+	const char *p;
+
+	if ((*s | 0x20) != e)
+		return s;
+	p = s + 1;
+	if (*p == '+' || *p == '-')
+		++p;
+	if (!LEX_IS_DIGIT(*p))
+		return s;
+	while (LEX_IS_DIGIT(*p))
+		++p;
+	return p;
+}
 
-	if (end == line) {
-		le->le_lptr = line;
-		fprintf(stderr, "Badly formed floating constant \"%s\"", line);
-		return BADTOK;
+/*
+ *  Scan the number at s, which starts with a digit, or a '.' and a
+ *  digit, in one pass.  Sets *p_token to INTEGER_CONSTANT,
+ *  FLOATING_CONSTANT or, for an octal number with an 8 or 9 in it,
+ *  BADTOK, and returns the end of the number, suffix included.  The
+ *  value of an integer is left in *p_val (modulo 2^64); a float is
+ *  only converted if someone asks, by lex_float_value().
+ */
+const char *
+lex_number(const char *s, token_t *p_token, unsigned long long *p_val)
+{
+	unsigned long long val;
+	const char *p, *e;
+	bool isfloat, octal, bad;
+	int d;
+
+	val = 0;
+	isfloat = bad = FALSE;
+	if (s[0] == '0' && (s[1] | 0x20) == 'x' &&
+			(hexval(s[2]) < 16 || (s[2] == '.' && hexval(s[3]) < 16))) {
+		for (p = s + 2; (d = hexval(*p)) < 16; ++p)
+			val = val * 16 + d;
+		if (*p == '.') {
+			isfloat = TRUE;
+			for (++p; hexval(*p) < 16; ++p)
+				;
+		}
+		if ((e = skip_exponent(p, 'p')) != p) {
+			isfloat = TRUE;
+			p = e;
+		}
+	}
+	else {
+		octal = *s == '0';
+		for (p = s; LEX_IS_DIGIT(*p); ++p) {
+			d = *p - '0';
+			if (!octal)
+				val = val * 10 + d;
+			else if (d < 8)
+				val = val * 8 + d;
+			else
+				bad = TRUE;
+		}
+		if (*p == '.') {
+			isfloat = TRUE;
+			for (++p; LEX_IS_DIGIT(*p); ++p)
+				;
+		}
+		if ((e = skip_exponent(p, 'e')) != p) {
+			isfloat = TRUE;
+			p = e;
+		}
 	}
 
-	co->co_val = string_copy(line, end-line);
-	co->co_size = end-line;
+	if (isfloat) {
+		if (*p == 'f' || *p == 'F' || *p == 'l' || *p == 'L')
+			++p;
+		*p_token = FLOATING_CONSTANT;
+		val = 0;
+	}
+	else {
+		while (*p == 'L' || *p == 'l' || *p == 'u' || *p == 'U')
+			++p;
+		*p_token = bad ? BADTOK : INTEGER_CONSTANT;
+	}
+	*p_val = val;
+	return p;
+}
 
-	*p_end = end;
+/*  The value of a FLOATING_CONSTANT.
+ */
+double
+lex_float_value(const constant_t *co)
+{
+	char buf[64], *s;
+	double val;
 
-	return FLOATING_CONSTANT;
+	/* strtod() needs the text NUL terminated, and co_val is a view */
+	s = co->co_size < sizeof buf ? buf : malloc(co->co_size + 1);
+	if (s == NULL)
+		return 0;
+	memcpy(s, co->co_val, co->co_size);
+	s[co->co_size] = '\0';
+	val = strtod(s, NULL);
+	if (s != buf)
+		free(s);
+	return val;
 }
 
 /* static */
@@ -834,7 +1453,8 @@ tokname(token_t token)
 		"BADTOK",                 BADTOK,
 		"EOF",                    0,
 	};
-	static char buf[100];
+	/* One per thread, as sessions on several threads share this */
+	static __thread char buf[32];
 	int i;
 
 	for (i = 0; i < sizeof tab / sizeof *tab; ++i)
@@ -845,6 +1465,73 @@ tokname(token_t token)
 	return buf;
 }
 
+/*  Map a whole source file for the lexer to walk in place.
+ *  The file is laid over a zeroed anonymous mapping one byte
+ *  longer than the file, so the buffer is always NUL terminated
+ *  even when the file size is a multiple of the page size.
+ *  Returns 0 on success, -1 if the file cannot be mapped (a
+ *  pipe, say), in which case the caller should use le_getline.
+ */
+int
+lex_map_file(lex_env_t *le, const char *filename)
+{
+	struct stat st;
+	size_t pagesize, maplen;
+	char *base;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY)) == -1)
+		return -1;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		le->le_buf = "";
+		le->le_buflen = 0;
+		le->le_mapped = FALSE;
+		return 0;
+	}
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	maplen = (st.st_size + 1 + pagesize - 1) & ~(pagesize - 1);
+	base = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	if (mmap(base, st.st_size, PROT_READ, MAP_PRIVATE|MAP_FIXED, fd, 0)
+							== MAP_FAILED) {
+		munmap(base, maplen);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	(void) madvise(base, st.st_size, MADV_SEQUENTIAL);
+	(void) madvise(base, st.st_size, MADV_WILLNEED);
+
+	le->le_buf = base;
+	le->le_buflen = st.st_size;
+	le->le_mapped = TRUE;
+	return 0;
+}
+
+void
+lex_unmap_file(lex_env_t *le)
+{
+	size_t pagesize;
+
+	if (le->le_mapped) {
+		pagesize = sysconf(_SC_PAGESIZE);
+		munmap((void *)le->le_buf,
+			(le->le_buflen + 1 + pagesize - 1) & ~(pagesize - 1));
+	}
+	le->le_buf = NULL;
+	le->le_buflen = 0;
+	le->le_mapped = FALSE;
+}
+
 
 void *safe_calloc(size_t n, size_t s)
 {
@@ -856,6 +1543,25 @@ void *safe_calloc(size_t n, size_t s)
 	return p;
 }
 
+void *safe_realloc(void *old, size_t s)
+{
+	void *p = realloc(old, s);
+	if (!p) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+/*  Make a NUL terminated copy of a constant that will outlive the
+ *  next call to lex_get_token().
+ */
+char *
+lex_constant_copy(const constant_t *co)
+{
+	return string_copy(co->co_val, co->co_size);
+}
+
 char *string_copy(const char *string, int len)
 {
 	char *p = malloc(len+1);
@@ -18,6 +18,11 @@
 #ifndef c_lex_h
 #define c_lex_h
 
+#include <stdio.h>
+
+#include "atom.h"
+#include "lex_scan.h"
+
 typedef enum { FALSE, TRUE } bool;
 
 typedef enum token_t token_t;
@@ -115,17 +120,21 @@ enum token_t {
 	BADTOK
 };
 
-enum {
-	MAX_IDENTIFIER_LEN = 1024
-};
-
 typedef struct {
-	char id_name[MAX_IDENTIFIER_LEN];
+	const atom_t *id_atom;
 } identifier_t;
 
+/*  The text of a constant.  For numbers and characters co_val points
+ *  straight into the input, is not NUL terminated, and is only good
+ *  until the next lex_get_token().  For strings it is the translated
+ *  value, kept in the lexer's literal pool until lex_free(), and
+ *  co_size counts its terminating NUL.  lex_constant_copy() makes a
+ *  copy that lasts.
+ */
 typedef struct {
-	char *co_val;
+	const char *co_val;
 	size_t co_size;
+	unsigned long long co_ival;	/* value of an INTEGER_CONSTANT */
 } constant_t;
 
 typedef union {
@@ -133,10 +142,26 @@ typedef union {
 	constant_t *constant;
 } lexeme_t;
 
+/*  A token that lex_peek_token() has read ahead, and its lexeme.
+ */
+typedef struct {
+	token_t la_token;
+	const char *la_tokstart;
+	const char *la_tokend;
+	lexeme_t la_lexeme;
+	constant_t la_constant;
+	identifier_t la_identifier;
+	const atom_t *la_literal;
+} lex_ahead_t;
+
+#define LEX_LOOKAHEAD	4	/* how far lex_peek_token() can see */
+
 /*  Environment for lexer.
  */
 typedef struct lex_envst {
 	const char *le_lptr;
+	const char *le_tokstart;	/* first character of the last token */
+	const char *le_tokend;		/* and just past its last */
 	const char *le_filename;
 	int le_lnum;
 	bool le_had_error;
@@ -145,23 +170,63 @@ typedef struct lex_envst {
 	char *le_getline_arg;
 	bool le_abort_parse;
 	lexeme_t le_lexeme;
+	atom_table_t *le_atoms;	/* where identifiers are interned */
+	const char *le_buf;	/* whole input, NUL terminated, or NULL */
+	size_t le_buflen;
+	bool le_mapped;		/* le_buf came from lex_map_file() */
+	/* Says whether a name is a TYPEDEF_NAME or an IDENTIFIER */
+	token_t (*le_name_type)(void *arg, const atom_t *atom);
+	void *le_name_type_arg;
+	constant_t le_constant;		/* what le_lexeme points at */
+	identifier_t le_identifier;
+	token_t le_prev_token;
+	lex_ahead_t le_ahead[LEX_LOOKAHEAD];	/* ring of peeked tokens */
+	int le_aheadpos;		/* where in le_ahead the next one is */
+	int le_nahead;			/* how many there are */
+	bool le_debug;			/* LEX_DEBUG was set */
+	const lex_scan_t *le_scan;	/* scanning loops for this CPU */
+	char *le_strbuf;		/* string constants are built here */
+	size_t le_strbufsize;
+	atom_table_t le_literals;	/* one copy of each string constant */
+	const atom_t *le_literal;	/* that of the last STRING_CONSTANT */
+	FILE *le_errors;		/* where messages go, stderr by default */
+	int le_nmessages;		/* how many have been printed there */
+	int le_nmarkers;		/* line markers read */
+	atom_table_t le_filenames;	/* those line markers named */
 } lex_env_t;
 
-extern lexeme_t *Lexeme;
-extern lex_env_t *Lex_env;
-
 void *safe_calloc(size_t,size_t);
+void *safe_realloc(void *,size_t);
 #define NEW(type)	((type *)safe_calloc(1, sizeof(type)))
 #define NEW_ARRAY(type, size) ((type *)safe_calloc((size), sizeof(type)))
 
-token_t lex_get_token (void);
-token_t lex_prev_token (void);
-bool lex_colon_follows (void);
+void lex_init (lex_env_t *le);
+void lex_free (lex_env_t *le);
+token_t lex_get_token (lex_env_t *le);
+token_t lex_prev_token (lex_env_t *le);
+token_t lex_keyword (const char *s, int len);
+token_t lex_peek_token (lex_env_t *le, int n);
+int lex_constant_list (lex_env_t *le);
+int lex_skip_block (lex_env_t *le);
+void lex_seek (lex_env_t *le, const char *s, int lnum);
+void lex_skip (lex_env_t *le, size_t len);
+void lex_split (lex_env_t *le, size_t start, size_t *at, int n,
+		void (*typedef_name)(void *arg, const char *s, int len),
+		void *arg);
+const char *lex_prefix_hash (const char *s, const char *end, size_t *np,
+			unsigned long long *hashp);
+const char *lex_filename (lex_env_t *le, const char *name);
 void lex_error (const char *s);
 const char *lex_tokname(token_t);
-extern token_t name_type(const char *buf);
+const char *tokname(token_t);
+int lex_map_file(lex_env_t *le, const char *filename);
+void lex_unmap_file(lex_env_t *le);
 extern void *safe_calloc(size_t,size_t);
 extern char *string_copy(const char *s, int len);
+char *lex_constant_copy(const constant_t *co);
+const char *lex_number(const char *s, token_t *p_token,
+			unsigned long long *p_val);
+double lex_float_value(const constant_t *co);
 
 
 #endif
@@ -57,9 +57,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
-
+#include <setjmp.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "c_parser.h"
 #include "c_lex.h"
 #include "list.h"
+#include "symtab.h"
+#include "tokbuf.h"
+#include "structidx.h"
+#include "ast.h"
 
 /***
 * Various FIRST SETS
@@ -91,32 +102,38 @@
 *    5) An assignment and a conditional expression look alike.
 */
 
-#define is_assign_operator(tok) \
-	(TokMap[tok] & TOK_ASSGNOP)
-#define is_type_name(tok) \
-	(TokMap[tok] & TOK_DECL_SPEC || tok == IDENTIFIER && Cursym != 0 && Cursym->object_type == OBJ_TYPEDEF_NAME)
-#define is_declaration(tok) \
-	is_type_name(tok)
+#define is_assign_operator(t) \
+	(TokMap[t] & TOK_ASSGNOP)
+#define is_type_name(t) \
+	(TokMap[t] & TOK_DECL_SPEC || t == IDENTIFIER && p->cursym != 0 && p->cursym->object_type == OBJ_TYPEDEF_NAME)
+#define is_declaration(t) \
+	is_type_name(t)
 #ifdef C89
-#define is_external_declaration(tok) \
-	(is_declaration(tok) || tok == STAR || tok == LPAREN || tok == IDENTIFIER)
+#define is_external_declaration(t) \
+	(is_declaration(t) || t == STAR || t == LPAREN || t == IDENTIFIER)
 #else
-#define is_external_declaration(tok) \
-	is_declaration(tok)
+#define is_external_declaration(t) \
+	is_declaration(t)
 #endif
-#define is_expression(tok) \
-	(TokMap[tok] & TOK_EXPR)
-#define is_statement(tok) \
-	(TokMap[tok] & TOK_STMT)
-#define is_function_body(tok) \
-	(tok == LBRACE || (is_declaration(tok) && tok != TYPEDEF))
+#define is_expression(t) \
+	(TokMap[t] & TOK_EXPR)
+#define is_statement(t) \
+	(TokMap[t] & TOK_STMT)
+#define climbing(p) \
+	((p)->debug_level == 0 && !(p)->descent && (p)->events == 0)
+#define is_function_body(t) \
+	(t == LBRACE || (is_declaration(t) && t != TYPEDEF))
+
+/* Tell the caller's parser_events_t, if there is one, of a rule */
+#define RULE_EVENT(s, fn) \
+	if (p->events != 0 && p->events->fn != 0) (*p->events->fn)(p->events_arg, s)
 
 #if 1
-#define TRACEIN(s) do { if (DebugLevel == 2) printf("%*s%s {\n", TraceLevel, "", s); fflush(stdout); TraceLevel++; } while(0);
-#define TRACEOUT(s) do { --TraceLevel; if (DebugLevel == 2) printf("%*s} (%s)\n", TraceLevel, "", s); fflush(stdout); } while(0);
+#define TRACEIN(s) do { if (p->debug_level == 2) printf("%*s%s {\n", p->trace_level, "", s); fflush(stdout); p->trace_level++; RULE_EVENT(s, pe_begin); } while(0);
+#define TRACEOUT(s) do { --p->trace_level; if (p->debug_level == 2) printf("%*s} (%s)\n", p->trace_level, "", s); fflush(stdout); RULE_EVENT(s, pe_end); } while(0);
 #else
-#define TRACEIN(s) 
-#define TRACEOUT(s)
+#define TRACEIN(s) do { RULE_EVENT(s, pe_begin); } while(0);
+#define TRACEOUT(s) do { RULE_EVENT(s, pe_end); } while(0);
 #endif
 
 enum {
@@ -132,8 +149,30 @@ enum {
 	TOK_STMT = 1024,
 	TOK_DECL_SPEC = 2048,
 	TOK_ASSGNOP = 4096,
+	TOK_PREC_SHIFT = 16		/* binary operator precedence, above */
+};
+
+/*  How tightly each binary operator binds, from TokMap; 0 for tokens
+ *  that are not binary operators.
+ */
+enum {
+	PREC_NONE,
+	PREC_LOGICAL_OR,
+	PREC_LOGICAL_AND,
+	PREC_INCLUSIVE_OR,
+	PREC_EXCLUSIVE_OR,
+	PREC_AND,
+	PREC_EQUALITY,
+	PREC_RELATIONAL,
+	PREC_SHIFT,
+	PREC_ADDITIVE,
+	PREC_MULTIPLICATIVE
 };
 
+#define PREC(n)	((unsigned long)(n) << TOK_PREC_SHIFT)
+#define binary_precedence(t) \
+	((int)(TokMap[t] >> TOK_PREC_SHIFT) & 0xf)
+
 enum {
 	LEVEL_GLOBAL = 0,
 	LEVEL_FUNCTION = 1,
@@ -150,299 +189,622 @@ enum {
 	OBJ_IDENTIFIER = 2+4+8+16+32
 };
 
-typedef struct symbol_t {
-	link_t link;
-	const char *name;
-	int storage_class;
-	int object_type;	
-} symbol_t;
+/* BADTOK is looked up too, and has no properties */
+static const unsigned long TokMap[BADTOK + 1] = {
+	[ FLOATING_CONSTANT ] = TOK_CONSTANT|TOK_EXPR|TOK_STMT,
+	[ INTEGER_CONSTANT ] = TOK_CONSTANT|TOK_EXPR|TOK_STMT,
+	[ STRING_CONSTANT ] = TOK_CONSTANT|TOK_EXPR|TOK_STMT,
+	[ CHARACTER_CONSTANT ] = TOK_CONSTANT|TOK_EXPR|TOK_STMT,
+	[ IDENTIFIER ] = TOK_EXPR|TOK_STMT,
+	[ SIZEOF ] = TOK_EXPR|TOK_STMT,
+	[ AND ] = TOK_EXPR|TOK_STMT|PREC(PREC_AND),
+	[ PLUSPLUS ] = TOK_EXPR|TOK_STMT,
+	[ MINUSMINUS ] = TOK_EXPR|TOK_STMT,
+	[ STAR ] = TOK_EXPR|TOK_STMT|PREC(PREC_MULTIPLICATIVE),
+	[ PLUS ] = TOK_EXPR|TOK_STMT|PREC(PREC_ADDITIVE),
+	[ MINUS ] = TOK_EXPR|TOK_STMT|PREC(PREC_ADDITIVE),
+	[ TILDE ] = TOK_EXPR|TOK_STMT,
+	[ LPAREN ] = TOK_EXPR|TOK_STMT,
+	[ NOT ] = TOK_EXPR|TOK_STMT,
+	[ TYPEDEF_NAME ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC,
+	[ CHAR ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC,
+	[ FLOAT ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC,
+	[ DOUBLE ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC,
+	[ SHORT ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC,
+	[ INT ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC,
+	[ UNSIGNED ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC,
+	[ SIGNED ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC,
+	[ VOID ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC,
+	[ STRUCT ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_STRUCT|TOK_TAG|TOK_DECL_SPEC,
+	[ UNION ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_STRUCT|TOK_TAG|TOK_DECL_SPEC,
+	[ ENUM ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TAG|TOK_DECL_SPEC,
+	[ LONG ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC,
+	[ CONST ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_QUALIFIER|TOK_DECL_SPEC,
+	[ VOLATILE ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_QUALIFIER|TOK_DECL_SPEC,
+	[ STATIC ] = TOK_STORAGE_CLASS|TOK_DECL_SPEC,
+	[ EXTERN ] = TOK_STORAGE_CLASS|TOK_DECL_SPEC,
+	[ AUTO ] = TOK_STORAGE_CLASS|TOK_DECL_SPEC,
+	[ REGISTER ] = TOK_STORAGE_CLASS|TOK_DECL_SPEC,
+	[ TYPEDEF ] = TOK_STORAGE_CLASS|TOK_DECL_SPEC,
+	[ IF ] = TOK_STMT,
+	[ BREAK ] = TOK_STMT,
+	[ CASE ] = TOK_STMT,
+	[ CONTINUE ] = TOK_STMT,
+	[ DEFAULT ] = TOK_STMT,
+	[ DO ] = TOK_STMT,
+	[ ELSE ] = TOK_STMT,
+	[ FOR ] = TOK_STMT,
+	[ GOTO ] = TOK_STMT,
+	[ RETURN ] = TOK_STMT,
+	[ SWITCH ] = TOK_STMT,
+	[ WHILE ] = TOK_STMT,
+	[ LBRACE ] = TOK_STMT,
+	[ SEMI ] = TOK_STMT,
+	[ EQUALS ] = TOK_ASSGNOP,
+	[ PLUS_EQUALS ] = TOK_ASSGNOP,
+	[ MINUS_EQUALS ] = TOK_ASSGNOP,
+	[ STAR_EQUALS ] = TOK_ASSGNOP,
+	[ SLASH_EQUALS ] = TOK_ASSGNOP,
+	[ PERCENT_EQUALS ] = TOK_ASSGNOP,
+	[ LSHIFT_EQUALS ] = TOK_ASSGNOP,
+	[ RSHIFT_EQUALS ] = TOK_ASSGNOP,
+	[ AND_EQUALS ] = TOK_ASSGNOP,
+	[ XOR_EQUALS ] = TOK_ASSGNOP,
+	[ OR_EQUALS ] = TOK_ASSGNOP,
+	[ SLASH ] = PREC(PREC_MULTIPLICATIVE),
+	[ PERCENT ] = PREC(PREC_MULTIPLICATIVE),
+	[ LSHIFT ] = PREC(PREC_SHIFT),
+	[ RSHIFT ] = PREC(PREC_SHIFT),
+	[ LESSTHAN ] = PREC(PREC_RELATIONAL),
+	[ GREATERTHAN ] = PREC(PREC_RELATIONAL),
+	[ LESSEQ ] = PREC(PREC_RELATIONAL),
+	[ GTEQ ] = PREC(PREC_RELATIONAL),
+	[ EQEQ ] = PREC(PREC_EQUALITY),
+	[ NOTEQ ] = PREC(PREC_EQUALITY),
+	[ XOR ] = PREC(PREC_EXCLUSIVE_OR),
+	[ OR ] = PREC(PREC_INCLUSIVE_OR),
+	[ ANDAND ] = PREC(PREC_LOGICAL_AND),
+	[ OROR ] = PREC(PREC_LOGICAL_OR),
+};
+
+/*
+ * A function body skipped in lazy mode, or parsed in input that may be
+ * edited.  scope is the function's parameter scope, and mark the last
+ * symbol in it when the body was reached.  Only global symbols with a
+ * serial below horizon had been declared by then.
+ */
+typedef struct {
+	parser_body_t info;
+	scope_t *scope;
+	symbol_t *mark;
+	unsigned int horizon;
+	int lnum;			/* line of the '{' */
+	const char *filename;
+} body_t;
+
+/*
+ * A top level declaration in input that may be edited, with what is
+ * needed to parse again from it: the symbol table serials and the
+ * number of bodies as they were when it began.
+ */
+typedef struct {
+	size_t start;			/* offset of its first token */
+	int lnum;			/* line of that token */
+	const char *filename;
+	unsigned int nsymbols;
+	unsigned int nscopes;
+	int nbodies;
+	unsigned int nnodes;		/* and the nodes in the tree */
+	char *error;			/* why it failed to parse, or NULL */
+} decl_t;
+
+#define NO_HORIZON	UINT_MAX
+
+/*
+ * A prefix file holds what parsing some input declared at file scope,
+ * so that other input that begins with the same text can skip it.  It
+ * is a header, then a prefix_symbol_t for each symbol in the order
+ * they were declared, then their names, each with a NUL.  Like a
+ * precompiled header it is only a cache, in the byte order of the
+ * machine that wrote it.
+ */
+#define PREFIX_MAGIC	0x43505831	/* "CPX1" */
 
 typedef struct {
-	link_t link;
-	int level;		/* nesting level */
-	list_t symbols;		/* list of symbols */
-} symtab_t;
+	unsigned int ph_magic;
+	unsigned int ph_nsymbols;
+	unsigned long long ph_length;	/* characters of the input that */
+	unsigned long long ph_hash;	/* lex_prefix_hash() took in */
+	unsigned long long ph_namesize;
+} prefix_header_t;
 
-static unsigned long TokMap[BADTOK];
+typedef struct {
+	unsigned int ps_hash;		/* at_hash of the name */
+	unsigned short ps_len;
+	unsigned char ps_storage_class;
+	unsigned char ps_object_type;
+} prefix_symbol_t;
 
-static int DebugLevel = 0;
-static int TraceLevel = 0;
+/* A prefix file read into memory */
+typedef struct {
+	char *px_data;			/* the whole file */
+	const prefix_header_t *px_header;
+	const prefix_symbol_t *px_symbols;
+	const char *px_names;
+} prefix_t;
 
-static	int Level = 0;
-static	int Saw_ident = 0;
-static	int Is_func = 0;
-static	token_t	tok;
-static	int Parsing_struct = 0;
-static	int Parsing_oldstyle_parmdecl = 0;
-static	int Storage_class[100];
-static	int stack_ptr = -1;
+/*
+ * A name that a chunk of the input, parsed on its own, looked up
+ * before declaring it, and whether it was then taken to be a typedef
+ * name.  The chunk was parsed right if that is what the declarations
+ * before the chunk make it.
+ */
+typedef struct {
+	const atom_t *atom;
+	int typedef_name;
+} seen_t;
 
-static list_t identifiers;		/* head of the identifiers list */
-static list_t labels;
-static list_t types;
-static symtab_t *Cursymtab;		/* current symbol table */
-static symtab_t *Curlabels;		
-static symtab_t *Curtypes;		
+/*
+ * A file scope declaration that a chunk made, and how much the chunk
+ * had to say before it.
+ */
+typedef struct {
+	symbol_t *sym;
+	long said;
+	const atom_t *atom;		/* its name in the main session */
+} made_t;
 
-static symbol_t *Cursym = 0;
+#define NO_STOP	((size_t)-1)
 
-static void
-init_tokmap(void);
+/*
+ * Where a construct began in the tree and in the input, for a node
+ * that turns out to be its parent once it has been parsed.
+ */
+typedef struct {
+	unsigned int node;
+	unsigned int start;
+} mark_t;
+
+/*
+ * Everything one parse needs.  A session may be used for any number of
+ * parses, one after another, and separate sessions may be used on
+ * separate threads at the same time.
+ */
+struct parser_t {
+	token_t	tok;			/* lookahead token */
+	int level;
+	int saw_ident;
+	int is_func;
+	int parsing_struct;
+	int parsing_oldstyle_parmdecl;
+	int storage_class[100];
+	int stack_ptr;
+	symtab_t identifiers;		/* ordinary identifiers */
+	symtab_t labels;
+	symtab_t types;
+	symbol_t *cursym;		/* what the lookahead identifier names */
+	lex_env_t lex;
+	lexeme_t *lexeme;
+	atom_table_t atoms;
+	int prelex;			/* lex everything first, into tokens */
+	int from_tokens;		/* this parse is reading tokens */
+	tokbuf_t tokens;
+	unsigned int tokpos;		/* next token in tokens */
+	structidx_t index;		/* from parser_index_file() */
+	int indexed;			/* lex holds the input indexed */
+	const parser_events_t *events;	/* the caller's callbacks, or NULL */
+	void *events_arg;
+	int tree;			/* build a syntax tree */
+	char *ast_suffix;		/* and save it beside the input */
+	int building;			/* the last parse's tree is in ast */
+	ast_t ast;
+	unsigned int ast_end;		/* just past the last token matched */
+	int descent;			/* one function per precedence level */
+	int lazy;			/* skip function bodies */
+	const atom_t *declarator_name;	/* last name declared globally */
+	body_t *bodies;			/* the bodies skipped */
+	int nbodies;
+	int bodysize;
+	int kept;			/* state kept for parser_parse_body() */
+	unsigned int horizon;		/* globals visible to a late body */
+	int incremental;		/* keep input for parser_edit() */
+	int editable;			/* this parse's input can be edited */
+	char *text;			/* the input, when it can be */
+	size_t textlen;
+	size_t textsize;
+	char *name;			/* and its name */
+	decl_t *decls;			/* top level declarations */
+	int ndecls;
+	int declsize;
+	int nbad;			/* declarations that failed */
+	int complete;			/* parsed to the end of the input */
+	size_t body_end;		/* just past the last function body */
+	prefix_t *prefix;		/* from parser_load_prefix() */
+	int saving;			/* keep the parse to save as a prefix */
+	int nthreads;			/* threads to parse one input on */
+	size_t stop;			/* offset of the declaration to stop at */
+	int stopped;			/* and p->tok is its first token */
+	int clean;			/* the parse may start afresh there */
+	int noting;			/* note the names looked up outside */
+	struct split_t *split;		/* what this parses a chunk of */
+	int nseed;			/* typedef names given to the chunk */
+	seen_t *seen;			/* names the chunk did not declare */
+	made_t *made;			/* and what it did */
+	int nmade;
+	int madesize;
+	FILE *errout;			/* for messages, if not stderr */
+	FILE *errors;			/* the chunk's messages, held back */
+	char *errtext;
+	size_t errsize;
+	int nseen;
+	int seensize;
+	unsigned char *seenid;		/* by at_id, whether in seen */
+	unsigned int seenidsize;
+	int debug_level;
+	int trace_level;
+	jmp_buf failed;			/* parse_error() jumps here */
+	char errmsg[256];
+	FILE *fp;			/* for reading unmappable files */
+	char *line;
+	size_t linesize;
+};
 
 static const char *
 object_name(int object_type);
 
-static symtab_t *
-new_symbol_table(list_t *owner);
+static void
+init_symbol_table(parser_t *p);
 
 static void
-init_symbol_table(void);
+enter_scope(parser_t *p);
 
-static symbol_t *
-find_symbol(symtab_t *tab, const char *name, int all_scope);
+static void
+exit_scope(parser_t *p);
+
+static void
+install_symbol(parser_t *p, const atom_t *atom, int storage_class, int object_type);
+
+static token_t
+name_type(void *arg, const atom_t *atom);
+
+static void
+parse_error(parser_t *p, const char *fmt, ...);
+
+/*  Where the current token starts, in input that is in memory.
+ */
+static size_t
+token_offset(parser_t *p)
+{
+	if (p->from_tokens)
+		return p->tokens.tb_offset[p->tokpos - 1];
+	return p->lex.le_tokstart - p->lex.le_buf;
+}
+
+/*  The token n after the current one, without moving on to it.  A
+ *  name is IDENTIFIER even if it is a typedef name.
+ */
+static token_t
+peek_token(parser_t *p, int n)
+{
+	unsigned int i = p->tokpos + n - 1;
+
+	if (p->from_tokens)
+		return i < p->tokens.tb_count ? TB_KIND(&p->tokens, i) : EOI;
+	return lex_peek_token(&p->lex, n);
+}
+
+static void
+match(parser_t *p, token_t expected_tok);
+
+/*  Where the current token ends, once it has been read.
+ */
+static size_t
+token_end(parser_t *p)
+{
+	if (p->from_tokens)
+		return p->tokens.tb_offset[p->tokpos - 1] +
+			p->tokens.tb_length[p->tokpos - 1];
+	return p->lex.le_tokend - p->lex.le_buf;
+}
+
+/*
+ * Building the syntax tree.  These do nothing unless p->building is
+ * set, and offsets are 0 for input that is not in memory.
+ */
+static unsigned int
+node_start(parser_t *p)
+{
+	if (p->lex.le_buf == 0)
+		return 0;
+	if (p->tok == EOI)
+		return p->lex.le_buflen;
+	return token_offset(p);
+}
+
+static mark_t
+node_mark(parser_t *p)
+{
+	mark_t m;
+
+	m.node = p->ast.ast_count;
+	m.start = p->building ? node_start(p) : 0;
+	return m;
+}
+
+/*  Open a node that starts with the current token.
+ */
+static void
+open_node(parser_t *p, int kind, token_t op)
+{
+	if (p->building)
+		ast_open(&p->ast, kind, op, node_start(p));
+}
+
+/*  Open a node that starts at m, as the parent of what follows it.
+ */
+static void
+wrap_node(parser_t *p, mark_t m, int kind, token_t op)
+{
+	if (p->building)
+		ast_wrap(&p->ast, m.node, kind, op, m.start);
+}
+
+static void
+close_node(parser_t *p)
+{
+	if (p->building)
+		ast_close(&p->ast, p->ast_end);
+}
+
+static void
+close_nodes(parser_t *p, int n)
+{
+	while (n-- > 0)
+		close_node(p);
+}
 
+/*  Forget the nodes made since m.
+ */
 static void
-enter_scope(void);
+drop_nodes(parser_t *p, mark_t m)
+{
+	if (p->building)
+		ast_cut(&p->ast, m.node);
+}
 
+/*  Match the current token, as a node with no children.
+ */
 static void
-exit_scope(void);
+match_node(parser_t *p, int kind, token_t expected_tok)
+{
+	unsigned int value = 0;
+
+	if (p->building && p->tok == expected_tok) {
+		if (kind == AST_NAME)
+			value = ast_name(&p->ast,
+					p->lexeme->identifier->id_atom);
+		else if (kind == AST_STRING)
+			value = ast_literal(&p->ast, p->lex.le_literal);
+		ast_leaf(&p->ast, kind, p->tok, node_start(p),
+			p->lex.le_buf != 0 ? token_end(p) : 0, value);
+	}
+	match(p, expected_tok);
+}
 
 static void
-install_symbol(const char *name, int storage_class, int object_type);
+match_constant(parser_t *p)
+{
+	match_node(p, p->tok == STRING_CONSTANT ? AST_STRING : AST_CONSTANT,
+			p->tok);
+}
 
+/*  A node for an expression that was left out.
+ */
 static void
-match(token_t expected_tok);
+empty_node(parser_t *p)
+{
+	unsigned int start;
+
+	if (p->building) {
+		start = node_start(p);
+		ast_leaf(&p->ast, AST_NONE, 0, start, start, 0);
+	}
+}
 
 static bool
-check_not_typedef(void);
+check_not_typedef(parser_t *p);
+
+static void
+constant_expression(parser_t *p);
+
+static void
+expression(parser_t *p);
+
+static void
+primary_expression(parser_t *p);
 
 static void
-constant_expression(void);
+postfix_operator(parser_t *p, mark_t m);
 
 static void
-expression(void);
+postfix_operators(parser_t *p, mark_t m);
 
 static void
-primary_expression(void);
+sizeof_expression(parser_t *p);
 
 static void
-postfix_operator(void);
+unary_expression(parser_t *p);
 
 static void
-postfix_operators(void);
+multiplicative_expression(parser_t *p);
 
 static void
-sizeof_expression(void);
+additive_expression(parser_t *p);
 
 static void
-unary_expression(void);
+shift_expression(parser_t *p);
 
 static void
-multiplicative_expression(void);
+relational_expression(parser_t *p);
 
 static void
-additive_expression(void);
+equality_expression(parser_t *p);
 
 static void
-shift_expression(void);
+and_expression(parser_t *p);
 
 static void
-relational_expression(void);
+exclusive_or_expression(parser_t *p);
 
 static void
-equality_expression(void);
+inclusive_or_expression(parser_t *p);
 
 static void
-and_expression(void);
+logical_and_expression(parser_t *p);
 
 static void
-exclusive_or_expression(void);
+logical_or_expression(parser_t *p);
 
 static void
-inclusive_or_expression(void);
+conditional_expression(parser_t *p);
 
 static void
-logical_and_expression(void);
+assignment_expression(parser_t *p);
 
 static void
-logical_or_expression(void);
+climb_expression(parser_t *p, bool assignment);
 
 static void
-conditional_expression(void);
+climb_binary(parser_t *p, int min_prec);
 
 static void
-assignment_expression(void);
+cast_expression(parser_t *p);
 
 static void
-labeled_statement(void);
+labeled_statement(parser_t *p);
 
 static void
-case_statement(void);
+case_statement(parser_t *p);
 
 static void
-default_statement(void);
+default_statement(parser_t *p);
 
 static void
-if_statement(void);
+if_statement(parser_t *p);
 
 static void
-switch_statement(void);
+switch_statement(parser_t *p);
 
 static void
-while_statement(void);
+while_statement(parser_t *p);
 
 static void
-do_while_statement(void);
+do_while_statement(parser_t *p);
 
 static void
-for_statement(void);
+for_statement(parser_t *p);
 
 static void
-break_statement(void);
+break_statement(parser_t *p);
 
 static void
-continue_statement(void);
+continue_statement(parser_t *p);
 
 static void
-goto_statement(void);
+goto_statement(parser_t *p);
 
 static void
-return_statement(void);
+return_statement(parser_t *p);
 
 static void
-empty_statement(void);
+empty_statement(parser_t *p);
 
 static void
-expression_statement(void);
+expression_statement(parser_t *p);
 
 static void
-statement(void);
+statement(parser_t *p);
 
 static void
-compound_statement(void);
+compound_statement(parser_t *p);
 
 static void
-enumerator(void);
+enumerator(parser_t *p);
 
 static void
-enum_specifier(void);
+enum_specifier(parser_t *p);
 
 static void
-member(void);
+member(parser_t *p);
 
 static void
-members(void);
+members(parser_t *p);
 
 static void
-struct_or_union_specifier(void);
+struct_or_union_specifier(parser_t *p);
 
 static void
-type_name(void);
+type_name(parser_t *p);
 
 static void
-declaration_specifiers(int no_storage_class);
+declaration_specifiers(parser_t *p, int no_storage_class);
 
 static void
-pointer(void);
+pointer(parser_t *p);
 
 static void
-direct_declarator(int abstract);
+direct_declarator(parser_t *p, int abstract);
 
 static void 
-parameter_list(int *new_style);
+parameter_list(parser_t *p, int *new_style);
 
 static void
-suffix_declarator(void);
+suffix_declarator(parser_t *p);
 
 static void
-declarator(int abstract);
+declarator(parser_t *p, int abstract);
 
 static void
-designator(void);
+designator(parser_t *p);
 
 static void
-initializer(int recurse);
+initializer(parser_t *p, int recurse);
 
 static void
-function_definition(void);
+function_definition(parser_t *p);
 
 static int
-init_declarator(int check_if_function);
+init_declarator(parser_t *p, int check_if_function);
 
 static void
-declaration(void);
+declaration(parser_t *p);
 
 static void
-translation_unit(void);
+translation_unit(parser_t *p);
 
-static const char *
-mygetline(char *arg);
+static int
+parse(parser_t *p);
 
 static void
-init_tokmap(void)
-{
-	TokMap[ FLOATING_CONSTANT ] = TOK_CONSTANT|TOK_EXPR|TOK_STMT ;
-	TokMap[ INTEGER_CONSTANT ] = TOK_CONSTANT|TOK_EXPR|TOK_STMT ;
-	TokMap[ STRING_CONSTANT ] = TOK_CONSTANT|TOK_EXPR|TOK_STMT ;
-	TokMap[ CHARACTER_CONSTANT ] = TOK_CONSTANT|TOK_EXPR|TOK_STMT ;
-	TokMap[ IDENTIFIER ] = TOK_EXPR|TOK_STMT ;
-	TokMap[ SIZEOF ] = TOK_EXPR|TOK_STMT ;
-	TokMap[ AND ] = TOK_EXPR|TOK_STMT ;
-	TokMap[ PLUSPLUS ] = TOK_EXPR|TOK_STMT ;
-	TokMap[ MINUSMINUS ] = TOK_EXPR|TOK_STMT ;
-	TokMap[ STAR ] = TOK_EXPR|TOK_STMT ;
-	TokMap[ PLUS ] = TOK_EXPR|TOK_STMT ;
-	TokMap[ MINUS ] = TOK_EXPR|TOK_STMT ;
-	TokMap[ TILDE ] = TOK_EXPR|TOK_STMT ;
-	TokMap[ LPAREN ] = TOK_EXPR|TOK_STMT ;
-	TokMap[ NOT ] = TOK_EXPR|TOK_STMT ;
-	TokMap[ TYPEDEF_NAME ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC;
-	TokMap[ CHAR ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC ;
-	TokMap[ FLOAT ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC ;
-	TokMap[ DOUBLE ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC ;
-	TokMap[ SHORT ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC ;
-	TokMap[ INT ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC ;
-	TokMap[ UNSIGNED ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC ;
-	TokMap[ SIGNED ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC ;
-	TokMap[ VOID ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC ;
-	TokMap[ STRUCT ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_STRUCT|TOK_TAG|TOK_DECL_SPEC ;
-	TokMap[ UNION ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_STRUCT|TOK_TAG|TOK_DECL_SPEC ;
-	TokMap[ ENUM ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TAG|TOK_DECL_SPEC ;
-	TokMap[ LONG ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_SPECIFIER|TOK_DECL_SPEC ;
-	TokMap[ CONST ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_QUALIFIER|TOK_DECL_SPEC ;
-	TokMap[ VOLATILE ] = TOK_TYPE_SPECIFIER_QUALIFIER|TOK_TYPE_QUALIFIER|TOK_DECL_SPEC ;
-	TokMap[ STATIC ] = TOK_STORAGE_CLASS|TOK_DECL_SPEC ;
-	TokMap[ EXTERN ] = TOK_STORAGE_CLASS|TOK_DECL_SPEC ;
-	TokMap[ AUTO ] = TOK_STORAGE_CLASS|TOK_DECL_SPEC ;
-	TokMap[ REGISTER ] = TOK_STORAGE_CLASS|TOK_DECL_SPEC ;
-	TokMap[ TYPEDEF ] = TOK_STORAGE_CLASS|TOK_DECL_SPEC ;
-	TokMap[ IF ] = TOK_STMT ;
-	TokMap[ BREAK ] = TOK_STMT ;
-	TokMap[ CASE ] = TOK_STMT ;
-	TokMap[ CONTINUE ] = TOK_STMT ;
-	TokMap[ DEFAULT ] = TOK_STMT ;
-	TokMap[ DO ] = TOK_STMT ;
-	TokMap[ ELSE ] = TOK_STMT ;
-	TokMap[ FOR ] = TOK_STMT ;
-	TokMap[ GOTO ] = TOK_STMT ;
-	TokMap[ RETURN ] = TOK_STMT ;
-	TokMap[ SWITCH ] = TOK_STMT ;
-	TokMap[ WHILE ] = TOK_STMT ;
-	TokMap[ LBRACE ] = TOK_STMT;
-	TokMap[ SEMI ] = TOK_STMT; 
-	TokMap[ EQUALS ] = TOK_ASSGNOP ;
-	TokMap[ PLUS_EQUALS ] = TOK_ASSGNOP ;
-	TokMap[ MINUS_EQUALS ] = TOK_ASSGNOP ;
-	TokMap[ STAR_EQUALS ] = TOK_ASSGNOP ;
-	TokMap[ SLASH_EQUALS ] = TOK_ASSGNOP ;
-	TokMap[ PERCENT_EQUALS ] = TOK_ASSGNOP ;
-	TokMap[ LSHIFT_EQUALS ] = TOK_ASSGNOP ;
-	TokMap[ RSHIFT_EQUALS ] = TOK_ASSGNOP ;
-	TokMap[ AND_EQUALS ] = TOK_ASSGNOP ;
-	TokMap[ XOR_EQUALS ] = TOK_ASSGNOP ;
-	TokMap[ OR_EQUALS ] = TOK_ASSGNOP ;
+free_prefix(prefix_t *px);
 
-}
+static void
+note_stop(parser_t *p);
+
+static void
+close_tree(parser_t *p);
+
+static int
+save_tree(parser_t *p, const char *filename);
+
+static symbol_t *
+seed_typedef(parser_t *p, const atom_t *atom);
+
+static token_t
+name_type(void *arg, const atom_t *atom);
+
+static const char *
+mygetline(char *arg);
 
 static const char *
 object_name(int object_type)
@@ -462,58 +824,22 @@ object_name(int object_type)
 	return name;
 }
 
-static symtab_t *
-new_symbol_table(list_t *owner)
-{
-	symtab_t *tab;
-
-	tab = calloc(1, sizeof(symtab_t));
-	list_init(&tab->symbols);
-	list_append(owner, tab);
-	return tab;
-}
-
 static void
-init_symbol_table(void)
-{
-	list_init(&identifiers);
-	Cursymtab = new_symbol_table(&identifiers);
-	list_init(&labels);
-	list_init(&types);
-	Curtypes = new_symbol_table(&types);
-}
-
-static symbol_t *
-find_symbol(symtab_t *tab, const char *name, int all_scope)
+init_symbol_table(parser_t *p)
 {
-	symbol_t *sym;
-
-	assert(tab != 0);
-	for (sym = (symbol_t *)list_first(&tab->symbols);
-		sym != 0;
-		sym = (symbol_t *)list_next(&tab->symbols, sym)) {
-		if (strcmp(sym->name, name) == 0) {
-			return sym;
-		}
-	}
-	if (!all_scope)
-		return 0;
-	tab = (symtab_t *)list_prev(&identifiers, tab);
-	if (tab == 0)
-		return 0;
-	return find_symbol(tab, name, all_scope);
+	symtab_init(&p->identifiers);
+	symtab_init(&p->labels);
+	symtab_init(&p->types);
 }
 
 static void
-enter_scope(void)
+enter_scope(parser_t *p)
 {
-	symtab_t *tab;
-
-	Level++;
-	if (DebugLevel == 3) { 
-		printf("%*sEntering scope %d\n", TraceLevel, "", Level); 
+	p->level++;
+	if (p->debug_level == 3) { 
+		printf("%*sEntering scope %d\n", p->trace_level, "", p->level); 
 	}
-	if (Level == LEVEL_STATEMENT) {
+	if (p->level == LEVEL_STATEMENT) {
 		/* Although we increment the level when we parse 
 		 * function parameters, and again when we enter the
 		 * function body, ANSI C requires these to be in the same
@@ -521,622 +847,989 @@ enter_scope(void)
 		 */
 		return;
 	}
-	/*
-	tab = calloc(1, sizeof(symtab_t));
-	list_init(&tab->symbols);
-	list_append(&identifiers, tab);
-	Cursymtab = tab;
-	*/
-	Cursymtab = new_symbol_table(&identifiers);
+	symtab_enter_scope(&p->identifiers, p->level);
 }
 
 static void
-exit_scope(void)
+exit_scope(parser_t *p)
 {
-	symtab_t *tab;
+	symtab_t *st = &p->identifiers;
+	bool stale;
 
-	if (DebugLevel == 3) { 
-		printf("%*sExiting scope %d\n", TraceLevel, "", Level); 
+	if (p->debug_level == 3) { 
+		printf("%*sExiting scope %d\n", p->trace_level, "", p->level); 
 	}
-	Level--;
+	p->level--;
 	/* Although we increment the Level when we parse 
 	 * function parameters, and again when we enter the
 	 * function body, ANSI C requires these to be in the same
 	 * scope.
 	 */
-	if (Level == LEVEL_FUNCTION)
+	if (p->level == LEVEL_FUNCTION)
 		return;
-	tab = Cursymtab;
-	Cursymtab = (symtab_t *)list_prev(&identifiers, Cursymtab);
-	assert(Cursymtab != 0);
-	list_remove(&identifiers, tab);
+	/* The lookahead may be a name declared in the scope being left,
+	 * whose symbol goes with it; it means what it does outside.
+	 */
+	stale = p->cursym != 0 && p->cursym->scope == st->st_current;
+	symtab_exit_scope(st);
+	if (stale) {
+		p->cursym = 0;
+		if (p->tok == IDENTIFIER)
+			name_type(p, p->lexeme->identifier->id_atom);
+	}
 }
 
+/*
+ * Note a file scope declaration made by a chunk, to be made again by
+ * the main session if the chunk's parse stands.
+ */
 static void
-install_symbol(const char *name, int storage_class, int object_type)
+note_made(parser_t *p, symbol_t *sym)
 {
-	symbol_t *sym;
+	if (p->nmade == p->madesize) {
+		p->madesize = p->madesize == 0 ? 256 : p->madesize * 2;
+		p->made = safe_realloc(p->made, p->madesize * sizeof *p->made);
+	}
+	p->made[p->nmade].sym = sym;
+	p->made[p->nmade].said = ftell(p->lex.le_errors);
+	p->made[p->nmade].atom = 0;
+	p->nmade++;
+}
 
-	sym = find_symbol(Cursymtab, name, 0);
-	if (sym != 0) {
-		fprintf(stderr, "Error: redeclaration of symbol %s as %s\n", name,
+static void
+install_symbol(parser_t *p, const atom_t *atom, int storage_class, int object_type)
+{
+	symbol_t *sym, *new;
+
+	sym = symtab_lookup_current(&p->identifiers, atom);
+	/* A chunk's file scope is checked when the main session takes it */
+	if (sym != 0 && !(p->noting && sym->scope->level == LEVEL_GLOBAL)) {
+		fprintf(p->lex.le_errors, "Error: redeclaration of symbol %s as %s\n", atom->at_name,
 			object_name(object_type));
-		fprintf(stderr, "Error: previously declared as %s\n", 
+		fprintf(p->lex.le_errors, "Error: previously declared as %s\n", 
 			object_name(sym->object_type));
 		/* fprintf(stderr, "Level = %d\n", Level); */
 		/* exit(1); */
 	}
-	if (DebugLevel == 3) {
-		printf("%*sInstalling %s name %s\n", TraceLevel, "", object_name(object_type), name);
+	if (p->debug_level == 3) {
+		printf("%*sInstalling %s name %s\n", p->trace_level, "", object_name(object_type), atom->at_name);
 		if (sym) {
-			printf("%*s\tOverriding %s name %s\n", TraceLevel, "", object_name(sym->object_type), sym->name);
+			printf("%*s\tOverriding %s name %s\n", p->trace_level, "", object_name(sym->object_type), sym->atom->at_name);
 		}
 	}
-	sym = safe_calloc(1, sizeof(symbol_t));
-	sym->name = string_copy(name, strlen(name));
-	sym->storage_class = storage_class;
-	sym->object_type = object_type;
-	list_append(&Cursymtab->symbols, sym);
+	new = symtab_install(&p->identifiers, atom, storage_class, object_type);
+	if (p->noting && new->scope->level == LEVEL_GLOBAL)
+		note_made(p, new);
 }	
 	
+/*
+ * Give up on the parse: record the message and unwind back to
+ * parse() through p->failed.
+ */
+static void
+parse_error(parser_t *p, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(p->errmsg, sizeof p->errmsg, fmt, ap);
+	va_end(ap);
+	longjmp(p->failed, 1);
+}
+
+static token_t
+next_token(parser_t *p)
+{
+	if (p->from_tokens)
+		return tokbuf_get(&p->tokens, p->tokpos++, &p->lex);
+	return lex_get_token(&p->lex);
+}
+
+/*  Tell the caller's parser_events_t of the token being matched.
+ */
+static void
+token_event(parser_t *p)
+{
+	parser_token_t t;
+
+	t.pt_token = p->tok;
+	t.pt_name = p->tok == IDENTIFIER ?
+			p->lexeme->identifier->id_atom->at_name : 0;
+	t.pt_start = t.pt_end = 0;
+	if (p->lex.le_buf != 0) {
+		t.pt_start = token_offset(p);
+		t.pt_end = token_end(p);
+	}
+	(*p->events->pe_token)(p->events_arg, &t);
+}
+
 static void
-match(token_t expected_tok)
+match(parser_t *p, token_t expected_tok)
 {
-	if (tok != expected_tok) {
-		printf("Parse failed: Expected %s, ", tokname(expected_tok));
-		printf("got %s\n", tokname(tok));
+	if (p->tok != expected_tok) {
+		parse_error(p, "Expected %s, got %s", tokname(expected_tok),
+			tokname(p->tok));
 		/* printf("Level = %d\n", Level); */
-		exit(1);
 	}
 	else {
-		if (DebugLevel) {
+		if (p->debug_level) {
 			const char *cp = 0;
-			if (TokMap[tok] & TOK_CONSTANT) {
-				cp = Lexeme->constant->co_val;
+			int len = 0;
+			if (TokMap[p->tok] & TOK_CONSTANT) {
+				cp = p->lexeme->constant->co_val;
+				len = p->lexeme->constant->co_size;
 			}
-			else if (tok == IDENTIFIER) {
-				cp = Lexeme->identifier->id_name;
+			else if (p->tok == IDENTIFIER) {
+				cp = p->lexeme->identifier->id_atom->at_name;
+				len = p->lexeme->identifier->id_atom->at_len;
 			}
 			if (cp == 0)
-				printf("%*s[%s]\n", TraceLevel, "", tokname(tok)); 
+				printf("%*s[%s]\n", p->trace_level, "", tokname(p->tok)); 
 			else
-				printf("%*s[%s(%s)]\n", TraceLevel, "", tokname(tok), cp); 
+				printf("%*s[%s(%.*s)]\n", p->trace_level, "", tokname(p->tok), len, cp); 
 		}
-		tok = lex_get_token();
+		if (p->building && p->lex.le_buf != 0)
+			p->ast_end = token_end(p);
+		if (p->events != 0 && p->events->pe_token != 0)
+			token_event(p);
+		p->tok = next_token(p);
 	}
 }
 
 static bool
-check_not_typedef(void)
+check_not_typedef(parser_t *p)
 {
-	return (Cursym == 0 || Cursym->object_type != OBJ_TYPEDEF_NAME);
+	return (p->cursym == 0 || p->cursym->object_type != OBJ_TYPEDEF_NAME);
 }
 
 static void
-constant_expression(void)
+constant_expression(parser_t *p)
 {
 	TRACEIN("constant_expression");
-	conditional_expression();
+	conditional_expression(p);
 	/* fold constant */
 	TRACEOUT("constant_expression");
 }
 
 static void
-expression(void)
+expression(parser_t *p)
 {
+	mark_t m;
+
 	TRACEIN("expression");
 
-	if (!is_expression(tok)) {
+	if (!is_expression(p->tok)) {
+		empty_node(p);
 		TRACEOUT("expression");
 		return;
 	}
 
-	assignment_expression();
-	while (tok == COMMA) {
-		match(COMMA);
-		assignment_expression();
+	m = node_mark(p);
+	assignment_expression(p);
+	if (p->tok == COMMA) {
+		wrap_node(p, m, AST_COMMA, COMMA);
+		while (p->tok == COMMA) {
+			match(p, COMMA);
+			assignment_expression(p);
+		}
+		close_node(p);
 	}
 	TRACEOUT("expression");
 }
 
 static void
-primary_expression(void)
+primary_expression(parser_t *p)
 {
 	TRACEIN("primary_expression");
-	if (tok == IDENTIFIER) {
-		check_not_typedef();
-		match(IDENTIFIER);
+	if (p->tok == IDENTIFIER) {
+		check_not_typedef(p);
+		match_node(p, AST_NAME, IDENTIFIER);
 	}
-	else if (TokMap[tok] & TOK_CONSTANT) {
-		match(tok);
+	else if (TokMap[p->tok] & TOK_CONSTANT) {
+		match_constant(p);
 	}
 	/* parenthesized expression handled in unary_expression() */
 	TRACEOUT("primary_expression");
 }
 
+/*  A postfix operator applied to what was parsed from m on.
+ */
 static void
-postfix_operator(void)
+postfix_operator(parser_t *p, mark_t m)
 {
 	TRACEIN("postfix_operator");
-	if (tok == LBRAC) {
-		match(LBRAC);
-		expression();
-		match(RBRAC);
-	}
-	else if (tok == LPAREN) {
-		match(LPAREN);
-		if (tok != RPAREN) {
-			assignment_expression();
-			while (tok == COMMA) {
-				match(COMMA);
-				assignment_expression();
+	if (p->tok == LBRAC) {
+		wrap_node(p, m, AST_INDEX, 0);
+		match(p, LBRAC);
+		expression(p);
+		match(p, RBRAC);
+		close_node(p);
+	}
+	else if (p->tok == LPAREN) {
+		wrap_node(p, m, AST_CALL, 0);
+		match(p, LPAREN);
+		if (p->tok != RPAREN) {
+			assignment_expression(p);
+			while (p->tok == COMMA) {
+				match(p, COMMA);
+				assignment_expression(p);
 			}
 		}
-		match(RPAREN);
+		match(p, RPAREN);
+		close_node(p);
 	}
-	else if (tok == DOT || tok == ARROW) {
-		match(tok);
-		match(IDENTIFIER);
+	else if (p->tok == DOT || p->tok == ARROW) {
+		wrap_node(p, m, AST_MEMBER, p->tok);
+		match(p, p->tok);
+		match_node(p, AST_NAME, IDENTIFIER);
+		close_node(p);
 	}
-	else if (tok == PLUSPLUS || tok == MINUSMINUS) {
-		match(tok);
+	else if (p->tok == PLUSPLUS || p->tok == MINUSMINUS) {
+		wrap_node(p, m, AST_POSTFIX, p->tok);
+		match(p, p->tok);
+		close_node(p);
 	}
 	TRACEOUT("postfix_operator");
 }
 
 static void
-postfix_operators(void)
+postfix_operators(parser_t *p, mark_t m)
 {
 	TRACEIN("postfix_operators");
-	while (tok == LBRAC || tok == LPAREN || tok == DOT ||
-		tok == ARROW || tok == PLUSPLUS || tok == MINUSMINUS) {
-		postfix_operator();
+	while (p->tok == LBRAC || p->tok == LPAREN || p->tok == DOT ||
+		p->tok == ARROW || p->tok == PLUSPLUS || p->tok == MINUSMINUS) {
+		postfix_operator(p, m);
 	}
 	TRACEOUT("postfix_operators");
 }
 
 static void
-sizeof_expression(void)
+sizeof_expression(parser_t *p)
 {
 	TRACEIN("sizeof_expression");
 	
-	match(SIZEOF);
-	if (tok == LPAREN) {
+	open_node(p, AST_SIZEOF, SIZEOF);
+	match(p, SIZEOF);
+	if (p->tok == LPAREN) {
 		int found_typename = 0;
-		match(LPAREN);
-		if (is_type_name(tok)) {
-			type_name();
+		mark_t m = node_mark(p);
+		match(p, LPAREN);
+		if (is_type_name(p->tok)) {
+			type_name(p);
 			found_typename = 1;
 		}
 		else {
-			expression();
+			expression(p);
 		}
-		match(RPAREN);
+		match(p, RPAREN);
 #if 1 /* as per comp.std.c */
-		if (found_typename && tok == LBRACE) {
-			initializer(0);
-			postfix_operators();
+		if (found_typename && p->tok == LBRACE) {
+			wrap_node(p, m, AST_COMPOUND_LITERAL, 0);
+			initializer(p, 0);
+			close_node(p);
+			postfix_operators(p, m);
 		}
 #endif
 		else if (!found_typename) {
-			postfix_operators();
+			postfix_operators(p, m);
 		}
 	}
 	else {
-		unary_expression();
+		unary_expression(p);
 	}
+	close_node(p);
 	TRACEOUT("sizeof_expression");
 }
 
 static void
-unary_expression(void)
+unary_expression(parser_t *p)
 {
 	TRACEIN("unary_expression");
-	if (tok == SIZEOF) {
-		sizeof_expression();
+	if (p->tok == SIZEOF) {
+		sizeof_expression(p);
 	}
-	else if (tok == LPAREN) {
+	else if (p->tok == LPAREN) {
 		int found_typename = 0;
-		match(LPAREN);
-		if (is_type_name(tok)) {
-			type_name();
+		mark_t m = node_mark(p);
+		match(p, LPAREN);
+		if (is_type_name(p->tok)) {
+			type_name(p);
 			found_typename = 1;
 		}
 		else {
-			expression();
+			expression(p);
 		}
-		match(RPAREN);
-		if (found_typename && tok == LBRACE) {
-			initializer(0);
-			postfix_operators();
+		match(p, RPAREN);
+		if (found_typename && p->tok == LBRACE) {
+			wrap_node(p, m, AST_COMPOUND_LITERAL, 0);
+			initializer(p, 0);
+			close_node(p);
+			postfix_operators(p, m);
 		}
 		else if (!found_typename) {
-			postfix_operators();
+			postfix_operators(p, m);
 		}
 		else {
-			unary_expression();
+			wrap_node(p, m, AST_CAST, 0);
+			unary_expression(p);
+			close_node(p);
 		}
 	}
-	else if (tok == PLUSPLUS || tok == MINUSMINUS || tok == AND
-		|| tok == STAR || tok == PLUS || tok == MINUS
-		|| tok == TILDE || tok == NOT) {
-		match(tok);
-		unary_expression();
+	else if (p->tok == PLUSPLUS || p->tok == MINUSMINUS || p->tok == AND
+		|| p->tok == STAR || p->tok == PLUS || p->tok == MINUS
+		|| p->tok == TILDE || p->tok == NOT) {
+		open_node(p, AST_UNARY, p->tok);
+		match(p, p->tok);
+		unary_expression(p);
+		close_node(p);
 	}
 	else {
-		primary_expression();
-		postfix_operators();
+		mark_t m = node_mark(p);
+		primary_expression(p);
+		postfix_operators(p, m);
 	}
 	TRACEOUT("unary_expression");
 }
 
 static void
-multiplicative_expression(void)
+multiplicative_expression(parser_t *p)
 {
+	mark_t m = node_mark(p);
+
 	TRACEIN("multiplicative_expression");
-	unary_expression();
-	while (tok == STAR || tok == SLASH || tok == PERCENT) {
-		match(tok);
-		unary_expression();
+	unary_expression(p);
+	while (p->tok == STAR || p->tok == SLASH || p->tok == PERCENT) {
+		wrap_node(p, m, AST_BINARY, p->tok);
+		match(p, p->tok);
+		unary_expression(p);
+		close_node(p);
 	}
 	TRACEOUT("multiplicative_expression");
 }
 
 static void
-additive_expression(void)
+additive_expression(parser_t *p)
 {
+	mark_t m = node_mark(p);
+
 	TRACEIN("additive_expression");
-	multiplicative_expression();
-	while (tok == PLUS || tok == MINUS) {
-		match(tok);
-		multiplicative_expression();
+	multiplicative_expression(p);
+	while (p->tok == PLUS || p->tok == MINUS) {
+		wrap_node(p, m, AST_BINARY, p->tok);
+		match(p, p->tok);
+		multiplicative_expression(p);
+		close_node(p);
 	}
 	TRACEOUT("additive_expression");
 }
 
 static void
-shift_expression(void)
+shift_expression(parser_t *p)
 {
+	mark_t m = node_mark(p);
+
 	TRACEIN("shift_expression");
-	additive_expression();
-	while (tok == LSHIFT || tok == RSHIFT) {
-		match(tok);
-		additive_expression();
+	additive_expression(p);
+	while (p->tok == LSHIFT || p->tok == RSHIFT) {
+		wrap_node(p, m, AST_BINARY, p->tok);
+		match(p, p->tok);
+		additive_expression(p);
+		close_node(p);
 	}
 	TRACEOUT("shift_expression");
 }
 
 static void
-relational_expression(void)
+relational_expression(parser_t *p)
 {
+	mark_t m = node_mark(p);
+
 	TRACEIN("relational_expression");
-	shift_expression();
-	while (tok == GREATERTHAN || tok == LESSTHAN || tok == GTEQ || tok == LESSEQ) {
-		match(tok);
-		shift_expression();
+	shift_expression(p);
+	while (p->tok == GREATERTHAN || p->tok == LESSTHAN || p->tok == GTEQ || p->tok == LESSEQ) {
+		wrap_node(p, m, AST_BINARY, p->tok);
+		match(p, p->tok);
+		shift_expression(p);
+		close_node(p);
 	}
 	TRACEOUT("relational_expression");
 }
 
 static void
-equality_expression(void)
+equality_expression(parser_t *p)
 {
+	mark_t m = node_mark(p);
+
 	TRACEIN("equality_expression");
-	relational_expression();
-	while (tok == EQEQ || tok == NOTEQ) {
-		match(tok);
-		relational_expression();
+	relational_expression(p);
+	while (p->tok == EQEQ || p->tok == NOTEQ) {
+		wrap_node(p, m, AST_BINARY, p->tok);
+		match(p, p->tok);
+		relational_expression(p);
+		close_node(p);
 	}
 	TRACEOUT("equality_expression");
 }
 
 static void
-and_expression(void)
+and_expression(parser_t *p)
 {
+	mark_t m = node_mark(p);
+
 	TRACEIN("and_expression");
-	equality_expression();
-	while (tok == AND) {
-		match(AND);
-		equality_expression();
+	equality_expression(p);
+	while (p->tok == AND) {
+		wrap_node(p, m, AST_BINARY, p->tok);
+		match(p, AND);
+		equality_expression(p);
+		close_node(p);
 	}
 	TRACEOUT("and_expression");
 }
 
 static void
-exclusive_or_expression(void)
+exclusive_or_expression(parser_t *p)
 {
+	mark_t m = node_mark(p);
+
 	TRACEIN("exclusive_or_expression");
-	and_expression();
-	while (tok == XOR) {
-		match(XOR);
-		and_expression();
+	and_expression(p);
+	while (p->tok == XOR) {
+		wrap_node(p, m, AST_BINARY, p->tok);
+		match(p, XOR);
+		and_expression(p);
+		close_node(p);
 	}
 	TRACEOUT("exclusive_or_expression");
 }
 
 static void
-inclusive_or_expression(void)
+inclusive_or_expression(parser_t *p)
 {
+	mark_t m = node_mark(p);
+
 	TRACEIN("inclusive_or_expression");
-	exclusive_or_expression();
-	while (tok == OR) {
-		match(OR);
-		exclusive_or_expression();
+	exclusive_or_expression(p);
+	while (p->tok == OR) {
+		wrap_node(p, m, AST_BINARY, p->tok);
+		match(p, OR);
+		exclusive_or_expression(p);
+		close_node(p);
 	}
 	TRACEOUT("inclusive_or_expression");
 }
 
 static void
-logical_and_expression(void)
+logical_and_expression(parser_t *p)
 {
+	mark_t m = node_mark(p);
+
 	TRACEIN("logical_and_expression");
-	inclusive_or_expression();
-	while (tok == ANDAND) {
-		match(ANDAND);
-		inclusive_or_expression();
+	inclusive_or_expression(p);
+	while (p->tok == ANDAND) {
+		wrap_node(p, m, AST_BINARY, p->tok);
+		match(p, ANDAND);
+		inclusive_or_expression(p);
+		close_node(p);
 	}
 	TRACEOUT("logical_and_expression");
 }
 
 
 static void
-logical_or_expression(void)
+logical_or_expression(parser_t *p)
 {
+	mark_t m = node_mark(p);
+
 	TRACEIN("logical_or_expression");
-	logical_and_expression();
-	while (tok == OROR) {
-		match(OROR);
-		logical_and_expression();
+	logical_and_expression(p);
+	while (p->tok == OROR) {
+		wrap_node(p, m, AST_BINARY, p->tok);
+		match(p, OROR);
+		logical_and_expression(p);
+		close_node(p);
 	}
 	TRACEOUT("logical_or_expression");
 }
 
 static void
-conditional_expression(void)
+conditional_expression(parser_t *p)
 {
+	mark_t m;
+
+	if (climbing(p)) {
+		climb_expression(p, FALSE);
+		return;
+	}
 	TRACEIN("conditional_expression");
-	logical_or_expression();
-	if (tok == QUERY) {
-		match(QUERY);
-		expression();
-		match(COLON);
-		conditional_expression();
+	m = node_mark(p);
+	logical_or_expression(p);
+	if (p->tok == QUERY) {
+		wrap_node(p, m, AST_CONDITIONAL, 0);
+		match(p, QUERY);
+		expression(p);
+		match(p, COLON);
+		conditional_expression(p);
+		close_node(p);
 	}
 	TRACEOUT("conditional_expression");
 }
 
 static void
-assignment_expression(void)
+assignment_expression(parser_t *p)
 {
+	mark_t m;
+
+	if (climbing(p)) {
+		climb_expression(p, TRUE);
+		return;
+	}
 	TRACEIN("assignment_expression");
-	conditional_expression();
-	if (is_assign_operator(tok)) {
+	m = node_mark(p);
+	conditional_expression(p);
+	if (is_assign_operator(p->tok)) {
 		/* TODO: check that previous expression was unary */
-		match(tok);
-		assignment_expression();
+		wrap_node(p, m, AST_ASSIGN, p->tok);
+		match(p, p->tok);
+		assignment_expression(p);
+		close_node(p);
 	}
 	TRACEOUT("assignment_expression");
 }
 
+/*
+ *  Expressions by precedence climbing.  The functions above follow the
+ *  grammar, one per level of precedence, so reaching a lone name means
+ *  going through all of them.  Here the binary operators are parsed by
+ *  one function driven by binary_precedence(), and prefix operators,
+ *  casts and postfix operators are taken in loops, so each operand
+ *  costs about the same few calls however it is written.  The same
+ *  inputs are accepted and rejected.  Tracing shows the grammar, so it
+ *  uses the functions above, as does setting p->descent.
+ */
+
+/*  An assignment_expression, or with assignment FALSE a
+ *  conditional_expression.  Neither the "? :" nor the assignment
+ *  operators need climbing: a conditional is a chain of binary
+ *  expressions joined by "? expression :", and an assignment a chain
+ *  of conditionals joined by assignment operators.  Both group to the
+ *  right, so their nodes are left open to the end, except that an
+ *  assignment takes the whole conditional before it as its left
+ *  operand.
+ */
+static void
+climb_expression(parser_t *p, bool assignment)
+{
+	mark_t m, operand;
+	int nconds = 0, nassigns = 0;
+
+	operand = node_mark(p);
+	for (;;) {
+		m = node_mark(p);
+		climb_binary(p, PREC_LOGICAL_OR);
+		if (p->tok == QUERY) {
+			wrap_node(p, m, AST_CONDITIONAL, 0);
+			nconds++;
+			match(p, QUERY);
+			expression(p);
+			match(p, COLON);
+		}
+		else if (assignment && is_assign_operator(p->tok)) {
+			close_nodes(p, nconds);
+			nconds = 0;
+			wrap_node(p, operand, AST_ASSIGN, p->tok);
+			nassigns++;
+			match(p, p->tok);
+			operand = node_mark(p);
+		}
+		else
+			break;
+	}
+	close_nodes(p, nconds + nassigns);
+}
+
+/*  Operands joined by binary operators of at least min_prec, all of
+ *  them left associative.
+ */
+static void
+climb_binary(parser_t *p, int min_prec)
+{
+	mark_t m = node_mark(p);
+	int prec;
+
+	cast_expression(p);
+	while ((prec = binary_precedence(p->tok)) >= min_prec) {
+		wrap_node(p, m, AST_BINARY, p->tok);
+		match(p, p->tok);
+		/* Only operators that bind tighter can take the next operand */
+		if (prec == PREC_MULTIPLICATIVE)
+			cast_expression(p);
+		else
+			climb_binary(p, prec + 1);
+		close_node(p);
+	}
+}
+
+/*  A unary_expression, which in this grammar includes casts, and its
+ *  postfix operators.  The nodes of the prefix operators, sizeof and
+ *  casts are left open until the operand is complete.
+ */
+static void
+cast_expression(parser_t *p)
+{
+	bool is_sizeof;
+	mark_t m;
+	int nopen = 0;
+
+	for (;;) {
+		switch (p->tok) {
+		case PLUSPLUS: case MINUSMINUS: case AND: case STAR:
+		case PLUS: case MINUS: case TILDE: case NOT:
+			open_node(p, AST_UNARY, p->tok);
+			nopen++;
+			match(p, p->tok);
+			continue;
+		case SIZEOF:
+			open_node(p, AST_SIZEOF, SIZEOF);
+			nopen++;
+			match(p, SIZEOF);
+			if (p->tok != LPAREN)
+				continue;
+			is_sizeof = TRUE;
+			break;
+		case LPAREN:
+			is_sizeof = FALSE;
+			break;
+		case IDENTIFIER:
+			m = node_mark(p);
+			check_not_typedef(p);
+			match_node(p, AST_NAME, IDENTIFIER);
+			goto postfix;
+		default:
+			m = node_mark(p);
+			if (TokMap[p->tok] & TOK_CONSTANT)
+				match_constant(p);
+			goto postfix;
+		}
+
+		/* "(" type_name ")" or "(" expression ")" */
+		m = node_mark(p);
+		match(p, LPAREN);
+		if (!is_type_name(p->tok)) {
+			expression(p);
+			match(p, RPAREN);
+			break;
+		}
+		type_name(p);
+		match(p, RPAREN);
+		if (p->tok == LBRACE) {
+			/* a compound literal */
+			wrap_node(p, m, AST_COMPOUND_LITERAL, 0);
+			initializer(p, 0);
+			close_node(p);
+			break;
+		}
+		if (is_sizeof) {
+			close_nodes(p, nopen);
+			return;
+		}
+		/* a cast, so go on to its operand */
+		wrap_node(p, m, AST_CAST, 0);
+		nopen++;
+	}
+
+postfix:
+	for (;;) {
+		switch (p->tok) {
+		case LBRAC:
+			wrap_node(p, m, AST_INDEX, 0);
+			match(p, LBRAC);
+			expression(p);
+			match(p, RBRAC);
+			break;
+		case LPAREN:
+			wrap_node(p, m, AST_CALL, 0);
+			match(p, LPAREN);
+			if (p->tok != RPAREN) {
+				assignment_expression(p);
+				while (p->tok == COMMA) {
+					match(p, COMMA);
+					assignment_expression(p);
+				}
+			}
+			match(p, RPAREN);
+			break;
+		case DOT:
+		case ARROW:
+			wrap_node(p, m, AST_MEMBER, p->tok);
+			match(p, p->tok);
+			match_node(p, AST_NAME, IDENTIFIER);
+			break;
+		case PLUSPLUS:
+		case MINUSMINUS:
+			wrap_node(p, m, AST_POSTFIX, p->tok);
+			match(p, p->tok);
+			break;
+		default:
+			close_nodes(p, nopen);
+			return;
+		}
+		close_node(p);
+	}
+}
+
 static void
-labeled_statement(void)
+labeled_statement(parser_t *p)
 {
 	TRACEIN("labeled_statement");
-	match(IDENTIFIER);
-	match(COLON);
-	statement();
+	open_node(p, AST_LABEL, 0);
+	match_node(p, AST_NAME, IDENTIFIER);
+	match(p, COLON);
+	statement(p);
+	close_node(p);
 	TRACEOUT("labeled_statement");
 }
 
 static void
-case_statement(void)
+case_statement(parser_t *p)
 {
 	TRACEIN("case_statement");
-	match(CASE);
-	constant_expression();
-	match(COLON);
-	statement();
+	open_node(p, AST_CASE, 0);
+	match(p, CASE);
+	constant_expression(p);
+	match(p, COLON);
+	statement(p);
+	close_node(p);
 	TRACEOUT("case_statement");
 }
 
 static void
-default_statement(void)
+default_statement(parser_t *p)
 {
 	TRACEIN("default_statement");
-	match(DEFAULT);
-	match(COLON);
-	statement();
+	open_node(p, AST_DEFAULT, 0);
+	match(p, DEFAULT);
+	match(p, COLON);
+	statement(p);
+	close_node(p);
 	TRACEOUT("default_statement");
 }
 
 static void
-if_statement(void)
+if_statement(parser_t *p)
 {
 	TRACEIN("if_statement");
-	enter_scope();
-	match(IF);
-	match(LPAREN);
-	expression();
-	match(RPAREN);
-	enter_scope();
-	statement();
-	exit_scope();
-	if (tok == ELSE) {
-		enter_scope();
-		match(ELSE);
-		statement();
-		exit_scope();
-	}
-	exit_scope();
+	enter_scope(p);
+	open_node(p, AST_IF, 0);
+	match(p, IF);
+	match(p, LPAREN);
+	expression(p);
+	match(p, RPAREN);
+	enter_scope(p);
+	statement(p);
+	exit_scope(p);
+	if (p->tok == ELSE) {
+		enter_scope(p);
+		match(p, ELSE);
+		statement(p);
+		exit_scope(p);
+	}
+	close_node(p);
+	exit_scope(p);
 	TRACEOUT("if_statement");
 }
 
 static void
-switch_statement(void)
+switch_statement(parser_t *p)
 {
 	TRACEIN("switch_statement");
-	enter_scope();
-	match(SWITCH);
-	match(LPAREN);
-	expression();
-	match(RPAREN);
-	enter_scope();
-	statement();
-	exit_scope();
-	exit_scope();
+	enter_scope(p);
+	open_node(p, AST_SWITCH, 0);
+	match(p, SWITCH);
+	match(p, LPAREN);
+	expression(p);
+	match(p, RPAREN);
+	enter_scope(p);
+	statement(p);
+	exit_scope(p);
+	close_node(p);
+	exit_scope(p);
 	TRACEOUT("switch_statement");
 }
 
 static void
-while_statement(void)
+while_statement(parser_t *p)
 {
 	TRACEIN("while_statement");
-	enter_scope();
-	match(WHILE);
-	match(LPAREN);
-	expression();
-	match(RPAREN);
-	enter_scope();
-	statement();
-	exit_scope();
-	exit_scope();
+	enter_scope(p);
+	open_node(p, AST_WHILE, 0);
+	match(p, WHILE);
+	match(p, LPAREN);
+	expression(p);
+	match(p, RPAREN);
+	enter_scope(p);
+	statement(p);
+	exit_scope(p);
+	close_node(p);
+	exit_scope(p);
 	TRACEOUT("while_statement");
 }
 
 static void
-do_while_statement(void)
+do_while_statement(parser_t *p)
 {
 	TRACEIN("do_while_statement");
-	enter_scope();
-	match(DO);
-	enter_scope();
-	statement();
-	exit_scope();
-	match(WHILE);
-	match(LPAREN);
-	expression();
-	match(RPAREN);
-	exit_scope();
-	match(SEMI);
+	enter_scope(p);
+	open_node(p, AST_DO, 0);
+	match(p, DO);
+	enter_scope(p);
+	statement(p);
+	exit_scope(p);
+	match(p, WHILE);
+	match(p, LPAREN);
+	expression(p);
+	match(p, RPAREN);
+	exit_scope(p);
+	match(p, SEMI);
+	close_node(p);
 	TRACEOUT("do_while_statement");
 }
 
 static void
-for_statement(void)
+for_statement(parser_t *p)
 {
 	TRACEIN("for_statement");
-	enter_scope();
-	match(FOR);
-	match(LPAREN);
-	if (tok != SEMI) {
-		if (is_declaration(tok)) {
-			declaration();
+	enter_scope(p);
+	open_node(p, AST_FOR, 0);
+	match(p, FOR);
+	match(p, LPAREN);
+	if (p->tok != SEMI) {
+		if (is_declaration(p->tok)) {
+			declaration(p);
 		}
 		else {	
-			expression();
-			match(SEMI);
+			expression(p);
+			match(p, SEMI);
 		}
 	}
 	else {
-		match(SEMI);
-	}
-	if (tok != SEMI)
-		expression();
-	match(SEMI);
-	if (tok != RPAREN)
-		expression();
-	match(RPAREN);
-	enter_scope();
-	statement();
-	exit_scope();
-	exit_scope();
+		empty_node(p);
+		match(p, SEMI);
+	}
+	if (p->tok != SEMI)
+		expression(p);
+	else
+		empty_node(p);
+	match(p, SEMI);
+	if (p->tok != RPAREN)
+		expression(p);
+	else
+		empty_node(p);
+	match(p, RPAREN);
+	enter_scope(p);
+	statement(p);
+	exit_scope(p);
+	close_node(p);
+	exit_scope(p);
 	TRACEOUT("for_statement");
 }
 
 static void
-break_statement(void)
+break_statement(parser_t *p)
 {
 	TRACEIN("break_statement");
-	match(BREAK);
-	match(SEMI);
+	open_node(p, AST_BREAK, 0);
+	match(p, BREAK);
+	match(p, SEMI);
+	close_node(p);
 	TRACEOUT("break_statement");
 }
 
 static void
-continue_statement(void)
+continue_statement(parser_t *p)
 {
 	TRACEIN("continue_statement");
-	match(CONTINUE);
-	match(SEMI);
+	open_node(p, AST_CONTINUE, 0);
+	match(p, CONTINUE);
+	match(p, SEMI);
+	close_node(p);
 	TRACEOUT("continue_statement");
 }
 
 static void
-goto_statement(void)
+goto_statement(parser_t *p)
 {
 	TRACEIN("goto_statement");
-	match(GOTO);
-	match(IDENTIFIER);
-	match(SEMI);
+	open_node(p, AST_GOTO, 0);
+	match(p, GOTO);
+	match_node(p, AST_NAME, IDENTIFIER);
+	match(p, SEMI);
+	close_node(p);
 	TRACEOUT("goto_statement");
 }
 
 static void
-return_statement(void)
+return_statement(parser_t *p)
 {
 	TRACEIN("return_statement");
-	match(RETURN);
-	if (tok != SEMI)
-		expression();
-	match(SEMI);
+	open_node(p, AST_RETURN, 0);
+	match(p, RETURN);
+	if (p->tok != SEMI)
+		expression(p);
+	match(p, SEMI);
+	close_node(p);
 	TRACEOUT("return_statement");
 }
 
 static void
-empty_statement(void)
+empty_statement(parser_t *p)
 {
 	TRACEIN("empty_statement");
-	match(SEMI);
+	match_node(p, AST_EMPTY, SEMI);
 	TRACEOUT("empty_statement");
 }
 
 static void
-expression_statement(void)
+expression_statement(parser_t *p)
 {
 	TRACEIN("expression_statement");
 
-	if (tok == IDENTIFIER && lex_colon_follows()) {
-		labeled_statement();
+	if (p->tok == IDENTIFIER && peek_token(p, 1) == COLON) {
+		labeled_statement(p);
 	}
 	else {
-		expression();
-		match(SEMI);
+		open_node(p, AST_EXPRESSION_STATEMENT, 0);
+		expression(p);
+		match(p, SEMI);
+		close_node(p);
 	}
 	TRACEOUT("expression_statement");
 }
 
 static void
-statement(void)
+statement(parser_t *p)
 {
 	TRACEIN("statement");
-	switch (tok) {
-	case IDENTIFIER: expression_statement(); break;
-	case CASE: case_statement(); break;
-	case DEFAULT: default_statement(); break;
-	case IF: if_statement(); break;
-	case SWITCH: switch_statement(); break;
-	case WHILE: while_statement(); break;
-	case DO: do_while_statement(); break;
-	case FOR: for_statement(); break;
-	case BREAK: break_statement(); break;
-	case CONTINUE: continue_statement(); break;
-	case GOTO: goto_statement(); break;
-	case RETURN: return_statement(); break;
-	case LBRACE: compound_statement(); break;
-	case SEMI: empty_statement(); break;
+	switch (p->tok) {
+	case IDENTIFIER: expression_statement(p); break;
+	case CASE: case_statement(p); break;
+	case DEFAULT: default_statement(p); break;
+	case IF: if_statement(p); break;
+	case SWITCH: switch_statement(p); break;
+	case WHILE: while_statement(p); break;
+	case DO: do_while_statement(p); break;
+	case FOR: for_statement(p); break;
+	case BREAK: break_statement(p); break;
+	case CONTINUE: continue_statement(p); break;
+	case GOTO: goto_statement(p); break;
+	case RETURN: return_statement(p); break;
+	case LBRACE: compound_statement(p); break;
+	case SEMI: empty_statement(p); break;
 	default: 
-		if (is_expression(tok))
-			expression_statement(); 
+		if (is_expression(p->tok))
+			expression_statement(p); 
+		else
+			parse_error(p, "unexpected input %s", tokname(p->tok));
 		break;
 	}
 	TRACEOUT("statement");
@@ -1144,210 +1837,235 @@ statement(void)
 
 
 static void
-compound_statement(void)
+compound_statement(parser_t *p)
 {
 	TRACEIN("compound_statement");
-	enter_scope();
-	match(LBRACE);
-
-	while (tok != RBRACE) {
-		if (is_declaration(tok)) {
-			if (tok == IDENTIFIER && lex_colon_follows())
-				statement();
+	enter_scope(p);
+	open_node(p, AST_COMPOUND, 0);
+	match(p, LBRACE);
+
+	while (p->tok != RBRACE) {
+		if (is_declaration(p->tok)) {
+			if (p->tok == IDENTIFIER && peek_token(p, 1) == COLON)
+				statement(p);
 			else
-				declaration();
+				declaration(p);
 		}
 		else {
-			statement();
+			statement(p);
 		}
 	}
-	exit_scope();
-	match(RBRACE);
+	if (p->level == LEVEL_STATEMENT && p->editable)
+		p->body_end = token_offset(p) + 1;
+	exit_scope(p);
+	match(p, RBRACE);
+	close_node(p);
 	TRACEOUT("compound_statement");
 }
 
 static void
-enumerator(void)
+enumerator(parser_t *p)
 {
 	TRACEIN("enumerator");
-	if (tok == IDENTIFIER) {
-		check_not_typedef();
-		install_symbol(Lexeme->identifier->id_name, 
-			Storage_class[stack_ptr], OBJ_ENUMERATOR);
-		match(IDENTIFIER);
+	if (p->tok == IDENTIFIER) {
+		check_not_typedef(p);
+		install_symbol(p, p->lexeme->identifier->id_atom, 
+			p->storage_class[p->stack_ptr], OBJ_ENUMERATOR);
+		open_node(p, AST_ENUMERATOR, 0);
+		match_node(p, AST_NAME, IDENTIFIER);
 	}
 	else {
 		TRACEOUT("enumerator");
 		return;
 	}
-	if (tok == EQUALS) {
-		match(EQUALS);
-		constant_expression();
+	if (p->tok == EQUALS) {
+		match(p, EQUALS);
+		constant_expression(p);
 	}
+	close_node(p);
 	TRACEOUT("enumerator");
 }
 
 static void
-enum_specifier(void)
+enum_specifier(parser_t *p)
 {
 	TRACEIN("enum_specifier");
-	if (tok == ENUM) {
-		match(ENUM);
+	if (p->tok == ENUM) {
+		open_node(p, AST_ENUM, 0);
+		match(p, ENUM);
 	}
 	else {
 		TRACEOUT("enum_specifier");
 		return;
 	}
-	if (tok == IDENTIFIER) {
-		match(IDENTIFIER);
+	if (p->tok == IDENTIFIER) {
+		match_node(p, AST_NAME, IDENTIFIER);
 	}
-	if (tok == LBRACE) {
-		match(LBRACE);
-		enumerator();
-		while (tok == COMMA) {
-			match(COMMA);
-			enumerator();
+	if (p->tok == LBRACE) {
+		match(p, LBRACE);
+		enumerator(p);
+		while (p->tok == COMMA) {
+			match(p, COMMA);
+			enumerator(p);
 		}
-		match(RBRACE);
+		match(p, RBRACE);
 	}
+	close_node(p);
 	TRACEOUT("enum_specifier");
 }
 
 static void
-member(void)
+member(parser_t *p)
 {
+	mark_t m = node_mark(p);
+
 	TRACEIN("member");
-	if (tok != COLON)
-		declarator(0);
-	if (tok == COLON) {
-		match(COLON);
-		constant_expression();
+	if (p->tok != COLON)
+		declarator(p, 0);
+	if (p->tok == COLON) {
+		wrap_node(p, m, AST_FIELD, 0);
+		match(p, COLON);
+		constant_expression(p);
+		close_node(p);
 	}
 	TRACEOUT("member");
 }
 
 static void
-members(void)
+members(parser_t *p)
 {
 	TRACEIN("members");
 	do {
-		stack_ptr++;
-		declaration_specifiers(1);
-		member();
-		while (tok == COMMA) {
-			match(COMMA);
-			member();
+		p->stack_ptr++;
+		open_node(p, AST_DECLARATION, 0);
+		declaration_specifiers(p, 1);
+		member(p);
+		while (p->tok == COMMA) {
+			match(p, COMMA);
+			member(p);
 		}
-		match(SEMI);
-		stack_ptr--;
-	} while (tok != RBRACE);
+		match(p, SEMI);
+		close_node(p);
+		p->stack_ptr--;
+	} while (p->tok != RBRACE);
 	TRACEOUT("members");
 }
 
 static void
-struct_or_union_specifier(void)
+struct_or_union_specifier(parser_t *p)
 {
 	TRACEIN("struct_or_union_specifier");
-	Parsing_struct++;
-	match(tok);
-	if (tok == IDENTIFIER)
-		match(IDENTIFIER);
-	if (tok == LBRACE) {
-		match(LBRACE);
-		members();
-		match(RBRACE);
-	}
-	Parsing_struct--;
+	p->parsing_struct++;
+	open_node(p, AST_STRUCT, p->tok);
+	match(p, p->tok);
+	if (p->tok == IDENTIFIER)
+		match_node(p, AST_NAME, IDENTIFIER);
+	if (p->tok == LBRACE) {
+		match(p, LBRACE);
+		members(p);
+		match(p, RBRACE);
+	}
+	close_node(p);
+	p->parsing_struct--;
 	TRACEOUT("struct_or_union_specifier");
 }
 
 static void
-type_name(void)
+type_name(parser_t *p)
 {
 	TRACEIN("type_name");
-	stack_ptr++;
-	declaration_specifiers(1);
-	declarator(1);
-	stack_ptr--;
+	p->stack_ptr++;
+	open_node(p, AST_TYPE_NAME, 0);
+	declaration_specifiers(p, 1);
+	declarator(p, 1);
+	close_node(p);
+	p->stack_ptr--;
 	TRACEOUT("type_name");
 }
 
 static void
-declaration_specifiers(int no_storage_class)
+declaration_specifiers(parser_t *p, int no_storage_class)
 {
 	bool type_found = FALSE;
 	TRACEIN("declaration_specifiers");
-	assert(stack_ptr >= 0 && stack_ptr < 100);
-	Storage_class[stack_ptr] = 0;
-	while (is_declaration(tok)) {
-		if (no_storage_class && (TokMap[tok] & TOK_STORAGE_CLASS)) {
-			fprintf(stderr, "Parse failed: unexpected storage class %s\n", tokname(tok));
-			exit(1);
+	assert(p->stack_ptr >= 0 && p->stack_ptr < 100);
+	p->storage_class[p->stack_ptr] = 0;
+	open_node(p, AST_SPECIFIERS, 0);
+	while (is_declaration(p->tok)) {
+		if (no_storage_class && (TokMap[p->tok] & TOK_STORAGE_CLASS)) {
+			parse_error(p, "unexpected storage class %s", tokname(p->tok));
 		}
-		if (tok == IDENTIFIER && type_found)
+		if (p->tok == IDENTIFIER && type_found)
 			break;
-		if ((TokMap[tok] & TOK_TYPE_SPECIFIER) || tok == IDENTIFIER) {
+		if ((TokMap[p->tok] & TOK_TYPE_SPECIFIER) || p->tok == IDENTIFIER) {
 			type_found = TRUE;
 		}
-		if (TokMap[tok] & TOK_STRUCT) {
-			struct_or_union_specifier();
+		if (TokMap[p->tok] & TOK_STRUCT) {
+			struct_or_union_specifier(p);
 			break;
 		}
-		else if (tok == ENUM) {
-			enum_specifier();
+		else if (p->tok == ENUM) {
+			enum_specifier(p);
 			break;
 		}
 		else {
 			bool savedtok = 0;
-			if (TokMap[tok] & TOK_STORAGE_CLASS) {
-				Storage_class[stack_ptr] = tok;
+			if (TokMap[p->tok] & TOK_STORAGE_CLASS) {
+				p->storage_class[p->stack_ptr] = p->tok;
 			}
-			else if (tok == IDENTIFIER) {
-				savedtok = tok;
+			else if (p->tok == IDENTIFIER) {
+				savedtok = p->tok;
 			}
-			match(tok);
+			match_node(p, savedtok == IDENTIFIER ? AST_NAME :
+					AST_KEYWORD, p->tok);
 			if (savedtok == IDENTIFIER)
 				break;
 		}
 	}
+	close_node(p);
 	TRACEOUT("declaration_specifiers");
 }
 
 static void
-pointer(void)
+pointer(parser_t *p)
 {
 	TRACEIN("pointer");
-	while (tok == STAR) {
-		match(STAR);
-		while (TokMap[tok] & TOK_TYPE_QUALIFIER) {
-			match(tok);
+	while (p->tok == STAR) {
+		open_node(p, AST_POINTER, 0);
+		match(p, STAR);
+		while (TokMap[p->tok] & TOK_TYPE_QUALIFIER) {
+			match_node(p, AST_KEYWORD, p->tok);
 		}
+		close_node(p);
 	}
 	TRACEOUT("pointer");
 }
 
 static void
-direct_declarator(int abstract)
+direct_declarator(parser_t *p, int abstract)
 {
 	TRACEIN("direct_declarator");
-	if (tok == LPAREN) {
-		match(LPAREN);
-		declarator(abstract);
-		match(RPAREN);
+	if (p->tok == LPAREN) {
+		match(p, LPAREN);
+		declarator(p, abstract);
+		match(p, RPAREN);
 	}
 	else {
 		if (!abstract) {
-			if (tok == IDENTIFIER) {
-				Saw_ident = 1;
-				if (Storage_class[stack_ptr] == TYPEDEF) {
-					install_symbol(Lexeme->identifier->id_name, 
+			if (p->tok == IDENTIFIER) {
+				p->saw_ident = 1;
+				if (p->storage_class[p->stack_ptr] == TYPEDEF) {
+					install_symbol(p, p->lexeme->identifier->id_atom, 
 						TYPEDEF, OBJ_TYPEDEF_NAME);
 				}
-				else if (!Parsing_struct && !Parsing_oldstyle_parmdecl) {
-					install_symbol(Lexeme->identifier->id_name, 
-						Storage_class[stack_ptr], OBJ_IDENTIFIER);
+				else if (!p->parsing_struct && !p->parsing_oldstyle_parmdecl) {
+					install_symbol(p, p->lexeme->identifier->id_atom, 
+						p->storage_class[p->stack_ptr], OBJ_IDENTIFIER);
 				}
-				match(IDENTIFIER);
+				if (p->level == LEVEL_GLOBAL)
+					p->declarator_name =
+						p->lexeme->identifier->id_atom;
+				match_node(p, AST_NAME, IDENTIFIER);
 			}
 		}
 	}
@@ -1355,24 +2073,22 @@ direct_declarator(int abstract)
 }
 
 static void 
-parameter_list(int *new_style)
+parameter_list(parser_t *p, int *new_style)
 {
 	TRACEIN("parameter_list");
-	if (tok == IDENTIFIER && (Cursym == 0 || Cursym->object_type != OBJ_TYPEDEF_NAME)) {
+	if (p->tok == IDENTIFIER && (p->cursym == 0 || p->cursym->object_type != OBJ_TYPEDEF_NAME)) {
 		*new_style = 0;
-		install_symbol(Lexeme->identifier->id_name, 
+		install_symbol(p, p->lexeme->identifier->id_atom, 
 			AUTO, OBJ_PARAMETER);
-		match(IDENTIFIER);
-		while (tok == COMMA) {
-			match(COMMA);
-			if (tok == IDENTIFIER) {
-				check_not_typedef();
-				install_symbol(Lexeme->identifier->id_name, 
+		match_node(p, AST_NAME, IDENTIFIER);
+		while (p->tok == COMMA) {
+			match(p, COMMA);
+			if (p->tok == IDENTIFIER) {
+				check_not_typedef(p);
+				install_symbol(p, p->lexeme->identifier->id_atom, 
 					AUTO, OBJ_PARAMETER);
-				match(tok);
 			}
-			else
-				match(IDENTIFIER);
+			match_node(p, AST_NAME, IDENTIFIER);
 		}
 	}
 	else {
@@ -1383,156 +2099,324 @@ parameter_list(int *new_style)
 		 */
 
 		*new_style = 1;
-		stack_ptr++;
-		declaration_specifiers(0);
-		declarator(0);
-		stack_ptr--;
-		while (tok == COMMA) {
-			match(COMMA);
-			if (tok == ELLIPSIS) {
-				match(ELLIPSIS);
+		p->stack_ptr++;
+		open_node(p, AST_PARAMETER, 0);
+		declaration_specifiers(p, 0);
+		declarator(p, 0);
+		close_node(p);
+		p->stack_ptr--;
+		while (p->tok == COMMA) {
+			match(p, COMMA);
+			if (p->tok == ELLIPSIS) {
+				match_node(p, AST_ELLIPSIS, ELLIPSIS);
 				break;
 			}
-			stack_ptr++;
-			declaration_specifiers(0);
-			declarator(0);
-			stack_ptr--;
+			p->stack_ptr++;
+			open_node(p, AST_PARAMETER, 0);
+			declaration_specifiers(p, 0);
+			declarator(p, 0);
+			close_node(p);
+			p->stack_ptr--;
 		}
 	}
 	TRACEOUT("parameter_list");
 }
 
 static void
-suffix_declarator(void)
+suffix_declarator(parser_t *p)
 {
 	TRACEIN("suffix_declarator");
-	if (tok == LBRAC) {
-		match(LBRAC);
-		constant_expression();
-		match(RBRAC);
+	if (p->tok == LBRAC) {
+		open_node(p, AST_ARRAY, 0);
+		match(p, LBRAC);
+		constant_expression(p);
+		match(p, RBRAC);
+		close_node(p);
 	}
-	else if (tok == LPAREN) {
+	else if (p->tok == LPAREN) {
 		int new_style = 0;
-		enter_scope();
-		match(LPAREN);
-		parameter_list(&new_style);
-		match(RPAREN);
-		if (new_style && tok != LBRACE)
-			exit_scope();
-		Is_func = 1;
+		bool empty;
+		mark_t m;
+
+		enter_scope(p);
+		open_node(p, AST_PARAMETERS, 0);
+		match(p, LPAREN);
+		m = node_mark(p);
+		empty = p->tok == RPAREN;
+		parameter_list(p, &new_style);
+		/* "()" is parsed as one parameter with nothing in it */
+		if (empty)
+			drop_nodes(p, m);
+		match(p, RPAREN);
+		close_node(p);
+		if (new_style && p->tok != LBRACE)
+			exit_scope(p);
+		p->is_func = 1;
 	}
 	TRACEOUT("suffix_declarator");
 }
 
 
 static void
-declarator(int abstract)
+declarator(parser_t *p, int abstract)
 {
 	TRACEIN("declarator");
-	if (tok == STAR) {
-		pointer();
+	open_node(p, AST_DECLARATOR, 0);
+	if (p->tok == STAR) {
+		pointer(p);
 	}
-	direct_declarator(abstract);
-	while (tok == LBRAC || tok == LPAREN) {
-		suffix_declarator();
+	direct_declarator(p, abstract);
+	while (p->tok == LBRAC || p->tok == LPAREN) {
+		suffix_declarator(p);
 	}
+	close_node(p);
 	TRACEOUT("declarator");
 }
 
 static void
-designator(void)
+designator(parser_t *p)
 {
 	TRACEIN("designator");
-	if (tok == LBRAC) {
-		match(LBRAC);
-		constant_expression();
-		match(RBRAC);
-	}
-	else if (tok == DOT) {
-		match(DOT);
-		if (tok == IDENTIFIER) {
-			check_not_typedef();
-			match(tok);
+	if (p->tok == LBRAC) {
+		open_node(p, AST_ARRAY, 0);
+		match(p, LBRAC);
+		constant_expression(p);
+		match(p, RBRAC);
+		close_node(p);
+	}
+	else if (p->tok == DOT) {
+		match(p, DOT);
+		if (p->tok == IDENTIFIER) {
+			check_not_typedef(p);
+			match_node(p, AST_NAME, IDENTIFIER);
 		}
 	}
 	TRACEOUT("designator");
 }
 	
 
+/*
+ * Tables of data are mostly long lists of plain constants.  If the
+ * lookahead is a constant followed by ',' or '}', step over it and as
+ * many more such constants as follow, with the lexer (or straight
+ * through the token buffer), rather than one trip through the whole
+ * expression grammar each.  Returns TRUE with the ',' or '}' after
+ * the last one as the lookahead, or FALSE, having done nothing, if
+ * the element is anything more than a constant.  Tracing and events
+ * need every call, and a syntax tree a node for each constant, so
+ * they turn this off.
+ */
+static bool
+constant_list(parser_t *p)
+{
+	tokbuf_t *tb = &p->tokens;
+	unsigned int i;
+
+	if (p->debug_level != 0 || p->building || p->events != 0 ||
+		!(TokMap[p->tok] & TOK_CONSTANT))
+		return FALSE;
+	if (p->from_tokens) {
+		i = p->tokpos;
+		if (i >= tb->tb_count ||
+			(TB_KIND(tb, i) != COMMA && TB_KIND(tb, i) != RBRACE))
+			return FALSE;
+		while (i + 2 < tb->tb_count && TB_KIND(tb, i) == COMMA &&
+			(TokMap[TB_KIND(tb, i + 1)] & TOK_CONSTANT) &&
+			(TB_KIND(tb, i + 2) == COMMA || TB_KIND(tb, i + 2) == RBRACE))
+			i += 2;
+		p->tokpos = i;
+	}
+	else if (lex_constant_list(&p->lex) == 0)
+		return FALSE;
+	p->tok = next_token(p);
+	return TRUE;
+}
+
 static void
-initializer(int recurse)
+initializer(parser_t *p, int recurse)
 {
 	TRACEIN("initializer");
-	if (tok == LBRACE) {
-		match(LBRACE);
-		initializer(recurse+1);
-		while (tok == COMMA) {
-			match(COMMA);
-			initializer(recurse+1);
+	if (p->tok == LBRACE) {
+		open_node(p, AST_INITIALIZER_LIST, 0);
+		match(p, LBRACE);
+		if (!constant_list(p))
+			initializer(p, recurse+1);
+		while (p->tok == COMMA) {
+			match(p, COMMA);
+			if (!constant_list(p))
+				initializer(p, recurse+1);
 		}
-		match(RBRACE);
+		match(p, RBRACE);
+		close_node(p);
 	}
-	else if (recurse && (tok == LBRAC || tok == DOT)) {
-		while (tok == LBRAC || tok == DOT) {
-			designator();
+	else if (recurse && (p->tok == LBRAC || p->tok == DOT)) {
+		open_node(p, AST_DESIGNATION, 0);
+		while (p->tok == LBRAC || p->tok == DOT) {
+			designator(p);
 		}
-		match(EQUALS);
-		initializer(0);
+		match(p, EQUALS);
+		initializer(p, 0);
+		close_node(p);
 	}
 	else {
-		assignment_expression();
+		assignment_expression(p);
 	}
 	TRACEOUT("initializer");
 }
 
-static void
-function_definition(void)
+/*
+ * Make room for another function body and fill in what is known of it
+ * at its '{', which starts at offset start.  It is not counted until
+ * nbodies is bumped.
+ */
+static body_t *
+new_body(parser_t *p, size_t start)
 {
-	TRACEIN("function_definition");
+	body_t *b;
 
-	if (tok == LBRACE) {
-		compound_statement();
+	if (p->nbodies == p->bodysize) {
+		p->bodysize = p->bodysize ? p->bodysize * 2 : 256;
+		p->bodies = safe_realloc(p->bodies,
+					p->bodysize * sizeof *p->bodies);
 	}
-	else {
-		Parsing_oldstyle_parmdecl++;
-		while (is_declaration(tok)) {
-			/*
-			* CHECK: The only storage class permitted is
-			* register and initialization is not permitted.
-			* if no declaration is given for a parameter,
-			* its type is taken to be int.
-			*/
-	
-		 	declaration();
-	 	}
-		Parsing_oldstyle_parmdecl--;
-	 	compound_statement();
- 	}
-	exit_scope();
-	TRACEOUT("function_definition");
+	b = &p->bodies[p->nbodies];
+	b->info.pb_name = p->declarator_name != 0 ?
+				p->declarator_name->at_name : "";
+	b->info.pb_start = start;
+	b->scope = p->identifiers.st_current;
+	b->scope->kept = 1;
+	b->mark = list_last(&b->scope->symbols);
+	b->horizon = p->identifiers.st_nsymbols;
+	b->lnum = p->lex.le_lnum;
+	b->filename = p->lex.le_filename;
+	return b;
+}
+
+/*
+ * In lazy mode, skip the function body that starts at the current '{'
+ * by matching braces, and note where it is and what scope it belongs
+ * in for parser_parse_body().  Returns FALSE, having done nothing, if
+ * the body has to be parsed now.
+ */
+static bool
+skip_body(parser_t *p)
+{
+	tokbuf_t *tb = &p->tokens;
+	body_t *b;
+	const char *filename;
+	size_t start, end;
+	unsigned int i;
+	int depth, lnum;
+
+	if (!p->lazy || p->tok != LBRACE)
+		return FALSE;
+	start = token_offset(p);
+	lnum = p->lex.le_lnum;
+	filename = p->lex.le_filename;
+	if (p->from_tokens) {
+		depth = 1;
+		for (i = p->tokpos; i < tb->tb_count; ++i) {
+			if (TB_KIND(tb, i) == LBRACE)
+				++depth;
+			else if (TB_KIND(tb, i) == RBRACE && --depth == 0)
+				break;
+		}
+		if (i == tb->tb_count)
+			return FALSE;
+		end = tb->tb_offset[i] + 1;
+		p->tokpos = i + 1;
+	}
+	else {
+		if (lex_skip_block(&p->lex) != 0)
+			return FALSE;
+		end = p->lex.le_lptr - p->lex.le_buf;
+	}
+	b = new_body(p, start);
+	b->info.pb_end = end;
+	b->lnum = lnum;
+	b->filename = filename;
+	if (p->building) {
+		ast_leaf(&p->ast, AST_BODY, 0, b->info.pb_start,
+				b->info.pb_end, 0);
+		p->ast_end = b->info.pb_end;
+	}
+	p->nbodies++;
+	p->tok = next_token(p);
+	return TRUE;
+}
+
+/*
+ * The body of a function definition, skipped in lazy mode.  Where the
+ * input may be edited, a body that is parsed is noted as well, so that
+ * an edit inside it need only parse it again.
+ */
+static void
+function_body(parser_t *p)
+{
+	body_t *b;
+
+	if (skip_body(p))
+		return;
+	if (!p->editable) {
+		compound_statement(p);
+		return;
+	}
+	b = new_body(p, token_offset(p));
+	compound_statement(p);
+	b->info.pb_end = p->body_end;
+	p->nbodies++;
+}
+
+static void
+function_definition(parser_t *p)
+{
+	TRACEIN("function_definition");
+
+	if (p->tok == LBRACE) {
+		function_body(p);
+	}
+	else {
+		p->parsing_oldstyle_parmdecl++;
+		while (is_declaration(p->tok)) {
+			/*
+			* CHECK: The only storage class permitted is
+			* register and initialization is not permitted.
+			* if no declaration is given for a parameter,
+			* its type is taken to be int.
+			*/
+	
+		 	declaration(p);
+	 	}
+		p->parsing_oldstyle_parmdecl--;
+		function_body(p);
+ 	}
+	exit_scope(p);
+	TRACEOUT("function_definition");
 }
 
 static int
-init_declarator(int check_if_function)
+init_declarator(parser_t *p, int check_if_function)
 {
 	int old_Is_func, old_Saw_ident;
 	int func_defn = 0;
+	int level = p->level;
+	mark_t m = node_mark(p);
 	TRACEIN("init_declarator");
 
-	old_Saw_ident = Saw_ident;
-	old_Is_func = Is_func;
+	old_Saw_ident = p->saw_ident;
+	old_Is_func = p->is_func;
 
-	Saw_ident = 0;
-	Is_func = 0;
-	declarator(0);
+	p->saw_ident = 0;
+	p->is_func = 0;
+	declarator(p, 0);
 
 	func_defn = check_if_function &&
-		Level == LEVEL_FUNCTION &&
-		Is_func && 
-		Saw_ident &&
-		is_function_body(tok);
+		p->level == LEVEL_FUNCTION &&
+		p->is_func && 
+		p->saw_ident &&
+		is_function_body(p->tok);
 
-	if (Is_func) {
+	if (p->is_func) {
 		/*
 		 * CHECK: The only storage class specifiers allowed among the
 		 * declaration specifiers are extern or static.
@@ -1543,21 +2427,30 @@ init_declarator(int check_if_function)
 		 */
 	}
 
-	Is_func = old_Is_func;
-	Saw_ident = old_Saw_ident;
+	p->is_func = old_Is_func;
+	p->saw_ident = old_Saw_ident;
 	if (func_defn) {
-		function_definition();
+		if (p->building)
+			ast_retag(&p->ast, AST_FUNCTION);
+		function_definition(p);
 		TRACEOUT("init_declarator");
 		return 1;
 	}
 	else {
-		if (tok == EQUALS) {
+		/* Old style parameters leave their scope open for the
+		 * declarations of their types, which only a definition has.
+		 */
+		if (p->level != level)
+			parse_error(p, "parameter names without types");
+		if (p->tok == EQUALS) {
 			/*
 		 	* CHECK: not allowed when parsing old style function parameters
 		 	* or a prototype.
 		 	*/
-			match(EQUALS);
-			initializer(0);
+			wrap_node(p, m, AST_INIT_DECLARATOR, 0);
+			match(p, EQUALS);
+			initializer(p, 0);
+			close_node(p);
 		}
 	}
 	TRACEOUT("init_declarator");
@@ -1570,29 +2463,31 @@ init_declarator(int check_if_function)
  * 4) empty declarations are not permitted.
  */
 static void
-declaration(void)
+declaration(parser_t *p)
 {
 	TRACEIN("declaration");
 	
-	stack_ptr++;
-	declaration_specifiers(0);
-	if ( tok == SEMI ) {
-		match(SEMI);
+	p->stack_ptr++;
+	open_node(p, AST_DECLARATION, 0);
+	declaration_specifiers(p, 0);
+	if ( p->tok == SEMI ) {
+		match(p, SEMI);
 		goto success;
 	}
 	/* 2) the first declarator at global level may start a function
 	 * definition.
 	 */
-	if (init_declarator(Level == LEVEL_GLOBAL) == 1) {
+	if (init_declarator(p, p->level == LEVEL_GLOBAL) == 1) {
 		goto success;
 	}
-	while ( tok == COMMA ) {
-		match(COMMA);
-		init_declarator(0);
+	while ( p->tok == COMMA ) {
+		match(p, COMMA);
+		init_declarator(p, 0);
 	}
-	match(SEMI);
+	match(p, SEMI);
 success:
-	stack_ptr--;
+	close_node(p);
+	p->stack_ptr--;
 	TRACEOUT("declaration");
 }
 
@@ -1601,80 +2496,1893 @@ success:
  * which are either declarations or function definitions.
  * 2) only at this level can functions be defined.
  */
+/*
+ * Note the start of a top level declaration in input that may be edited.
+ */
+static void
+begin_decl(parser_t *p)
+{
+	decl_t *d;
+
+	if (p->ndecls == p->declsize) {
+		p->declsize = p->declsize ? p->declsize * 2 : 256;
+		p->decls = safe_realloc(p->decls,
+					p->declsize * sizeof *p->decls);
+	}
+	d = &p->decls[p->ndecls++];
+	d->start = token_offset(p);
+	d->lnum = p->lex.le_lnum;
+	d->filename = p->lex.le_filename;
+	d->nsymbols = p->identifiers.st_nsymbols;
+	d->nscopes = p->identifiers.st_nscopes;
+	d->nbodies = p->nbodies;
+	d->nnodes = p->ast.ast_count;
+	d->error = 0;
+}
+
 static void
-translation_unit(void)
+translation_unit(parser_t *p)
 {
 	TRACEIN("translation_unit");
-	Level = LEVEL_GLOBAL;
-	tok = lex_get_token();
-	while (tok != 0) {
+	p->level = LEVEL_GLOBAL;
+	if (!p->stopped)
+		p->tok = next_token(p);
+	p->stopped = 0;
+	while (p->tok != 0) {
+		if (p->stop != NO_STOP && token_offset(p) >= p->stop) {
+			note_stop(p);
+			break;
+		}
+		if (p->editable)
+			begin_decl(p);
 
-		if (is_external_declaration(tok)) {
+		if (is_external_declaration(p->tok)) {
 			/* 
 			 * a function definition looks like a declaration,
 			 * hence is initially parsed as one.
 			 * the check for 2) is in init_declarator().
 			 */
-			declaration();
+			declaration(p);
 		}
-		else if (tok == SEMI) {
+		else if (p->tok == SEMI) {
 			/*ERROR(4): empty declarations are not permitted */
-			match(tok);
+			match(p, p->tok);
 		}
 		else {
-			fprintf(stderr, "Parse failed: unexpected input %s\n",
-				tokname(tok));
-			exit(1);
+			parse_error(p, "unexpected input %s", tokname(p->tok));
 		}
-		assert(Level == LEVEL_GLOBAL);
+		assert(p->level == LEVEL_GLOBAL);
 	}
 	TRACEOUT("translation_unit");
 }
 
-token_t
-name_type(const char *name)
+/*
+ * Note that a chunk looked atom up and found sym, if the chunk had not
+ * declared it.
+ */
+static void
+note_seen(parser_t *p, const atom_t *atom, const symbol_t *sym)
+{
+	unsigned int n;
+
+	if (atom->at_id >= p->seenidsize) {
+		n = p->seenidsize == 0 ? 1024 : p->seenidsize;
+		while (n <= atom->at_id)
+			n *= 2;
+		p->seenid = safe_realloc(p->seenid, n);
+		memset(p->seenid + p->seenidsize, 0, n - p->seenidsize);
+		p->seenidsize = n;
+	}
+	if (p->seenid[atom->at_id])
+		return;
+	p->seenid[atom->at_id] = 1;
+	if (p->nseen == p->seensize) {
+		p->seensize = p->seensize == 0 ? 256 : p->seensize * 2;
+		p->seen = safe_realloc(p->seen, p->seensize * sizeof *p->seen);
+	}
+	p->seen[p->nseen].atom = atom;
+	p->seen[p->nseen].typedef_name = sym != 0 &&
+				sym->object_type == OBJ_TYPEDEF_NAME;
+	p->nseen++;
+}
+
+/*
+ * Stop before the declaration at p->stop, leaving its first token as
+ * the lookahead, and note whether the parse from there could as well
+ * start afresh.  It could not if more was read ahead, or if that token
+ * is a name that was looked up in a scope that has since been left,
+ * as one after a function body is, and meant something else there.
+ */
+static void
+note_stop(parser_t *p)
+{
+	const atom_t *atom;
+	symbol_t *sym;
+
+	p->stopped = 1;
+	p->clean = p->lex.le_nahead == 0;
+	if (p->clean && p->tok == IDENTIFIER) {
+		atom = p->lexeme->identifier->id_atom;
+		sym = symtab_lookup(&p->identifiers, atom);
+		if (p->noting && sym == 0) {
+			sym = seed_typedef(p, atom);
+			note_seen(p, atom, sym);
+		}
+		p->clean = check_not_typedef(p) ==
+			(sym == 0 || sym->object_type != OBJ_TYPEDEF_NAME);
+	}
+}
+
+static token_t
+name_type(void *arg, const atom_t *atom)
 {
-	Cursym = find_symbol(Cursymtab, name, 1);
+	parser_t *p = (parser_t *)arg;
+
+	p->cursym = symtab_lookup(&p->identifiers, atom);
+	/* A body parsed late cannot see globals declared after it */
+	if (p->cursym != 0 && p->cursym->serial >= p->horizon &&
+			p->cursym->scope->level == LEVEL_GLOBAL)
+		p->cursym = 0;
+	if (p->noting && p->cursym == 0) {
+		p->cursym = seed_typedef(p, atom);
+		note_seen(p, atom, p->cursym);
+	}
 	return IDENTIFIER;
 }
 
 static const char *
 mygetline(char *arg)
 {
-	static char line[512];
-	line[0] = 0;
+	parser_t *p = (parser_t *)arg;
 
-	return fgets(line, sizeof line, (FILE *)arg);
+	if (getline(&p->line, &p->linesize, p->fp) == -1)
+		return NULL;
+	return p->line;
 }
 
-void parser_main(int argc, char *argv[])
+/*
+ * Forget the top level declarations from the i'th on.
+ */
+static void
+drop_decls(parser_t *p, int i)
+{
+	while (p->ndecls > i) {
+		decl_t *d = &p->decls[--p->ndecls];
+
+		if (d->error != 0) {
+			free(d->error);
+			--p->nbad;
+		}
+	}
+}
+
+/*
+ * Free the symbol tables, names and input of the last parse.  An input
+ * that may be edited stays in p->text.
+ */
+static void
+release_parse(parser_t *p)
+{
+	symtab_free(&p->identifiers);
+	symtab_free(&p->labels);
+	symtab_free(&p->types);
+	atom_table_free(&p->atoms);
+	lex_free(&p->lex);
+	lex_unmap_file(&p->lex);
+	p->nbodies = 0;
+	drop_decls(p, 0);
+	p->kept = 0;
+}
+
+/*
+ * Start afresh at the top level, or at that of a function body.
+ */
+static void
+reset_parse(parser_t *p, int level)
+{
+	p->level = level;
+	p->saw_ident = 0;
+	p->is_func = 0;
+	p->parsing_struct = 0;
+	p->parsing_oldstyle_parmdecl = 0;
+	p->stack_ptr = -1;
+	p->cursym = 0;
+	p->trace_level = 0;
+	p->declarator_name = 0;
+	p->horizon = NO_HORIZON;
+	p->stop = NO_STOP;
+	p->stopped = 0;
+}
+
+/*
+ * Make sure p->text has room for len characters and a NUL.
+ */
+static void
+reserve_text(parser_t *p, size_t len)
+{
+	if (len < p->textsize)
+		return;
+	p->textsize = p->textsize ? p->textsize * 2 : 4096;
+	if (p->textsize <= len)
+		p->textsize = len + 1;
+	p->text = safe_realloc(p->text, p->textsize);
+}
+
+/*
+ * Copy the input, which is in memory, into p->text, where
+ * parser_edit() can change it.
+ */
+static void
+own_text(parser_t *p)
+{
+	lex_env_t *le = &p->lex;
+	const char *buf = le->le_buf;
+	size_t len = le->le_buflen;
+
+	if (buf == p->text)
+		return;
+	free(p->name);
+	p->name = string_copy(le->le_filename, strlen(le->le_filename));
+	reserve_text(p, len);
+	memcpy(p->text, buf, len);
+	p->text[len] = '\0';
+	lex_unmap_file(le);
+	le->le_buf = p->text;
+	le->le_buflen = p->textlen = len;
+	le->le_filename = p->name;
+}
+
+/*
+ * The outcome of parsing input that may be edited: 0 if every top
+ * level declaration parsed, else -1 with the first failure in errmsg.
+ */
+static int
+decls_status(parser_t *p)
 {
-	lex_env_t mylex = {0};
-        FILE *fp;
+	int i;
+
+	if (p->nbad == 0)
+		return p->complete ? 0 : -1;
+	for (i = 0; p->decls[i].error == 0; ++i)
+		;
+	snprintf(p->errmsg, sizeof p->errmsg, "%s", p->decls[i].error);
+	return -1;
+}
+
+/*
+ * Note why top level declaration d failed to parse, errmsg.
+ */
+static void
+decl_failed(parser_t *p, decl_t *d)
+{
+	d->error = string_copy(p->errmsg, strlen(p->errmsg));
+	++p->nbad;
+}
+
+/*
+ * After parsing input that may be edited has stopped, at the end or
+ * at an error, get back to the top level.  An error leaves the rest of
+ * the input unparsed and the last declaration incomplete.
+ */
+static int
+end_decls(parser_t *p, int failed)
+{
+	symtab_t *st = &p->identifiers;
+
+	while (st->st_current != list_first(&st->st_scopes))
+		symtab_exit_scope(st);
+	reset_parse(p, LEVEL_GLOBAL);
+	p->complete = !failed;
+	if (failed && p->ndecls > 0)
+		decl_failed(p, &p->decls[p->ndecls - 1]);
+	return decls_status(p);
+}
+
+parser_t *
+parser_create(void)
+{
+	parser_t *p;
 	const char *cp = getenv("DEBUG");
 
+	p = NEW(parser_t);
 	if (cp != 0) {
-		DebugLevel = atoi(cp);
+		p->debug_level = atoi(cp);
+	}
+	if ((cp = getenv("PRELEX")) != 0) {
+		p->prelex = atoi(cp);
 	}
+	if ((cp = getenv("DESCENT")) != 0) {
+		p->descent = atoi(cp);
+	}
+	if ((cp = getenv("LAZY")) != 0) {
+		p->lazy = atoi(cp);
+	}
+	if ((cp = getenv("THREADS")) != 0) {
+		p->nthreads = atoi(cp);
+	}
+	if ((cp = getenv("AST")) != 0) {
+		p->tree = atoi(cp);
+	}
+	if ((cp = getenv("AST_SAVE")) != 0 && *cp != '\0') {
+		parser_set_ast_save(p, cp);
+	}
+	if ((cp = getenv("PREFIX")) != 0 && parser_load_prefix(p, cp) != 0)
+		fprintf(stderr, "PREFIX ignored: %s\n", p->errmsg);
+	return p;
+}
+
+/*
+ * Close the nodes left open at the end of the input, or by an error,
+ * so that the tree holds whatever was parsed.
+ */
+static void
+close_tree(parser_t *p)
+{
+	ast_close_all(&p->ast, p->lex.le_buf != 0 ? p->lex.le_buflen :
+								p->ast_end);
+}
+
+/*
+ * Let go of the last input, and of whatever was kept from parsing it.
+ */
+static void
+drop_input(parser_t *p)
+{
+	if (p->kept)
+		release_parse(p);
+	else if (p->indexed)
+		lex_unmap_file(&p->lex);
+	p->indexed = 0;
+}
 
-        if (argc != 2)
-                exit(1);
-        fp = fopen(argv[1], "r");
-        if (fp == 0)
-                exit(1);
+void
+parser_destroy(parser_t *p)
+{
+	drop_input(p);
+	free(p->bodies);
+	free(p->decls);
+	free(p->text);
+	free(p->name);
+	free_prefix(p->prefix);
+	free(p->ast_suffix);
+	free(p->seen);
+	free(p->seenid);
+	free(p->made);
+	if (p->errors != 0)
+		fclose(p->errors);
+	free(p->errtext);
+	free(p->line);
+	tokbuf_free(&p->tokens);
+	structidx_free(&p->index);
+	ast_free(&p->ast);
+	free(p);
+}
 
- 	Lex_env = &mylex;
-	Lex_env->le_getline = mygetline;
-	Lex_env->le_getline_arg = (char *)fp;
-	Lexeme = &Lex_env->le_lexeme;
-        init_tokmap();
-	init_symbol_table();
+void
+parser_set_debug(parser_t *p, int level)
+{
+	p->debug_level = level;
+}
 
-#if 0
-        putenv("LEX_DEBUG=1");
-#endif
-	translation_unit();
+/*
+ * With on set, each input that is in memory is lexed completely before
+ * parsing starts, and the parser then works from the token arrays.
+ */
+void
+parser_set_prelex(parser_t *p, int on)
+{
+	p->prelex = on;
+}
+
+/*
+ * With on set, expressions are parsed by recursive descent, one
+ * function per level of precedence, rather than by precedence
+ * climbing.  The result is the same; only the speed differs.
+ */
+void
+parser_set_descent(parser_t *p, int on)
+{
+	p->descent = on;
+}
+
+/*
+ * With on set, function bodies in input that is in memory are not
+ * parsed but skipped by matching braces; only the declarations around
+ * them are.  The bodies are listed by parser_body(), and after a
+ * successful parse each can be parsed with parser_parse_body() until
+ * the next parse starts.
+ */
+void
+parser_set_lazy(parser_t *p, int on)
+{
+	p->lazy = on;
+}
+
+/*
+ * Parse each input that is in memory, and is big enough, on up to n
+ * threads, splitting it between top level declarations.  The result
+ * is the same as with one thread.  Lazy, incremental and traced
+ * parses always use one, and a prelexed one uses them to lex.
+ */
+void
+parser_set_threads(parser_t *p, int n)
+{
+	p->nthreads = n;
+}
+
+/*
+ * With on set, each parse builds a syntax tree of what it parses, as
+ * described in ast.h, which parser_ast() returns.  A tree is built on
+ * one thread, and holds a BODY node for each body a lazy parse skips.
+ * What a prefix declared is not in it.  Input of more than 4 GiB gets
+ * no tree, as offsets in it would not fit in a node.
+ */
+void
+parser_set_ast(parser_t *p, int on)
+{
+	p->tree = on;
+}
+
+/*
+ * With suffix not NULL, each file that parser_parse_file() parses
+ * without error has its tree written, as by ast_save(), to a file of
+ * its name with suffix added, which ast_map() can then use without
+ * parsing it again.  The trees are built whether or not
+ * parser_set_ast() is on.
+ */
+void
+parser_set_ast_save(parser_t *p, const char *suffix)
+{
+	free(p->ast_suffix);
+	p->ast_suffix = suffix != 0 ? string_copy(suffix, strlen(suffix)) : 0;
+}
+
+/*
+ * Write the tree of filename beside it, for parser_set_ast_save().
+ */
+static int
+save_tree(parser_t *p, const char *filename)
+{
+	char *name;
+	size_t len;
+	int status;
+
+	len = strlen(filename);
+	name = safe_calloc(1, len + strlen(p->ast_suffix) + 1);
+	memcpy(name, filename, len);
+	strcpy(name + len, p->ast_suffix);
+	status = ast_save(&p->ast, filename, name);
+	if (status != 0)
+		snprintf(p->errmsg, sizeof p->errmsg, "cannot write %s: %s",
+							name, strerror(errno));
+	free(name);
+	return status;
+}
+
+/*
+ * The tree of the last parse, as far as it got, or NULL if none was
+ * built.  It is good until the next parse or edit.
+ */
+const ast_t *
+parser_ast(parser_t *p)
+{
+	return p->building ? &p->ast : NULL;
+}
+
+/*
+ * Move the tree of the last parse to t, which the caller then frees
+ * with ast_free().  Returns 0, or -1 if there is none.  Edits made
+ * after this keep no tree, until the next parse.
+ */
+int
+parser_take_ast(parser_t *p, ast_t *t)
+{
+	if (!p->building)
+		return -1;
+	*t = p->ast;
+	ast_done(t);
+	ast_init(&p->ast);
+	p->building = 0;
+	return 0;
+}
+
+/*
+ * Have the parses that follow call the functions in ev, with arg, as
+ * they go: pe_begin and pe_end as each rule of the grammar starts and
+ * ends, with its name, and pe_token for each token matched.  Any of
+ * them may be NULL, and so may ev, to have no events.  Expressions
+ * are parsed by recursive descent while there are events, so that
+ * each level of precedence is reported, and a parse runs on one
+ * thread.  A rule that a failure cuts short gets no pe_end, and the
+ * bodies a lazy parse skips have no events.  ev must last as long as
+ * it is in use.
+ */
+void
+parser_set_events(parser_t *p, const parser_events_t *ev, void *arg)
+{
+	p->events = ev;
+	p->events_arg = arg;
+}
+
+/*
+ * Have the parses that follow, including those of parser_parse_body()
+ * and parser_edit(), write their messages about the input to fp
+ * instead of stderr, or to stderr again if fp is NULL.
+ */
+void
+parser_set_errors(parser_t *p, FILE *fp)
+{
+	p->errout = fp;
+	p->lex.le_errors = fp != NULL ? fp : stderr;
+}
+
+int
+parser_body_count(parser_t *p)
+{
+	return p->nbodies;
+}
+
+const parser_body_t *
+parser_body(parser_t *p, int i)
+{
+	if (i < 0 || i >= p->nbodies)
+		return 0;
+	return &p->bodies[i].info;
+}
+
+/*
+ * Parse function body b again, from the input in memory.  It is parsed
+ * in the scope of its parameters, seeing the globals declared before
+ * it.  What it declares is forgotten afterwards, and the scopes it
+ * opens are freed.
+ */
+static int
+parse_body_at(parser_t *p, body_t *b)
+{
+	symtab_t *st = &p->identifiers;
+	unsigned int nscopes = st->st_nscopes;
+	int building = p->building;
+	int status;
+
+	/* The tree is of the parse that skipped the body */
+	p->building = 0;
+	reset_parse(p, LEVEL_FUNCTION);
+	p->horizon = b->horizon;
+	symtab_forget(b->scope, b->mark);
+	symtab_reenter_scope(st, b->scope);
+	p->from_tokens = 0;
+	lex_seek(&p->lex, p->lex.le_buf + b->info.pb_start, b->lnum);
+	p->lex.le_filename = b->filename;
+	p->tok = next_token(p);
+
+	if (setjmp(p->failed) == 0) {
+		compound_statement(p);
+		status = 0;
+	}
+	else
+		status = -1;
+
+	while (st->st_current != b->scope)
+		symtab_exit_scope(st);
+	symtab_free_exited(st, nscopes);
+	symtab_exit_scope(st);
+	symtab_forget(b->scope, b->mark);
+	reset_parse(p, LEVEL_GLOBAL);
+	p->building = building;
+	return status;
+}
+
+/*
+ * Parse body i of the last lazy parse, as it would have been parsed
+ * where it is.  Returns 0, or -1 with the reason in parser_error().
+ */
+int
+parser_parse_body(parser_t *p, int i)
+{
+	if (!p->kept || i < 0 || i >= p->nbodies) {
+		snprintf(p->errmsg, sizeof p->errmsg, "no function body %d", i);
+		return -1;
+	}
+	p->errmsg[0] = '\0';
+	return parse_body_at(p, &p->bodies[i]);
+}
+
+/*
+ * With on set, parses of input in memory keep a copy of it, and what
+ * is needed to parse it again after parser_edit() has changed it.
+ */
+void
+parser_set_incremental(parser_t *p, int on)
+{
+	p->incremental = on;
+}
+
+/*
+ * Parse the input again from top level declaration i, which has been
+ * edited, to the end.  Everything before i stands as it was.
+ */
+static int
+reparse_from(parser_t *p, int i)
+{
+	decl_t d;
+	int status;
+
+	if (i == 0) {
+		release_parse(p);
+		lex_init(&p->lex);
+		p->lex.le_buf = p->text;
+		p->lex.le_buflen = p->textlen;
+		p->lex.le_filename = p->name;
+		return parse(p);
+	}
+	d = p->decls[i];
+	symtab_truncate(&p->identifiers, d.nsymbols);
+	symtab_free_exited(&p->identifiers, d.nscopes);
+	p->nbodies = d.nbodies;
+	drop_decls(p, i);
+
+	reset_parse(p, LEVEL_GLOBAL);
+	p->from_tokens = 0;
+	lex_seek(&p->lex, p->text + d.start, d.lnum);
+	p->lex.le_filename = d.filename;
+	if (p->building)
+		ast_truncate(&p->ast, d.nnodes);
+	if (setjmp(p->failed) == 0) {
+		translation_unit(p);
+		status = 0;
+	}
+	else
+		status = -1;
+	if (p->building)
+		close_tree(p);
+	return end_decls(p, status != 0);
+}
 
-        return;
+/*
+ * If an edit of len characters in place of removed at offset lies
+ * within the body of function definition i, and leaves its braces
+ * matched, parse that body again and move the later declarations
+ * along.  The edit has been made; it added lines lines.  Returns FALSE
+ * if the edit needs more than that, as it always does when a tree is
+ * being kept, since the nodes after the body would all move.
+ */
+static bool
+edit_body(parser_t *p, int i, size_t offset, size_t removed, size_t len,
+		int lines)
+{
+	size_t delta = len - removed;	/* modulo SIZE_MAX + 1 */
+	decl_t *d = &p->decls[i];
+	body_t *b;
+	int j;
+
+	if (p->building)
+		return FALSE;
+	if (i == p->ndecls - 1 ? !p->complete || d->nbodies == p->nbodies :
+				d->nbodies == d[1].nbodies)
+		return FALSE;
+	b = &p->bodies[d->nbodies];
+	if (offset <= b->info.pb_start || offset + removed >= b->info.pb_end)
+		return FALSE;
+
+	/* Still one block, ending where the old one did? */
+	p->from_tokens = 0;
+	lex_seek(&p->lex, p->text + b->info.pb_start, b->lnum);
+	if (next_token(p) != LBRACE || lex_skip_block(&p->lex) != 0 ||
+		(size_t)(p->lex.le_lptr - p->text) != b->info.pb_end + delta)
+		return FALSE;
+
+	b->info.pb_end += delta;
+	for (j = d->nbodies + 1; j < p->nbodies; ++j) {
+		p->bodies[j].info.pb_start += delta;
+		p->bodies[j].info.pb_end += delta;
+		p->bodies[j].lnum += lines;
+	}
+	for (j = i + 1; j < p->ndecls; ++j) {
+		p->decls[j].start += delta;
+		p->decls[j].lnum += lines;
+	}
+
+	if (d->error != 0) {
+		free(d->error);
+		d->error = 0;
+		--p->nbad;
+	}
+	if (!p->lazy && parse_body_at(p, b) != 0)
+		decl_failed(p, d);
+	return TRUE;
 }
 
+/*
+ * Replace the removed characters at offset in the input of the last
+ * parse, which must have been made with parser_set_incremental() on,
+ * with the len characters at text, and bring the parse up to date.
+ * Only the top level declarations from the one the edit begins in are
+ * parsed again, and for an edit inside a function body that keeps
+ * its braces matched, only that body.  Returns 0 if all the input
+ * parses, or -1 with the first failure in parser_error().
+ */
+int
+parser_edit(parser_t *p, size_t offset, size_t removed, const char *text,
+		size_t len)
+{
+	size_t newlen;
+	int lines, directive, lo, hi, mid;
+	const char *s;
+
+	if (!p->kept || !p->editable) {
+		snprintf(p->errmsg, sizeof p->errmsg, "no input to edit");
+		return -1;
+	}
+	if (offset > p->textlen || removed > p->textlen - offset) {
+		snprintf(p->errmsg, sizeof p->errmsg,
+			"edit at %lu is past the end", (unsigned long)offset);
+		return -1;
+	}
+
+	lines = 0;
+	for (s = p->text + offset; s < p->text + offset + removed; ++s)
+		lines -= *s == '\n';
+	for (s = text; s < text + len; ++s)
+		lines += *s == '\n';
+	directive = memchr(p->text + offset, '#', removed) != 0 ||
+			memchr(text, '#', len) != 0;
+
+	newlen = p->textlen - removed + len;
+	reserve_text(p, newlen);
+	memmove(p->text + offset + len, p->text + offset + removed,
+				p->textlen - offset - removed + 1);
+	memcpy(p->text + offset, text, len);
+	p->textlen = p->lex.le_buflen = newlen;
+	p->lex.le_buf = p->text;
+	p->errmsg[0] = '\0';
+
+	/* The last declaration that begins at or before the edit */
+	lo = 0;
+	hi = p->ndecls;
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (p->decls[mid].start <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	if (lo < p->ndecls && !directive &&
+			edit_body(p, lo, offset, removed, len, lines))
+		return decls_status(p);
+	return reparse_from(p, lo);
+}
+
+const char *
+parser_error(parser_t *p)
+{
+	return p->errmsg;
+}
+
+/*
+ * If the input begins with the text of the prefix loaded by
+ * parser_load_prefix(), declare what that text did and carry on
+ * lexing after it.
+ */
+static void
+use_prefix(parser_t *p)
+{
+	prefix_t *px = p->prefix;
+	lex_env_t *le = &p->lex;
+	const prefix_symbol_t *ps;
+	const atom_t *atom;
+	const char *name, *end;
+	unsigned long long hash;
+	unsigned int i;
+	size_t n;
+
+	if (px == 0 || le->le_buf == 0)
+		return;
+	n = px->px_header->ph_length;
+	end = lex_prefix_hash(le->le_buf, le->le_buf + le->le_buflen, &n,
+								&hash);
+	if (n != px->px_header->ph_length || hash != px->px_header->ph_hash)
+		return;
+	name = px->px_names;
+	for (i = 0; i < px->px_header->ph_nsymbols; ++i) {
+		ps = &px->px_symbols[i];
+		atom = atom_intern(&p->atoms, name, ps->ps_len, ps->ps_hash);
+		symtab_install(&p->identifiers, atom, ps->ps_storage_class,
+						ps->ps_object_type);
+		name += ps->ps_len + 1;
+	}
+	lex_skip(le, end - le->le_buf);
+}
+
+/*
+ * Parsing one input on several threads.  The input is split where a
+ * quick scan finds the end of a top level declaration, and each chunk
+ * after the first is parsed by a session of its own that knows only
+ * some of the typedef names declared before it.  The chunk's parse
+ * stands if it began where the parse of what precedes it stopped, and
+ * took every name it looked up before declaring it for what the
+ * declarations before it make that name.  Otherwise the main session
+ * parses the chunk again.
+ *
+ * The first round of chunks is given the typedef names of a prefix,
+ * and those that the scan that split the input guessed were declared
+ * before the chunk.  Those that the chunks in the first round actually
+ * declared are then passed on to the chunks after them, and any chunk
+ * that this shows was parsed wrongly is parsed again, in parallel too,
+ * before the chunks are checked in order.
+ */
+enum {
+	SPLIT_CHUNK_MIN = 64 * 1024,	/* fewer bytes than this are not split */
+	SPLIT_CHUNKS = 4		/* chunks per thread */
+};
+
+/* A name that a typedef seems to declare */
+typedef struct {
+	size_t offset;
+	int len;
+} guess_t;
+
+typedef struct {
+	parser_t *parser;		/* its own session */
+	size_t start;			/* offset of its first token */
+	const char *filename;		/* and where that is, in the */
+	int lnum;			/* terms of the line markers */
+	size_t end;			/* where the next chunk starts */
+	size_t last;			/* where its parse stopped */
+	int clean;			/* and whether it stopped cleanly */
+	int status;
+	int nseed;			/* typedef names it is given */
+	int redo;			/* parse it (again) */
+} chunk_t;
+
+typedef struct split_t {
+	parser_t *parser;		/* the main session */
+	const char *text;		/* its input, for the chunks */
+	size_t len;
+	chunk_t *chunks;
+	int nchunks;
+	const atom_t **typedefs;	/* in the main session's atoms */
+	int ntypedefs;
+	int typedefsize;
+	guess_t *guesses;		/* from lex_split(), in order */
+	int nguesses;
+	int guesssize;
+	int nadded;			/* how many are in typedefs */
+	int *seedslots;			/* typedefs hashed by name */
+	unsigned int seedsize;
+	int next;			/* the next chunk to look at */
+	pthread_mutex_t lock;
+} split_t;
+
+/* What a chunk finds when it looks up a typedef name it was given */
+static symbol_t Seed_typedef = { .object_type = OBJ_TYPEDEF_NAME };
+
+/*
+ * Hash the typedef names to be given to chunks, so that their sessions
+ * can look them up while they parse at the same time.  Each slot holds
+ * the index in sp->typedefs of the first one with a name, or -1.
+ */
+static void
+index_seeds(split_t *sp)
+{
+	const atom_t *atom;
+	unsigned int i, mask;
+	int j;
+
+	for (sp->seedsize = 1024; sp->seedsize < 2 * (unsigned int)sp->ntypedefs;
+			sp->seedsize *= 2)
+		;
+	free(sp->seedslots);
+	sp->seedslots = NEW_ARRAY(int, sp->seedsize);
+	for (i = 0; i < sp->seedsize; ++i)
+		sp->seedslots[i] = -1;
+	mask = sp->seedsize - 1;
+	for (j = 0; j < sp->ntypedefs; ++j) {
+		atom = sp->typedefs[j];
+		for (i = atom->at_hash & mask; sp->seedslots[i] != -1 &&
+				sp->typedefs[sp->seedslots[i]] != atom;
+				i = (i + 1) & mask)
+			;
+		if (sp->seedslots[i] == -1)
+			sp->seedslots[i] = j;
+	}
+}
+
+/*
+ * Look up a name that chunk parser p has not declared among the typedef
+ * names it was given.
+ */
+static symbol_t *
+seed_typedef(parser_t *p, const atom_t *atom)
+{
+	split_t *sp = p->split;
+	const atom_t *seed;
+	unsigned int i, mask;
+	int j;
+
+	mask = sp->seedsize - 1;
+	for (i = atom->at_hash & mask; (j = sp->seedslots[i]) != -1;
+			i = (i + 1) & mask) {
+		seed = sp->typedefs[j];
+		if (seed->at_len == atom->at_len &&
+				memcmp(seed->at_name, atom->at_name,
+							atom->at_len) == 0)
+			return j < p->nseed ? &Seed_typedef : 0;
+	}
+	return 0;
+}
+
+/*
+ * Set up p to parse from a clean symbol table.
+ */
+static void
+start_parse(parser_t *p)
+{
+	reset_parse(p, LEVEL_GLOBAL);
+	p->errmsg[0] = '\0';
+	p->nbodies = 0;
+	atom_table_init(&p->atoms);
+	p->lex.le_atoms = &p->atoms;
+	p->lex.le_name_type = name_type;
+	p->lex.le_name_type_arg = p;
+	p->lexeme = &p->lex.le_lexeme;
+	init_symbol_table(p);
+}
+
+/*
+ * Parse top level declarations up to the end of the input, or up to
+ * the first that starts at or after p->stop, and set *last to where
+ * the parse stopped.  Returns 0 or -1.
+ */
+static int
+parse_upto(parser_t *p, size_t *last)
+{
+	if (setjmp(p->failed) != 0)
+		return -1;
+	translation_unit(p);
+	if (p->tok == EOI) {
+		*last = p->lex.le_buflen;
+		p->clean = 1;
+	}
+	else
+		*last = token_offset(p);
+	return 0;
+}
+
+/*  The main session's atom for a chunk's atom.
+ */
+static const atom_t *
+main_atom(parser_t *p, const atom_t *atom)
+{
+	return atom_intern(&p->atoms, atom->at_name, atom->at_len,
+				atom->at_hash);
+}
+
+/*  The main session's atom for the name of the i'th declaration that
+ *  chunk parser w made at file scope.
+ */
+static const atom_t *
+made_atom(parser_t *p, parser_t *w, int i)
+{
+	made_t *m = &w->made[i];
+
+	if (m->atom == 0)
+		m->atom = main_atom(p, m->sym->atom);
+	return m->atom;
+}
+
+/*  Give atom as a typedef name to the chunks yet to be seeded.
+ */
+static void
+add_typedef(split_t *sp, const atom_t *atom, symtab_t *known)
+{
+	if (sp->ntypedefs == sp->typedefsize) {
+		sp->typedefsize = sp->typedefsize == 0 ?
+					256 : sp->typedefsize * 2;
+		sp->typedefs = safe_realloc(sp->typedefs,
+			sp->typedefsize * sizeof *sp->typedefs);
+	}
+	sp->typedefs[sp->ntypedefs++] = atom;
+	symtab_install(known, atom, TYPEDEF, OBJ_TYPEDEF_NAME);
+}
+
+/*
+ * Add the typedef names declared at file scope in the main session to
+ * those given to the chunks, and to known.
+ */
+static void
+add_typedefs(split_t *sp, symtab_t *known)
+{
+	symbol_t *sym;
+	scope_t *global;
+
+	global = list_first(&sp->parser->identifiers.st_scopes);
+	for (sym = list_first(&global->symbols); sym != 0;
+			sym = list_next(&global->symbols, sym)) {
+		if (sym->object_type == OBJ_TYPEDEF_NAME)
+			add_typedef(sp, sym->atom, known);
+	}
+}
+
+/*
+ * The same for those chunk parser w declared.
+ */
+static void
+add_made_typedefs(split_t *sp, parser_t *w, symtab_t *known)
+{
+	int i;
+
+	for (i = 0; i < w->nmade; ++i) {
+		if (w->made[i].sym->object_type == OBJ_TYPEDEF_NAME)
+			add_typedef(sp, made_atom(sp->parser, w, i), known);
+	}
+}
+
+/*
+ * Add the names that lex_split() guessed to be declared by typedefs
+ * before offset end, from the next one not yet added.
+ */
+static void
+add_guesses(split_t *sp, size_t end, symtab_t *known)
+{
+	const char *buf = sp->parser->lex.le_buf;
+	guess_t *g;
+
+	for (; sp->nadded < sp->nguesses; ++sp->nadded) {
+		g = &sp->guesses[sp->nadded];
+		if (g->offset >= end)
+			break;
+		add_typedef(sp, atom_intern(&sp->parser->atoms, buf + g->offset,
+			g->len, atom_hash(buf + g->offset, g->len)), known);
+	}
+}
+
+/*  lex_split()'s callback */
+static void
+guess_typedef(void *arg, const char *s, int len)
+{
+	split_t *sp = arg;
+
+	if (sp->nguesses == sp->guesssize) {
+		sp->guesssize = sp->guesssize == 0 ? 256 : sp->guesssize * 2;
+		sp->guesses = safe_realloc(sp->guesses,
+				sp->guesssize * sizeof *sp->guesses);
+	}
+	sp->guesses[sp->nguesses].offset = s - sp->parser->lex.le_buf;
+	sp->guesses[sp->nguesses].len = len;
+	sp->nguesses++;
+}
+
+/*
+ * Parse chunk c in its own session, given the first c->nseed typedef
+ * names, noting what it looks up and declares.
+ */
+static void
+parse_chunk(split_t *sp, chunk_t *c)
+{
+	parser_t *w = c->parser;
+
+	if (w->kept)
+		release_parse(w);
+	lex_init(&w->lex);
+	w->lex.le_buf = sp->text;
+	w->lex.le_buflen = sp->len;
+	w->lex.le_filename = lex_filename(&w->lex, c->filename);
+	if (w->errors != 0) {
+		fclose(w->errors);
+		free(w->errtext);
+	}
+	w->errtext = 0;
+	if ((w->errors = open_memstream(&w->errtext, &w->errsize)) != 0)
+		w->lex.le_errors = w->errors;
+	start_parse(w);
+	w->split = sp;
+	w->nseed = c->nseed;
+	w->nseen = 0;
+	w->nmade = 0;
+	if (w->seenid != 0)
+		memset(w->seenid, 0, w->seenidsize);
+	w->noting = 1;
+	w->stop = c->end;
+	lex_seek(&w->lex, w->lex.le_buf + c->start, c->lnum);
+	c->status = parse_upto(w, &c->last);
+	c->clean = w->clean;
+	w->noting = 0;
+	w->kept = 1;
+}
+
+/*  A thread's loop: parse the chunks marked to be redone until there
+ *  are none left.
+ */
+static void *
+run_chunks(void *arg)
+{
+	split_t *sp = arg;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&sp->lock);
+		while ((i = sp->next++) < sp->nchunks && !sp->chunks[i].redo)
+			;
+		pthread_mutex_unlock(&sp->lock);
+		if (i >= sp->nchunks)
+			return NULL;
+		parse_chunk(sp, &sp->chunks[i]);
+	}
+}
+
+/*  Work out the file name and line number that each chunk after the
+ *  first starts at, from the last line marker before it, while only
+ *  this thread is using the main session's lexer.
+ */
+static void
+locate_chunks(split_t *sp)
+{
+	lex_env_t le;
+	chunk_t *c;
+	int i;
+
+	for (i = 1; i < sp->nchunks; ++i) {
+		c = &sp->chunks[i];
+		lex_init(&le);
+		le.le_buf = sp->text;
+		le.le_buflen = sp->len;
+		le.le_filename = sp->parser->lex.le_filename;
+		lex_skip(&le, c->start);
+		c->filename = lex_filename(&sp->parser->lex, le.le_filename);
+		c->lnum = le.le_lnum;
+		lex_free(&le);
+	}
+}
+
+/*  Start up to n threads on the chunks after the first, returning how
+ *  many started.
+ */
+static int
+start_round(split_t *sp, pthread_t *threads, int n)
+{
+	int i;
+
+	sp->next = 1;
+	for (i = 0; i < n; ++i) {
+		if (pthread_create(&threads[i], NULL, run_chunks, sp) != 0)
+			break;
+	}
+	return i;
+}
+
+static void
+finish_round(split_t *sp, pthread_t *threads, int n)
+{
+	int i;
+
+	run_chunks(sp);
+	for (i = 0; i < n; ++i)
+		pthread_join(threads[i], NULL);
+}
+
+/*
+ * Whether every name that chunk parser w looked up before declaring it
+ * is a typedef name in st just when the chunk took it for one.
+ */
+static int
+seen_fits(parser_t *p, symtab_t *st, parser_t *w)
+{
+	symbol_t *sym;
+	int i;
+
+	for (i = 0; i < w->nseen; ++i) {
+		sym = symtab_lookup(st, main_atom(p, w->seen[i].atom));
+		if ((sym != 0 && sym->object_type == OBJ_TYPEDEF_NAME) !=
+				w->seen[i].typedef_name)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Whether chunk c was parsed as it would have been in the main session
+ * as it is: as seen_fits() says, and no name that the chunk declared
+ * at file scope is declared there already as something else, which
+ * would have kept that meaning.
+ */
+static int
+chunk_fits(parser_t *p, chunk_t *c)
+{
+	parser_t *w = c->parser;
+	symbol_t *sym, *old;
+	int i;
+
+	if (!seen_fits(p, &p->identifiers, w))
+		return 0;
+	for (i = 0; i < w->nmade; ++i) {
+		sym = w->made[i].sym;
+		old = symtab_lookup(&p->identifiers, made_atom(p, w, i));
+		if (old != 0 && (old->object_type == OBJ_TYPEDEF_NAME) !=
+				(sym->object_type == OBJ_TYPEDEF_NAME))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Make the file scope declarations of chunk c in the main session, and
+ * pass on its messages, as parsing it there would have.
+ */
+static void
+take_chunk(parser_t *p, chunk_t *c)
+{
+	parser_t *w = c->parser;
+	symbol_t *sym;
+	size_t said;
+	int i;
+
+	if (w->errors != 0)
+		fflush(w->errors);
+	said = 0;
+	for (i = 0; i < w->nmade; ++i) {
+		sym = w->made[i].sym;
+		if (w->errors != 0) {
+			fwrite(w->errtext + said, 1, w->made[i].said - said,
+							p->lex.le_errors);
+			said = w->made[i].said;
+		}
+		install_symbol(p, made_atom(p, w, i),
+				sym->storage_class, sym->object_type);
+	}
+	if (w->errors != 0)
+		fwrite(w->errtext + said, 1, w->errsize - said,
+						p->lex.le_errors);
+}
+
+/*
+ * Parse the input in memory from where p->lex is, on p->nthreads
+ * threads if it is big enough.  Returns 0 or -1, as parse() does.
+ */
+static int
+parse_split(parser_t *p)
+{
+	split_t sp;
+	chunk_t *c;
+	symtab_t known;
+	pthread_t *threads;
+	size_t *at, start, len, prev;
+	int i, n, nstarted, status, here;
+
+	start = p->lex.le_lptr != 0 ? p->lex.le_lptr - p->lex.le_buf : 0;
+	len = p->lex.le_buflen - start;
+	n = p->nthreads * SPLIT_CHUNKS;
+	if (len / SPLIT_CHUNK_MIN < (size_t)n)
+		n = len / SPLIT_CHUNK_MIN;
+	if (n < 2)
+		return parse_upto(p, &prev);
+
+	memset(&sp, 0, sizeof sp);
+	sp.parser = p;
+	sp.text = p->lex.le_buf;
+	sp.len = p->lex.le_buflen;
+	at = NEW_ARRAY(size_t, n - 1);
+	for (i = 0; i < n - 1; ++i)
+		at[i] = start + len / n * (i + 1);
+	lex_split(&p->lex, start, at, n - 1, guess_typedef, &sp);
+
+	sp.chunks = NEW_ARRAY(chunk_t, n);
+	sp.chunks[0].start = start;
+	sp.nchunks = 1;
+	for (i = 0; i < n - 1; ++i) {
+		if (at[i] > sp.chunks[sp.nchunks - 1].start &&
+				at[i] < p->lex.le_buflen)
+			sp.chunks[sp.nchunks++].start = at[i];
+	}
+	free(at);
+	if (sp.nchunks < 2) {
+		free(sp.chunks);
+		free(sp.guesses);
+		return parse_upto(p, &prev);
+	}
+	for (i = 0; i < sp.nchunks; ++i) {
+		c = &sp.chunks[i];
+		c->end = i + 1 < sp.nchunks ? sp.chunks[i + 1].start : NO_STOP;
+		if (i > 0) {
+			c->parser = NEW(parser_t);
+			c->parser->descent = p->descent;
+			c->redo = 1;
+		}
+	}
+	locate_chunks(&sp);
+	pthread_mutex_init(&sp.lock, NULL);
+	n = p->nthreads - 1;
+	if (n > sp.nchunks - 1)
+		n = sp.nchunks - 1;
+	threads = NEW_ARRAY(pthread_t, n);
+
+	/* The first round, with the typedef names of the prefix and those
+	 * guessed before each chunk.
+	 */
+	symtab_init(&known);
+	add_typedefs(&sp, &known);
+	for (i = 1; i < sp.nchunks; ++i) {
+		add_guesses(&sp, sp.chunks[i].start, &known);
+		sp.chunks[i].nseed = sp.ntypedefs;
+	}
+	symtab_free(&known);
+	index_seeds(&sp);
+	nstarted = start_round(&sp, threads, n);
+	p->stop = sp.chunks[0].end;
+	status = parse_upto(p, &prev);
+	finish_round(&sp, threads, nstarted);
+
+	/* The second, with those the first round declared before each
+	 * chunk, or guessed where it failed.
+	 */
+	if (status == 0) {
+		symtab_init(&known);
+		sp.ntypedefs = 0;
+		sp.nadded = 0;
+		add_typedefs(&sp, &known);
+		for (i = 1; i < sp.nchunks; ++i) {
+			c = &sp.chunks[i];
+			c->redo = c->status != 0 ||
+					!seen_fits(p, &known, c->parser);
+			c->nseed = sp.ntypedefs;
+			while (sp.nadded < sp.nguesses &&
+				    sp.guesses[sp.nadded].offset < c->start)
+				sp.nadded++;
+			if (c->status == 0)
+				add_made_typedefs(&sp, c->parser, &known);
+			else
+				add_guesses(&sp, c->end, &known);
+		}
+		symtab_free(&known);
+		index_seeds(&sp);
+		nstarted = start_round(&sp, threads, n);
+		finish_round(&sp, threads, nstarted);
+	}
+
+	/* Take each chunk in turn, or parse it here, going on from where
+	 * this session stopped if it was the last to parse.
+	 */
+	here = 1;
+	for (i = 1; status == 0 && i < sp.nchunks; ++i) {
+		c = &sp.chunks[i];
+		if (c->status == 0 && c->start == prev && p->clean &&
+				c->clean && chunk_fits(p, c)) {
+			take_chunk(p, c);
+			prev = c->last;
+			here = 0;
+		}
+		else {
+			if (!here) {
+				lex_skip(&p->lex, prev);
+				p->stopped = 0;
+				here = 1;
+			}
+			p->stop = c->end;
+			status = parse_upto(p, &prev);
+		}
+	}
+	p->stop = NO_STOP;
+
+	for (i = 1; i < sp.nchunks; ++i)
+		parser_destroy(sp.chunks[i].parser);
+	pthread_mutex_destroy(&sp.lock);
+	free(sp.chunks);
+	free(sp.typedefs);
+	free(sp.guesses);
+	free(sp.seedslots);
+	free(threads);
+	return status;
+}
+
+/*
+ * Parse whatever input p->lex has been given, starting from a clean
+ * symbol table.  Returns 0 on success, or -1 with the reason in
+ * p->errmsg.
+ */
+static int
+parse(parser_t *p)
+{
+	size_t last;
+	int status;
+
+	start_parse(p);
+	if (p->errout != 0)
+		p->lex.le_errors = p->errout;
+	p->editable = p->incremental && p->lex.le_buf != NULL;
+	if (p->editable)
+		own_text(p);
+	use_prefix(p);
+
+	/* A file read a line at a time is parsed as it is read. */
+	p->tokpos = 0;
+	p->from_tokens = p->prelex && !p->editable &&
+				tokbuf_fill_split(&p->tokens, &p->lex,
+						p->nthreads) >= 0;
+
+	/* The offsets in a tree are unsigned int */
+	p->building = (p->tree || p->ast_suffix != 0) &&
+			p->lex.le_buflen <= UINT_MAX;
+	if (p->building) {
+		ast_reset(&p->ast);
+		p->ast_end = 0;
+		ast_open(&p->ast, AST_TRANSLATION_UNIT, 0, 0);
+	}
+
+	/* Input in memory may be split between threads, unless its
+	 * parse has to be traced or kept, or a tree built, or its events
+	 * are wanted in order.
+	 */
+	if (p->nthreads > 1 && p->lex.le_buf != NULL && !p->editable &&
+			!p->lazy && !p->from_tokens && !p->building &&
+			p->events == 0 &&
+			p->debug_level == 0 && !p->lex.le_debug)
+		status = parse_split(p);
+	else
+		status = parse_upto(p, &last);
+	if (p->building)
+		close_tree(p);
+
+	/* After a lazy parse, keep what parser_parse_body() needs, and
+	 * all of it where the input may be edited.
+	 */
+	if (p->editable) {
+		status = end_decls(p, status != 0);
+		p->kept = 1;
+	}
+	else if (status == 0 && (p->nbodies > 0 || p->saving))
+		p->kept = 1;
+	else
+		release_parse(p);
+	return status;
+}
+
+int
+parser_parse_file(parser_t *p, const char *filename)
+{
+	int status;
+
+	drop_input(p);
+	lex_init(&p->lex);
+	p->fp = 0;
+	/* Walk the file in place if we can map it, otherwise fall
+	 * back to reading it a line at a time.
+	 */
+	if (lex_map_file(&p->lex, filename) != 0) {
+		if ((p->fp = fopen(filename, "r")) == 0) {
+			snprintf(p->errmsg, sizeof p->errmsg,
+				"cannot open %s", filename);
+			return -1;
+		}
+		p->lex.le_getline = mygetline;
+		p->lex.le_getline_arg = (char *)p;
+	}
+	p->lex.le_filename = filename;
+	status = parse(p);
+	if (p->fp != 0) {
+		fclose(p->fp);
+		p->fp = 0;
+	}
+	if (status == 0 && p->ast_suffix != 0)
+		status = save_tree(p, filename);
+	return status;
+}
+
+/*
+ * text[len] must be '\0'; the lexer relies on it to stop.  After a
+ * lazy parse text must stay put until the next parse, as the skipped
+ * bodies are parsed from it.
+ */
+int
+parser_parse_buffer(parser_t *p, const char *text, size_t len,
+			const char *name)
+{
+	assert(text[len] == '\0');
+	drop_input(p);
+	lex_init(&p->lex);
+	p->lex.le_buf = text;
+	p->lex.le_buflen = len;
+	p->lex.le_filename = name;
+	return parse(p);
+}
+
+/*
+ * Index the input p->lex has in memory into p->index, and describe
+ * the index in *pi.
+ */
+static int
+index_input(parser_t *p, parser_index_t *pi)
+{
+	int status;
+
+	p->indexed = 1;
+	if (p->errout != 0)
+		p->lex.le_errors = p->errout;
+	if (p->lex.le_buflen > UINT_MAX) {
+		snprintf(p->errmsg, sizeof p->errmsg, "%s is too big to index",
+							p->lex.le_filename);
+		return -1;
+	}
+	status = structidx_build(&p->index, p->lex.le_buf, p->lex.le_buflen,
+							p->lex.le_scan);
+	pi->pi_text = p->lex.le_buf;
+	pi->pi_offset = p->index.si_offset;
+	pi->pi_depth = p->index.si_depth;
+	pi->pi_count = p->index.si_count;
+	if (status != 0)
+		snprintf(p->errmsg, sizeof p->errmsg,
+			"%s: unbalanced braces or unterminated comment",
+							p->lex.le_filename);
+	return status;
+}
+
+/*
+ * Find the structural characters of a file without parsing it: each
+ * '{', '}', '(', ')', '[', ']', ';' and ',' outside comments, string
+ * and character constants and directive lines, in order, with the
+ * number of braces open around it.  The file must be one that can be
+ * mapped into memory.  *pi is good until the next parse or index in
+ * p.  Returns 0, or -1 with the reason in parser_error(), in which
+ * case *pi is still filled in if the file could be read.
+ */
+int
+parser_index_file(parser_t *p, const char *filename, parser_index_t *pi)
+{
+	memset(pi, 0, sizeof *pi);
+	drop_input(p);
+	lex_init(&p->lex);
+	p->lex.le_filename = filename;
+	p->errmsg[0] = '\0';
+	if (lex_map_file(&p->lex, filename) != 0) {
+		snprintf(p->errmsg, sizeof p->errmsg, "cannot map %s",
+								filename);
+		return -1;
+	}
+	return index_input(p, pi);
+}
+
+/*
+ * The same for text, which as for parser_parse_buffer() must have a
+ * NUL at text[len], and must stay put while *pi is used.
+ */
+int
+parser_index_buffer(parser_t *p, const char *text, size_t len,
+			const char *name, parser_index_t *pi)
+{
+	assert(text[len] == '\0');
+	memset(pi, 0, sizeof *pi);
+	drop_input(p);
+	lex_init(&p->lex);
+	p->lex.le_buf = text;
+	p->lex.le_buflen = len;
+	p->lex.le_filename = name;
+	p->errmsg[0] = '\0';
+	return index_input(p, pi);
+}
+
+static void
+free_prefix(prefix_t *px)
+{
+	if (px != 0) {
+		free(px->px_data);
+		free(px);
+	}
+}
+
+/*
+ * Read the prefix file written by parser_save_prefix() into memory.
+ * From then on, input that begins with the text it was made from is
+ * parsed from the end of that text, with the file scope declarations
+ * in it already made.  Other input is parsed as usual.  A filename of
+ * NULL drops the prefix.  Returns 0, or -1 with the reason in
+ * parser_error() and no prefix.
+ */
+int
+parser_load_prefix(parser_t *p, const char *filename)
+{
+	prefix_t *px;
+	const prefix_header_t *ph;
+	FILE *fp;
+	long size;
+	unsigned long long off;
+	unsigned int i;
+
+	free_prefix(p->prefix);
+	p->prefix = 0;
+	if (filename == 0)
+		return 0;
+	if ((fp = fopen(filename, "rb")) == 0) {
+		snprintf(p->errmsg, sizeof p->errmsg, "cannot open %s",
+								filename);
+		return -1;
+	}
+	px = NEW(prefix_t);
+	if (fseek(fp, 0L, SEEK_END) != 0 || (size = ftell(fp)) < 0 ||
+		fseek(fp, 0L, SEEK_SET) != 0 ||
+		fread(px->px_data = safe_calloc(1, size + 1), 1, size, fp) !=
+								(size_t)size) {
+		snprintf(p->errmsg, sizeof p->errmsg, "cannot read %s",
+								filename);
+		fclose(fp);
+		free_prefix(px);
+		return -1;
+	}
+	fclose(fp);
+
+	/* Check that it holds what the header says it does */
+	ph = px->px_header = (const prefix_header_t *)px->px_data;
+	if ((size_t)size < sizeof *ph || ph->ph_magic != PREFIX_MAGIC ||
+		(size - sizeof *ph) / sizeof (prefix_symbol_t) <
+							ph->ph_nsymbols) {
+		snprintf(p->errmsg, sizeof p->errmsg, "%s is not a prefix file",
+								filename);
+		free_prefix(px);
+		return -1;
+	}
+	px->px_symbols = (const prefix_symbol_t *)(ph + 1);
+	px->px_names = (const char *)(px->px_symbols + ph->ph_nsymbols);
+	off = (size_t)size - (px->px_names - px->px_data);
+	if (off == ph->ph_namesize)
+		for (off = i = 0; i < ph->ph_nsymbols; ++i) {
+			off += px->px_symbols[i].ps_len + 1;
+			if (off > ph->ph_namesize ||
+					px->px_names[off - 1] != '\0')
+				break;
+		}
+	if (off != ph->ph_namesize || i < ph->ph_nsymbols) {
+		snprintf(p->errmsg, sizeof p->errmsg, "%s is damaged", filename);
+		free_prefix(px);
+		return -1;
+	}
+	p->prefix = px;
+	return 0;
+}
+
+/*
+ * Write the symbols that the last parse declared at file scope, and a
+ * fingerprint of its input, to filename.
+ */
+static int
+write_prefix(parser_t *p, const char *filename)
+{
+	scope_t *global = list_first(&p->identifiers.st_scopes);
+	prefix_header_t ph;
+	prefix_symbol_t ps;
+	symbol_t *sym;
+	size_t n = (size_t)-1;
+	FILE *fp;
+
+	memset(&ph, 0, sizeof ph);
+	ph.ph_magic = PREFIX_MAGIC;
+	lex_prefix_hash(p->lex.le_buf, p->lex.le_buf + p->lex.le_buflen, &n,
+								&ph.ph_hash);
+	ph.ph_length = n;
+	for (sym = list_first(&global->symbols); sym != 0;
+		sym = list_next(&global->symbols, sym)) {
+		if (sym->atom->at_len > USHRT_MAX) {
+			snprintf(p->errmsg, sizeof p->errmsg,
+				"name too long for a prefix file");
+			return -1;
+		}
+		ph.ph_nsymbols++;
+		ph.ph_namesize += sym->atom->at_len + 1;
+	}
+
+	if ((fp = fopen(filename, "wb")) == 0) {
+		snprintf(p->errmsg, sizeof p->errmsg, "cannot create %s",
+								filename);
+		return -1;
+	}
+	fwrite(&ph, sizeof ph, 1, fp);
+	memset(&ps, 0, sizeof ps);
+	for (sym = list_first(&global->symbols); sym != 0;
+		sym = list_next(&global->symbols, sym)) {
+		ps.ps_hash = sym->atom->at_hash;
+		ps.ps_len = sym->atom->at_len;
+		ps.ps_storage_class = sym->storage_class;
+		ps.ps_object_type = sym->object_type;
+		fwrite(&ps, sizeof ps, 1, fp);
+	}
+	for (sym = list_first(&global->symbols); sym != 0;
+		sym = list_next(&global->symbols, sym))
+		fwrite(sym->atom->at_name, sym->atom->at_len + 1, 1, fp);
+	if (ferror(fp) | fclose(fp)) {
+		snprintf(p->errmsg, sizeof p->errmsg, "cannot write %s",
+								filename);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Parse header, typically the preprocessed system headers that many
+ * files start with, and save what it declared at file scope in the
+ * prefix file filename for parser_load_prefix().  header must be a
+ * file that can be mapped.
+ */
+int
+parser_save_prefix(parser_t *p, const char *header, const char *filename)
+{
+	int status;
+
+	p->saving = 1;
+	status = parser_parse_file(p, header);
+	p->saving = 0;
+	if (status == 0 && p->lex.le_buf == 0) {
+		snprintf(p->errmsg, sizeof p->errmsg,
+				"%s cannot be mapped", header);
+		status = -1;
+	}
+	if (status == 0)
+		status = write_prefix(p, filename);
+	if (p->kept)
+		release_parse(p);
+	return status;
+}
+
+/*  Read one file name per line from listfile ("-" is stdin) onto the
+ *  end of files, growing it as needed.
+ */
+static void
+read_file_list(const char *listfile, char ***files, int *nfiles, int *size)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t linesize = 0;
+	ssize_t len;
+
+	fp = strcmp(listfile, "-") == 0 ? stdin : fopen(listfile, "r");
+	if (fp == NULL) {
+		perror(listfile);
+		exit(1);
+	}
+	while ((len = getline(&line, &linesize, fp)) != -1) {
+		while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+			line[--len] = '\0';
+		if (len == 0)
+			continue;
+		if (*nfiles == *size) {
+			*size = *size ? *size * 2 : 64;
+			*files = realloc(*files, *size * sizeof **files);
+			if (*files == NULL) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		(*files)[(*nfiles)++] = string_copy(line, len);
+	}
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+}
+
+/*
+ *  c_parser file
+ *  c_parser [-j threads] [-l listfile] file...
+ *  c_parser -s prefixfile header
+ *  c_parser -i file
+ *  c_parser -a file
+ *  c_parser -r treefile
+ *
+ *  With a single file the parse is silent and the exit status says
+ *  whether it succeeded.  Otherwise the files, plus those named in
+ *  listfile, are parsed by parser_batch() and a line is printed for
+ *  each one.  -s saves what header declares in prefixfile, for use
+ *  through the PREFIX environment variable.  -i prints the offset,
+ *  brace depth and character of each entry of the file's structural
+ *  index, instead of parsing it.  -a prints the file's syntax tree, as
+ *  far as the parse got, and -r prints a tree saved through AST_SAVE.
+ */
+void parser_main(int argc, char *argv[])
+{
+	parser_t *p;
+	parser_index_t pi;
+	char **files = NULL;
+	int nfiles = 0, size = 0;
+	int nthreads = 0;
+	size_t n;
+	int i;
+
+	if (argc == 2 && argv[1][0] != '-') {
+		p = parser_create();
+		if (parser_parse_file(p, argv[1]) != 0) {
+			fprintf(stderr, "Parse failed: %s\n", parser_error(p));
+			exit(1);
+		}
+		parser_destroy(p);
+		return;
+	}
+	if (argc == 3 && strcmp(argv[1], "-i") == 0) {
+		p = parser_create();
+		i = parser_index_file(p, argv[2], &pi);
+		for (n = 0; n < pi.pi_count; ++n)
+			printf("%u %u %c\n", pi.pi_offset[n], pi.pi_depth[n],
+					pi.pi_text[pi.pi_offset[n]]);
+		if (i != 0) {
+			fprintf(stderr, "Index failed: %s\n", parser_error(p));
+			exit(1);
+		}
+		parser_destroy(p);
+		return;
+	}
+	if (argc == 3 && strcmp(argv[1], "-a") == 0) {
+		p = parser_create();
+		parser_set_ast(p, 1);
+		i = parser_parse_file(p, argv[2]);
+		if (parser_ast(p) != NULL)
+			ast_print(parser_ast(p), stdout);
+		if (i != 0) {
+			fprintf(stderr, "Parse failed: %s\n", parser_error(p));
+			exit(1);
+		}
+		parser_destroy(p);
+		return;
+	}
+	if (argc == 3 && strcmp(argv[1], "-r") == 0) {
+		ast_t t;
+		const char *source;
+
+		if (ast_map(&t, argv[2], &source) != 0) {
+			fprintf(stderr, "Cannot read %s: %s\n", argv[2],
+						strerror(errno));
+			exit(1);
+		}
+		if (ast_check(&t) != 0) {
+			fprintf(stderr, "%s is damaged\n", argv[2]);
+			ast_free(&t);
+			exit(1);
+		}
+		printf("%s\n", source);
+		ast_print(&t, stdout);
+		ast_free(&t);
+		return;
+	}
+	if (argc == 4 && strcmp(argv[1], "-s") == 0) {
+		p = parser_create();
+		if (parser_save_prefix(p, argv[3], argv[2]) != 0) {
+			fprintf(stderr, "Saving prefix failed: %s\n",
+							parser_error(p));
+			exit(1);
+		}
+		parser_destroy(p);
+		return;
+	}
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			nthreads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+			read_file_list(argv[++i], &files, &nfiles, &size);
+		else if (argv[i][0] == '-') {
+			fprintf(stderr, "usage: %s [-j threads] [-l listfile] "
+						"file...\n"
+					"       %s -s prefixfile header\n"
+					"       %s -i file\n"
+					"       %s -a file\n"
+					"       %s -r treefile\n",
+					argv[0], argv[0], argv[0], argv[0],
+					argv[0]);
+			exit(1);
+		}
+		else {
+			if (nfiles == size) {
+				size = size ? size * 2 : 64;
+				files = realloc(files, size * sizeof *files);
+				if (files == NULL) {
+					perror("realloc");
+					exit(1);
+				}
+			}
+			files[nfiles++] = string_copy(argv[i], strlen(argv[i]));
+		}
+	}
+	if (nfiles == 0)
+		exit(1);
+	if (nthreads <= 0)
+		nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+	i = parser_batch((const char **) files, nfiles, nthreads, stdout);
+	while (nfiles > 0)
+		free(files[--nfiles]);
+	free(files);
+	if (i != 0)
+		exit(1);
+}
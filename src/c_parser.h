@@ -0,0 +1,104 @@
+/* c_parser.h - interface to the C 99 parser */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+/*
+ *  A parser_t is a parsing session.  It holds all of the parser's and
+ *  the lexer's state, so a process may run many sessions at once, one
+ *  per thread, and may reuse a session for one file after another.
+ *
+ *	p = parser_create();
+ *	if (parser_parse_file(p, "foo.i") != 0)
+ *		fprintf(stderr, "%s\n", parser_error(p));
+ *	parser_destroy(p);
+ *
+ *  The parse functions return 0 on success and -1 on failure.
+ */
+
+#ifndef c_parser_h
+#define c_parser_h
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "ast.h"
+
+typedef struct parser_t parser_t;
+
+/* A function body skipped by a lazy parse */
+typedef struct {
+	const char *pb_name;		/* the function's name */
+	size_t pb_start;		/* offset of its '{' in the input */
+	size_t pb_end;			/* just past its '}' */
+} parser_body_t;
+
+/* A token matched by the parser, for parser_events_t */
+typedef struct {
+	int pt_token;			/* a token_t, from c_lex.h */
+	const char *pt_name;		/* an identifier's name, or NULL */
+	size_t pt_start;		/* its text in the input, if that */
+	size_t pt_end;			/* is in memory, and 0 if not */
+} parser_token_t;
+
+/* What a parse tells parser_set_events() callers as it goes */
+typedef struct {
+	void (*pe_begin)(void *arg, const char *rule);
+	void (*pe_end)(void *arg, const char *rule);
+	void (*pe_token)(void *arg, const parser_token_t *token);
+} parser_events_t;
+
+/* The structural characters of an input, from parser_index_file() */
+typedef struct {
+	const char *pi_text;		/* the input */
+	const unsigned int *pi_offset;	/* where each one is in pi_text */
+	const unsigned int *pi_depth;	/* the braces open around it */
+	size_t pi_count;
+} parser_index_t;
+
+parser_t *parser_create(void);
+void parser_destroy(parser_t *p);
+void parser_set_debug(parser_t *p, int level);
+void parser_set_prelex(parser_t *p, int on);
+void parser_set_descent(parser_t *p, int on);
+void parser_set_lazy(parser_t *p, int on);
+void parser_set_threads(parser_t *p, int n);
+void parser_set_incremental(parser_t *p, int on);
+void parser_set_ast(parser_t *p, int on);
+void parser_set_ast_save(parser_t *p, const char *suffix);
+void parser_set_events(parser_t *p, const parser_events_t *ev, void *arg);
+void parser_set_errors(parser_t *p, FILE *fp);
+int parser_parse_file(parser_t *p, const char *filename);
+int parser_parse_buffer(parser_t *p, const char *text, size_t len,
+			const char *name);
+const char *parser_error(parser_t *p);
+int parser_body_count(parser_t *p);
+const parser_body_t *parser_body(parser_t *p, int i);
+int parser_parse_body(parser_t *p, int i);
+const ast_t *parser_ast(parser_t *p);
+int parser_take_ast(parser_t *p, ast_t *t);
+int parser_edit(parser_t *p, size_t offset, size_t removed,
+		const char *text, size_t len);
+int parser_save_prefix(parser_t *p, const char *header,
+			const char *filename);
+int parser_load_prefix(parser_t *p, const char *filename);
+int parser_index_file(parser_t *p, const char *filename,
+			parser_index_t *pi);
+int parser_index_buffer(parser_t *p, const char *text, size_t len,
+			const char *name, parser_index_t *pi);
+
+/* Parse many files on nthreads threads; returns the number that failed */
+int parser_batch(const char **files, int nfiles, int nthreads, FILE *out);
+
+void parser_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,69 @@
+/* keytab.h - the C keywords, shared by c_lex.c and mkkeyhash.c */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+/*
+ *  Keytab is defined here rather than in c_lex.c so that mkkeyhash can
+ *  build the keyword hash table (keyhash.h) from it when the lexer is
+ *  compiled.  To add a keyword, add it here and rebuild.
+ */
+
+#ifndef keytab_h
+#define keytab_h
+
+static struct {
+	const char *name;
+	token_t token;
+	bool need_lexinfo;
+} Keytab[] = {
+	{"_Bool",	BOOL,		FALSE},
+	{"_Complex",	COMPLEX,	FALSE},
+	{"_Imaginary",	IMAGINARY,	FALSE},
+	{"auto",	AUTO,		FALSE},
+	{"break",	BREAK,		TRUE},
+	{"case",	CASE,		FALSE},
+	{"char",	CHAR,		FALSE},
+	{"const",	CONST,		FALSE},
+	{"continue",	CONTINUE,	TRUE},
+	{"default",	DEFAULT,	FALSE},
+	{"do",		DO,		FALSE},
+	{"double",	DOUBLE,		FALSE},
+	{"else",	ELSE,		FALSE},
+	{"enum",	ENUM,		FALSE},
+	{"extern",	EXTERN,		FALSE},
+	{"float",	FLOAT,		FALSE},
+	{"for",		FOR,		TRUE},
+	{"goto",	GOTO,		FALSE},
+	{"if",		IF,		FALSE},
+	{"inline",	INLINE,		FALSE},
+	{"int",		INT,		FALSE},
+	{"long",	LONG,		FALSE},
+	{"register",	REGISTER,	FALSE},
+	{"restrict",	RESTRICT,	FALSE},
+	{"return",	RETURN,		TRUE},
+	{"short",	SHORT,		FALSE},
+	{"signed",	SIGNED,		FALSE},
+	{"sizeof",	SIZEOF,		FALSE},
+	{"static",	STATIC,		FALSE},
+	{"struct",	STRUCT,		FALSE},
+	{"switch",	SWITCH,		FALSE},
+	{"typedef",	TYPEDEF,	FALSE},
+	{"union",	UNION,		FALSE},
+	{"unsigned",	UNSIGNED,	FALSE},
+	{"void",	VOID,		FALSE},
+	{"volatile",	VOLATILE,	FALSE},
+	{"while",	WHILE,		FALSE}
+};
+#define NKEYS (sizeof Keytab / sizeof *Keytab)
+
+#endif
@@ -0,0 +1,562 @@
+/* lex_scan.c - lexer scanning loops, vectorised where possible */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+/*
+ *  Each vector scanner builds a bit mask with one bit per character
+ *  of an aligned block, set where the scan should stop, and returns
+ *  the position of the lowest set bit.  In the first block the bits
+ *  for characters before the starting point are cleared.  Most runs
+ *  of blanks are a single space, so the first character is always
+ *  tested on its own before any vector work is done.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "lex_scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SCAN 1
+#include <immintrin.h>
+/* The aligned loads of the last block may take in bytes after the
+ * NUL, which AddressSanitizer would report on heap input.
+ */
+#define NO_ASAN __attribute__((no_sanitize_address))
+#endif
+
+/*  Anything not listed, including every byte above 127, is CC_OTHER.
+ */
+const unsigned char Lex_charclass[256] = {
+	['\0'] = CC_END,
+	['\t'] = CC_BLANK, ['\v'] = CC_BLANK, ['\f'] = CC_BLANK,
+	['\r'] = CC_BLANK, [' '] = CC_BLANK,
+	['\n'] = CC_NEWLINE,
+	['$'] = CC_LETTER, ['A'] = CC_LETTER, ['B'] = CC_LETTER,
+	['C'] = CC_LETTER, ['D'] = CC_LETTER, ['E'] = CC_LETTER,
+	['F'] = CC_LETTER, ['G'] = CC_LETTER, ['H'] = CC_LETTER,
+	['I'] = CC_LETTER, ['J'] = CC_LETTER, ['K'] = CC_LETTER,
+	['L'] = CC_LETTER, ['M'] = CC_LETTER, ['N'] = CC_LETTER,
+	['O'] = CC_LETTER, ['P'] = CC_LETTER, ['Q'] = CC_LETTER,
+	['R'] = CC_LETTER, ['S'] = CC_LETTER, ['T'] = CC_LETTER,
+	['U'] = CC_LETTER, ['V'] = CC_LETTER, ['W'] = CC_LETTER,
+	['X'] = CC_LETTER, ['Y'] = CC_LETTER, ['Z'] = CC_LETTER,
+	['_'] = CC_LETTER, ['a'] = CC_LETTER, ['b'] = CC_LETTER,
+	['c'] = CC_LETTER, ['d'] = CC_LETTER, ['e'] = CC_LETTER,
+	['f'] = CC_LETTER, ['g'] = CC_LETTER, ['h'] = CC_LETTER,
+	['i'] = CC_LETTER, ['j'] = CC_LETTER, ['k'] = CC_LETTER,
+	['l'] = CC_LETTER, ['m'] = CC_LETTER, ['n'] = CC_LETTER,
+	['o'] = CC_LETTER, ['p'] = CC_LETTER, ['q'] = CC_LETTER,
+	['r'] = CC_LETTER, ['s'] = CC_LETTER, ['t'] = CC_LETTER,
+	['u'] = CC_LETTER, ['v'] = CC_LETTER, ['w'] = CC_LETTER,
+	['x'] = CC_LETTER, ['y'] = CC_LETTER, ['z'] = CC_LETTER,
+	['0'] = CC_DIGIT, ['1'] = CC_DIGIT, ['2'] = CC_DIGIT,
+	['3'] = CC_DIGIT, ['4'] = CC_DIGIT, ['5'] = CC_DIGIT,
+	['6'] = CC_DIGIT, ['7'] = CC_DIGIT, ['8'] = CC_DIGIT,
+	['9'] = CC_DIGIT,
+	['.'] = CC_DOT,
+	['!'] = CC_PUNCT, ['%'] = CC_PUNCT, ['&'] = CC_PUNCT,
+	['('] = CC_PUNCT, [')'] = CC_PUNCT, ['*'] = CC_PUNCT,
+	['+'] = CC_PUNCT, [','] = CC_PUNCT, ['-'] = CC_PUNCT,
+	['/'] = CC_PUNCT, [':'] = CC_PUNCT, [';'] = CC_PUNCT,
+	['<'] = CC_PUNCT, ['='] = CC_PUNCT, ['>'] = CC_PUNCT,
+	['?'] = CC_PUNCT, ['['] = CC_PUNCT, [']'] = CC_PUNCT,
+	['^'] = CC_PUNCT, ['{'] = CC_PUNCT, ['|'] = CC_PUNCT,
+	['}'] = CC_PUNCT, ['~'] = CC_PUNCT,
+	['\''] = CC_QUOTE,
+	['"'] = CC_DQUOTE,
+};
+
+#define IS_BLANK(c)	LEX_IS_BLANK(c)
+#define IS_IDENT(c)	LEX_IS_IDENT(c)
+
+/*  Most names are short, and are quicker to finish one character at
+ *  a time than to load a vector for.
+ */
+#define SHORT_IDENT	8
+
+static const char *
+scalar_blanks(const char *s)
+{
+	while (IS_BLANK(*s))
+		++s;
+	return s;
+}
+
+static const char *
+scalar_comment(const char *s)
+{
+	while (*s != '*' && *s != '\n' && *s != '\0')
+		++s;
+	return s;
+}
+
+static const char *
+scalar_ident(const char *s)
+{
+	while (IS_IDENT(*s))
+		++s;
+	return s;
+}
+
+static const char *
+scalar_string(const char *s)
+{
+	while (*s != '"' && *s != '\\' && *s != '\n' && *s != '\0')
+		++s;
+	return s;
+}
+
+static const char *
+scalar_block(const char *s)
+{
+	while (*s != '{' && *s != '}' && *s != '"' && *s != '\'' &&
+		*s != '/' && *s != '\n' && *s != '\0')
+		++s;
+	return s;
+}
+
+static void
+scalar_classify(const char *s, lex_masks_t *m)
+{
+	unsigned long long bit;
+
+	memset(m, 0, sizeof *m);
+	for (bit = 1; bit != 0; bit <<= 1, ++s) {
+		switch (*s) {
+		case '{':
+			m->lm_open |= bit;
+			m->lm_struct |= bit;
+			break;
+		case '}':
+			m->lm_close |= bit;
+			m->lm_struct |= bit;
+			break;
+		case '(': case ')': case '[': case ']': case ';': case ',':
+			m->lm_struct |= bit;
+			break;
+		case '"':
+			m->lm_dquote |= bit;
+			break;
+		case '\'':
+			m->lm_quote |= bit;
+			break;
+		case '/':
+			m->lm_slash |= bit;
+			break;
+		case '*':
+			m->lm_star |= bit;
+			break;
+		case '\\':
+			m->lm_backslash |= bit;
+			break;
+		case '\n':
+			m->lm_newline |= bit;
+			break;
+		case '#':
+			m->lm_hash |= bit;
+			break;
+		case '\0':
+			m->lm_nul |= bit;
+			break;
+		}
+	}
+}
+
+#ifdef HAVE_X86_SCAN
+
+/*  x - lo <= n, unsigned, for each byte.
+ */
+#define SSE2_IN_RANGE(x, lo, n) \
+	_mm_cmpeq_epi8(_mm_min_epu8(_mm_sub_epi8((x), _mm_set1_epi8(lo)), \
+				_mm_set1_epi8(n)), \
+			_mm_sub_epi8((x), _mm_set1_epi8(lo)))
+
+__attribute__((target("sse2"))) static unsigned int
+sse2_stop_blanks(__m128i x)
+{
+	__m128i blank;
+
+	blank = _mm_andnot_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')),
+				SSE2_IN_RANGE(x, '\t', '\r' - '\t'));
+	blank = _mm_or_si128(blank, _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')));
+	return ~_mm_movemask_epi8(blank) & 0xffff;
+}
+
+__attribute__((target("sse2"))) static unsigned int
+sse2_stop_comment(__m128i x)
+{
+	__m128i stop;
+
+	stop = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('*')),
+				_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')));
+	stop = _mm_or_si128(stop, _mm_cmpeq_epi8(x, _mm_setzero_si128()));
+	return _mm_movemask_epi8(stop);
+}
+
+__attribute__((target("sse2"))) static unsigned int
+sse2_stop_ident(__m128i x)
+{
+	__m128i ident;
+
+	ident = SSE2_IN_RANGE(_mm_or_si128(x, _mm_set1_epi8(0x20)),
+							'a', 'z' - 'a');
+	ident = _mm_or_si128(ident, SSE2_IN_RANGE(x, '0', 9));
+	ident = _mm_or_si128(ident, _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+	ident = _mm_or_si128(ident, _mm_cmpeq_epi8(x, _mm_set1_epi8('$')));
+	return ~_mm_movemask_epi8(ident) & 0xffff;
+}
+
+__attribute__((target("sse2"))) static unsigned int
+sse2_stop_string(__m128i x)
+{
+	__m128i stop;
+
+	stop = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')),
+				_mm_cmpeq_epi8(x, _mm_set1_epi8('\\')));
+	stop = _mm_or_si128(stop, _mm_cmpeq_epi8(x, _mm_set1_epi8('\n')));
+	stop = _mm_or_si128(stop, _mm_cmpeq_epi8(x, _mm_setzero_si128()));
+	return _mm_movemask_epi8(stop);
+}
+
+__attribute__((target("sse2"))) static unsigned int
+sse2_stop_block(__m128i x)
+{
+	__m128i stop;
+
+	stop = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('{')),
+				_mm_cmpeq_epi8(x, _mm_set1_epi8('}')));
+	stop = _mm_or_si128(stop, _mm_cmpeq_epi8(x, _mm_set1_epi8('"')));
+	stop = _mm_or_si128(stop, _mm_cmpeq_epi8(x, _mm_set1_epi8('\'')));
+	stop = _mm_or_si128(stop, _mm_cmpeq_epi8(x, _mm_set1_epi8('/')));
+	stop = _mm_or_si128(stop, _mm_cmpeq_epi8(x, _mm_set1_epi8('\n')));
+	stop = _mm_or_si128(stop, _mm_cmpeq_epi8(x, _mm_setzero_si128()));
+	return _mm_movemask_epi8(stop);
+}
+
+#define SSE2_SCAN(name, stop) \
+__attribute__((target("sse2"))) NO_ASAN static const char * \
+name(const char *s) \
+{ \
+	const __m128i *v; \
+	unsigned int off, mask; \
+ \
+	off = (size_t)s & 15; \
+	v = (const __m128i *)(s - off); \
+	mask = stop(_mm_load_si128(v)) & (0xffffu << off); \
+	while (mask == 0) \
+		mask = stop(_mm_load_si128(++v)); \
+	return (const char *)v + __builtin_ctz(mask); \
+}
+
+SSE2_SCAN(sse2_scan_blanks, sse2_stop_blanks)
+SSE2_SCAN(sse2_scan_comment, sse2_stop_comment)
+SSE2_SCAN(sse2_scan_ident, sse2_stop_ident)
+SSE2_SCAN(sse2_string, sse2_stop_string)
+SSE2_SCAN(sse2_block, sse2_stop_block)
+
+#define SSE2_EQ(x, c) \
+	((unsigned long long)_mm_movemask_epi8(_mm_cmpeq_epi8((x), \
+							_mm_set1_epi8(c))))
+
+/*  SSE2 has no byte shuffle, so the structural characters are
+ *  compared for one at a time.
+ */
+__attribute__((target("sse2"))) static void
+sse2_classify(const char *s, lex_masks_t *m)
+{
+	const __m128i *v = (const __m128i *)s;
+	__m128i x;
+	unsigned long long st, open, close;
+	int i, sh;
+
+	memset(m, 0, sizeof *m);
+	for (i = 0; i < 4; ++i) {
+		x = _mm_load_si128(v + i);
+		sh = 16 * i;
+		open = SSE2_EQ(x, '{');
+		close = SSE2_EQ(x, '}');
+		st = open | close | SSE2_EQ(x, '(') | SSE2_EQ(x, ')') |
+			SSE2_EQ(x, '[') | SSE2_EQ(x, ']') | SSE2_EQ(x, ';') |
+			SSE2_EQ(x, ',');
+		m->lm_struct |= st << sh;
+		m->lm_open |= open << sh;
+		m->lm_close |= close << sh;
+		m->lm_dquote |= SSE2_EQ(x, '"') << sh;
+		m->lm_quote |= SSE2_EQ(x, '\'') << sh;
+		m->lm_slash |= SSE2_EQ(x, '/') << sh;
+		m->lm_star |= SSE2_EQ(x, '*') << sh;
+		m->lm_backslash |= SSE2_EQ(x, '\\') << sh;
+		m->lm_newline |= SSE2_EQ(x, '\n') << sh;
+		m->lm_hash |= SSE2_EQ(x, '#') << sh;
+		m->lm_nul |= SSE2_EQ(x, '\0') << sh;
+	}
+}
+
+static const char *
+sse2_blanks(const char *s)
+{
+	return IS_BLANK(*s) ? sse2_scan_blanks(s) : s;
+}
+
+static const char *
+sse2_comment(const char *s)
+{
+	return sse2_scan_comment(s);
+}
+
+static const char *
+sse2_ident(const char *s)
+{
+	int i;
+
+	for (i = 0; i < SHORT_IDENT; ++i) {
+		if (!IS_IDENT(s[i]))
+			return s + i;
+	}
+	return sse2_scan_ident(s + SHORT_IDENT);
+}
+
+#define AVX2_IN_RANGE(x, lo, n) \
+	_mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_sub_epi8((x), \
+					_mm256_set1_epi8(lo)), \
+				_mm256_set1_epi8(n)), \
+			_mm256_sub_epi8((x), _mm256_set1_epi8(lo)))
+
+__attribute__((target("avx2"))) static unsigned int
+avx2_stop_blanks(__m256i x)
+{
+	__m256i blank;
+
+	blank = _mm256_andnot_si256(
+			_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')),
+			AVX2_IN_RANGE(x, '\t', '\r' - '\t'));
+	blank = _mm256_or_si256(blank,
+			_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')));
+	return ~(unsigned int)_mm256_movemask_epi8(blank);
+}
+
+__attribute__((target("avx2"))) static unsigned int
+avx2_stop_comment(__m256i x)
+{
+	__m256i stop;
+
+	stop = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('*')),
+				_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')));
+	stop = _mm256_or_si256(stop,
+				_mm256_cmpeq_epi8(x, _mm256_setzero_si256()));
+	return (unsigned int)_mm256_movemask_epi8(stop);
+}
+
+__attribute__((target("avx2"))) static unsigned int
+avx2_stop_ident(__m256i x)
+{
+	__m256i ident;
+
+	ident = AVX2_IN_RANGE(_mm256_or_si256(x, _mm256_set1_epi8(0x20)),
+							'a', 'z' - 'a');
+	ident = _mm256_or_si256(ident, AVX2_IN_RANGE(x, '0', 9));
+	ident = _mm256_or_si256(ident,
+				_mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')));
+	ident = _mm256_or_si256(ident,
+				_mm256_cmpeq_epi8(x, _mm256_set1_epi8('$')));
+	return ~(unsigned int)_mm256_movemask_epi8(ident);
+}
+
+__attribute__((target("avx2"))) static unsigned int
+avx2_stop_string(__m256i x)
+{
+	__m256i stop;
+
+	stop = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')),
+				_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\')));
+	stop = _mm256_or_si256(stop,
+				_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')));
+	stop = _mm256_or_si256(stop,
+				_mm256_cmpeq_epi8(x, _mm256_setzero_si256()));
+	return (unsigned int)_mm256_movemask_epi8(stop);
+}
+
+__attribute__((target("avx2"))) static unsigned int
+avx2_stop_block(__m256i x)
+{
+	__m256i stop;
+
+	stop = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('{')),
+				_mm256_cmpeq_epi8(x, _mm256_set1_epi8('}')));
+	stop = _mm256_or_si256(stop,
+				_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')));
+	stop = _mm256_or_si256(stop,
+				_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\'')));
+	stop = _mm256_or_si256(stop,
+				_mm256_cmpeq_epi8(x, _mm256_set1_epi8('/')));
+	stop = _mm256_or_si256(stop,
+				_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')));
+	stop = _mm256_or_si256(stop,
+				_mm256_cmpeq_epi8(x, _mm256_setzero_si256()));
+	return (unsigned int)_mm256_movemask_epi8(stop);
+}
+
+#define AVX2_SCAN(name, stop) \
+__attribute__((target("avx2"))) NO_ASAN static const char * \
+name(const char *s) \
+{ \
+	const __m256i *v; \
+	unsigned int off, mask; \
+ \
+	off = (size_t)s & 31; \
+	v = (const __m256i *)(s - off); \
+	mask = stop(_mm256_load_si256(v)) & (0xffffffffu << off); \
+	while (mask == 0) \
+		mask = stop(_mm256_load_si256(++v)); \
+	return (const char *)v + __builtin_ctz(mask); \
+}
+
+AVX2_SCAN(avx2_scan_blanks, avx2_stop_blanks)
+AVX2_SCAN(avx2_scan_comment, avx2_stop_comment)
+AVX2_SCAN(avx2_scan_ident, avx2_stop_ident)
+AVX2_SCAN(avx2_string, avx2_stop_string)
+AVX2_SCAN(avx2_block, avx2_stop_block)
+
+#define AVX2_EQ(x, c) \
+	((unsigned long long)(unsigned int)_mm256_movemask_epi8( \
+			_mm256_cmpeq_epi8((x), _mm256_set1_epi8(c))))
+
+/*  The structural characters are found with two table lookups, on the
+ *  low and the high half of each byte, whose results share a bit only
+ *  for one of them: 0x28, 0x29 and 0x2c share bit 0, 0x3b bit 1, and
+ *  0x5b, 0x5d, 0x7b and 0x7d bit 2.
+ */
+__attribute__((target("avx2"))) static unsigned long long
+avx2_struct(__m256i x)
+{
+	const __m256i lo = _mm256_setr_epi8(
+			0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 6, 1, 4, 0, 0,
+			0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 6, 1, 4, 0, 0);
+	const __m256i hi = _mm256_setr_epi8(
+			0, 0, 1, 2, 0, 4, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0,
+			0, 0, 1, 2, 0, 4, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	__m256i both;
+
+	both = _mm256_and_si256(
+		_mm256_shuffle_epi8(lo, _mm256_and_si256(x, nibble)),
+		_mm256_shuffle_epi8(hi, _mm256_and_si256(
+					_mm256_srli_epi16(x, 4), nibble)));
+	return (unsigned int)~_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(both, _mm256_setzero_si256()));
+}
+
+__attribute__((target("avx2"))) static void
+avx2_classify(const char *s, lex_masks_t *m)
+{
+	const __m256i *v = (const __m256i *)s;
+	__m256i x, y;
+
+	x = _mm256_load_si256(v);
+	y = _mm256_load_si256(v + 1);
+	m->lm_struct = avx2_struct(x) | avx2_struct(y) << 32;
+	m->lm_open = AVX2_EQ(x, '{') | AVX2_EQ(y, '{') << 32;
+	m->lm_close = AVX2_EQ(x, '}') | AVX2_EQ(y, '}') << 32;
+	m->lm_dquote = AVX2_EQ(x, '"') | AVX2_EQ(y, '"') << 32;
+	m->lm_quote = AVX2_EQ(x, '\'') | AVX2_EQ(y, '\'') << 32;
+	m->lm_slash = AVX2_EQ(x, '/') | AVX2_EQ(y, '/') << 32;
+	m->lm_star = AVX2_EQ(x, '*') | AVX2_EQ(y, '*') << 32;
+	m->lm_backslash = AVX2_EQ(x, '\\') | AVX2_EQ(y, '\\') << 32;
+	m->lm_newline = AVX2_EQ(x, '\n') | AVX2_EQ(y, '\n') << 32;
+	m->lm_hash = AVX2_EQ(x, '#') | AVX2_EQ(y, '#') << 32;
+	m->lm_nul = AVX2_EQ(x, '\0') | AVX2_EQ(y, '\0') << 32;
+}
+
+static const char *
+avx2_blanks(const char *s)
+{
+	return IS_BLANK(*s) ? avx2_scan_blanks(s) : s;
+}
+
+static const char *
+avx2_comment(const char *s)
+{
+	return avx2_scan_comment(s);
+}
+
+static const char *
+avx2_ident(const char *s)
+{
+	int i;
+
+	for (i = 0; i < SHORT_IDENT; ++i) {
+		if (!IS_IDENT(s[i]))
+			return s + i;
+	}
+	return avx2_scan_ident(s + SHORT_IDENT);
+}
+
+#endif /* HAVE_X86_SCAN */
+
+/*  Best first.
+ */
+static const lex_scan_t Scanners[] = {
+#ifdef HAVE_X86_SCAN
+	{ "avx2", avx2_blanks, avx2_comment, avx2_ident, avx2_string,
+					avx2_block, avx2_classify },
+	{ "sse2", sse2_blanks, sse2_comment, sse2_ident, sse2_string,
+					sse2_block, sse2_classify },
+#endif
+	{ "scalar", scalar_blanks, scalar_comment, scalar_ident,
+			scalar_string, scalar_block, scalar_classify },
+};
+#define NSCANNERS	(sizeof Scanners / sizeof *Scanners)
+
+static int
+supported(const lex_scan_t *ls)
+{
+#ifdef HAVE_X86_SCAN
+	if (strcmp(ls->ls_name, "avx2") == 0)
+		return __builtin_cpu_supports("avx2");
+	if (strcmp(ls->ls_name, "sse2") == 0)
+		return __builtin_cpu_supports("sse2");
+#endif
+	return 1;
+}
+
+/*  The i'th set of scanners this CPU can run, best first, or NULL
+ *  when there are no more.
+ */
+const lex_scan_t *
+lex_scan_list(int i)
+{
+	unsigned int n;
+
+	for (n = 0; n < NSCANNERS; ++n) {
+		if (supported(&Scanners[n]) && i-- == 0)
+			return &Scanners[n];
+	}
+	return NULL;
+}
+
+/*  The scanners called name, or the best ones if name is NULL.
+ *  Returns NULL if there are none by that name that this CPU can run.
+ */
+const lex_scan_t *
+lex_scan_select(const char *name)
+{
+	const lex_scan_t *ls;
+	int i;
+
+	for (i = 0; (ls = lex_scan_list(i)) != NULL; ++i) {
+		if (name == NULL || strcmp(ls->ls_name, name) == 0)
+			return ls;
+	}
+	return NULL;
+}
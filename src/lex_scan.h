@@ -0,0 +1,100 @@
+/* lex_scan.h - lexer scanning loops, vectorised where possible */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+/*
+ *  The lexer's innermost loops, each of which runs along a string
+ *  until it finds a character of some class.  There is a plain C
+ *  version of each, and SSE2 and AVX2 versions on x86 that look at
+ *  16 or 32 characters at a time; lex_scan_select() picks the best
+ *  set the CPU supports.  ls_classify() instead sorts a whole block
+ *  of characters at once, for structidx_build().
+ *
+ *  Every scanner stops at a NUL, so the string must be NUL terminated.
+ *  The vector versions only make aligned loads, which never cross
+ *  into a page that the terminating NUL is not on.  They read past
+ *  the NUL on purpose, up to the end of its aligned 16 or 32 byte
+ *  block, and never fault; these reads are left out of
+ *  AddressSanitizer's checks, which would otherwise stop at them on
+ *  input in a heap buffer.
+ */
+
+#ifndef lex_scan_h
+#define lex_scan_h
+
+/*  Character classes, from Lex_charclass.  Only the first character of
+ *  a token decides which class of token it is.
+ */
+enum {
+	CC_OTHER,		/* not allowed outside strings */
+	CC_END,			/* NUL */
+	CC_BLANK,		/* ' ', '\t', '\v', '\f', '\r' */
+	CC_NEWLINE,
+	CC_LETTER,		/* letters, '_' and '$' */
+	CC_DIGIT,
+	CC_DOT,			/* operator, or the start of a number */
+	CC_PUNCT,		/* the first character of an operator */
+	CC_QUOTE,
+	CC_DQUOTE
+};
+
+extern const unsigned char Lex_charclass[256];
+
+#define LEX_CLASS(c)	(Lex_charclass[(unsigned char)(c)])
+#define LEX_IS_BLANK(c)	(LEX_CLASS(c) == CC_BLANK)
+#define LEX_IS_DIGIT(c)	(LEX_CLASS(c) == CC_DIGIT)
+#define LEX_IS_IDENT(c)	(LEX_CLASS(c) == CC_LETTER || LEX_CLASS(c) == CC_DIGIT)
+
+/*  One bit for each of the 64 characters of a block, bit i standing
+ *  for character i, set where the character is of the kind named.
+ */
+typedef struct {
+	unsigned long long lm_struct;	/* '{' '}' '(' ')' '[' ']' ';' ',' */
+	unsigned long long lm_open;	/* '{' */
+	unsigned long long lm_close;	/* '}' */
+	unsigned long long lm_dquote;	/* '"' */
+	unsigned long long lm_quote;	/* '\'' */
+	unsigned long long lm_slash;
+	unsigned long long lm_star;
+	unsigned long long lm_backslash;
+	unsigned long long lm_newline;
+	unsigned long long lm_hash;	/* '#' */
+	unsigned long long lm_nul;
+} lex_masks_t;
+
+typedef struct lex_scan_t {
+	const char *ls_name;
+	/* Skip ' ', '\t', '\v', '\f' and '\r'; newlines are left to
+	 * the caller, which has to count them.
+	 */
+	const char *(*ls_blanks)(const char *s);
+	/* Find the first '*', '\n' or NUL, inside a comment */
+	const char *(*ls_comment)(const char *s);
+	/* Skip letters, digits, '_' and '$' */
+	const char *(*ls_ident)(const char *s);
+	/* Find the first '"', '\\', '\n' or NUL, inside a string */
+	const char *(*ls_string)(const char *s);
+	/* Find the first '{', '}', '"', '\'', '/', '\n' or NUL, when
+	 * skipping a block without lexing it
+	 */
+	const char *(*ls_block)(const char *s);
+	/* Fill in the masks for the 64 characters at s, which must be
+	 * aligned to 64 bytes; this one does not stop at a NUL
+	 */
+	void (*ls_classify)(const char *s, lex_masks_t *m);
+} lex_scan_t;
+
+const lex_scan_t *lex_scan_select(const char *name);
+const lex_scan_t *lex_scan_list(int i);
+
+#endif
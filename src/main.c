@@ -1,4 +1,4 @@
-extern void parser_main(int, char *[]);
+#include "c_parser.h"
 
 int main(int argc, char* argv[])
 {
@@ -0,0 +1,118 @@
+/* mkkeyhash.c - write keyhash.h, the keyword hash table for c_lex.c */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+/*
+ *  The hash is keyed on the length and the first, second and last
+ *  characters of a name, each with its own multiplier.  mkkeyhash
+ *  tries multipliers, smallest table first, until every keyword in
+ *  Keytab lands in a slot of its own, and writes that table out.  The
+ *  Makefile runs it whenever keytab.h changes.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "c_lex.h"
+#include "keytab.h"
+
+#define NKEYS		(sizeof Keytab / sizeof *Keytab)
+#define MAXMUL		16
+#define MAXSIZE		1024
+
+static unsigned int
+hash(const unsigned int *mul, const char *s, int len)
+{
+	return mul[0] * len + mul[1] * (unsigned char)s[0] +
+		mul[2] * (unsigned char)s[1] +
+		mul[3] * (unsigned char)s[len - 1];
+}
+
+/*  Fill table (size slots) with Keytab index plus one for each
+ *  keyword, or return 0 if two keywords share a slot.
+ */
+static int
+try_table(const unsigned int *mul, unsigned int size, unsigned char *table)
+{
+	unsigned int i, h;
+
+	memset(table, 0, size);
+	for (i = 0; i < NKEYS; ++i) {
+		h = hash(mul, Keytab[i].name, strlen(Keytab[i].name)) &
+			(size - 1);
+		if (table[h] != 0)
+			return 0;
+		table[h] = i + 1;
+	}
+	return 1;
+}
+
+static int
+find_table(unsigned int *mul, unsigned int *p_size, unsigned char *table)
+{
+	unsigned int size;
+
+	for (size = 32; size <= MAXSIZE; size *= 2)
+		for (mul[0] = 1; mul[0] < MAXMUL; ++mul[0])
+		for (mul[1] = 1; mul[1] < MAXMUL; ++mul[1])
+		for (mul[2] = 1; mul[2] < MAXMUL; ++mul[2])
+		for (mul[3] = 1; mul[3] < MAXMUL; ++mul[3])
+			if (try_table(mul, size, table)) {
+				*p_size = size;
+				return 1;
+			}
+	return 0;
+}
+
+int
+main(void)
+{
+	unsigned char table[MAXSIZE];
+	unsigned int mul[4], size, i;
+	int len, minlen, maxlen;
+
+	if (NKEYS > 255) {
+		fprintf(stderr, "mkkeyhash: too many keywords for a byte table\n");
+		return 1;
+	}
+	minlen = maxlen = strlen(Keytab[0].name);
+	for (i = 1; i < NKEYS; ++i) {
+		len = strlen(Keytab[i].name);
+		if (len < minlen)
+			minlen = len;
+		if (len > maxlen)
+			maxlen = len;
+	}
+	/* the hash reads the second character */
+	if (minlen < 2) {
+		fprintf(stderr, "mkkeyhash: keywords must be at least two characters long\n");
+		return 1;
+	}
+	if (!find_table(mul, &size, table)) {
+		fprintf(stderr, "mkkeyhash: no perfect hash found for Keytab\n");
+		return 1;
+	}
+
+	printf("/* keyhash.h - generated from keytab.h by mkkeyhash; do not edit */\n\n");
+	printf("#define KEY_MINLEN\t%d\n", minlen);
+	printf("#define KEY_MAXLEN\t%d\n\n", maxlen);
+	printf("#define KEYHASH(s, len)\t((%u * (len) + %u * (unsigned char)(s)[0] + \\\n"
+		"\t\t\t%u * (unsigned char)(s)[1] + \\\n"
+		"\t\t\t%u * (unsigned char)(s)[(len) - 1]) & %u)\n\n",
+		mul[0], mul[1], mul[2], mul[3], size - 1);
+	printf("static const unsigned char Keyhash[%u] = {", size);
+	for (i = 0; i < size; ++i)
+		printf("%s%3d,", i % 16 == 0 ? "\n\t" : "", table[i]);
+	printf("\n};\n");
+	return 0;
+}
@@ -0,0 +1,212 @@
+/* structidx.c - where the braces, parentheses and semicolons are */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+/*
+ *  The input is taken 64 characters at a time.  ls_classify() turns
+ *  each block into bit masks, and the block is then walked by finding
+ *  the lowest set bit of the mask for whatever would end the current
+ *  state: a quote, "/" or "#" outside anything, the closing quote,
+ *  backslash or newline in a constant, "*" in a comment, and newline
+ *  in a directive.  The structural characters met outside are taken
+ *  from their mask in a run, so most characters are never looked at
+ *  one by one.  The text is read as the lexer reads it: there are no
+ *  "//" comments, a constant ends at a newline, and a directive is a
+ *  line that starts with '#'.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "c_lex.h"
+#include "structidx.h"
+
+enum { IN_CODE, IN_STRING, IN_CHAR, IN_COMMENT, IN_DIRECTIVE };
+
+/*  The bits for positions pos and up, and those below k.
+ */
+#define FROM(pos)	((pos) >= 64 ? 0 : ~0ull << (pos))
+#define BELOW(k)	((k) >= 64 ? ~0ull : (1ull << (k)) - 1)
+
+void
+structidx_init(structidx_t *si)
+{
+	memset(si, 0, sizeof *si);
+}
+
+void
+structidx_free(structidx_t *si)
+{
+	free(si->si_offset);
+	free(si->si_depth);
+	structidx_init(si);
+}
+
+static void
+grow_index(structidx_t *si)
+{
+	si->si_size = si->si_size ? si->si_size * 2 : 4096;
+	si->si_offset = safe_realloc(si->si_offset,
+					si->si_size * sizeof *si->si_offset);
+	si->si_depth = safe_realloc(si->si_depth,
+					si->si_size * sizeof *si->si_depth);
+}
+
+/*
+ *  Index the len characters at text, which must be followed by a NUL
+ *  and fewer than 4G long.  The lexer stops at a NUL, and so does
+ *  this.  Returns 0, or -1 if the input ends in a comment or its
+ *  braces do not balance; the index is made anyway, with a stray '}'
+ *  given depth 0.
+ */
+int
+structidx_build(structidx_t *si, const char *text, size_t len,
+		const lex_scan_t *ls)
+{
+	char padbuf[128], *pad;
+	const char *base, *end, *blk;
+	lex_masks_t m;
+	unsigned long long valid, lines, stops, bits;
+	unsigned int i, k, pos, nl, off;
+	size_t n;
+	int depth, state, status;
+
+	pad = padbuf + (-(size_t)padbuf & 63);
+	end = text + len;
+	base = text - ((size_t)text & 63);
+	n = 0;
+	depth = 0;
+	state = IN_CODE;
+	status = 0;
+	pos = text - base;
+	nl = 1;			/* the input starts a line */
+	for (; base < end; base += 64) {
+		/* Blocks that run outside the input are copied, so that
+		 * nothing is read from outside it.
+		 */
+		valid = base < text ? FROM(pos) : ~0ull;
+		if (base < text || end - base < 64) {
+			memset(pad, ' ', 64);
+			blk = base < text ? text : base;
+			memcpy(pad + (blk - base), blk,
+				(end - base < 64 ? end : base + 64) - blk);
+			if (end - base < 64)
+				valid &= BELOW(end - base);
+			(*ls->ls_classify)(pad, &m);
+		}
+		else
+			(*ls->ls_classify)(base, &m);
+		if ((m.lm_nul & valid) != 0) {
+			valid &= BELOW(__builtin_ctzll(m.lm_nul & valid));
+			end = base;
+		}
+		lines = m.lm_newline << 1 | (unsigned long long)nl <<
+						(base < text ? pos : 0);
+		nl = m.lm_newline >> 63;
+
+		if (si->si_size - n < 64)
+			grow_index(si);
+		off = base - text;
+		while (pos < 64) {
+			switch (state) {
+			case IN_CODE:
+				stops = (m.lm_dquote | m.lm_quote | m.lm_slash |
+						(m.lm_hash & lines)) &
+							valid & FROM(pos);
+				k = stops ? __builtin_ctzll(stops) : 64;
+				bits = m.lm_struct & valid & FROM(pos) &
+								BELOW(k);
+				for (; bits != 0; bits &= bits - 1) {
+					i = __builtin_ctzll(bits);
+					depth -= m.lm_close >> i & 1;
+					if (depth < 0) {
+						depth = 0;
+						status = -1;
+					}
+					si->si_offset[n] = off + i;
+					si->si_depth[n++] = depth;
+					depth += m.lm_open >> i & 1;
+				}
+				if (k == 64) {
+					pos = 64;
+					break;
+				}
+				pos = k + 1;
+				switch (base[k]) {
+				case '"':
+					state = IN_STRING;
+					break;
+				case '\'':
+					state = IN_CHAR;
+					break;
+				case '/':
+					if (base[k + 1] == '*') {
+						state = IN_COMMENT;
+						pos = k + 2;
+					}
+					break;
+				default:
+					state = IN_DIRECTIVE;
+					break;
+				}
+				break;
+			case IN_STRING:
+			case IN_CHAR:
+				stops = ((state == IN_STRING ? m.lm_dquote :
+								m.lm_quote) |
+					m.lm_backslash | m.lm_newline) &
+							valid & FROM(pos);
+				if (stops == 0) {
+					pos = 64;
+					break;
+				}
+				k = __builtin_ctzll(stops);
+				if (base[k] == '\\')
+					pos = k + 2;
+				else {
+					state = IN_CODE;
+					pos = base[k] == '\n' ? k : k + 1;
+				}
+				break;
+			case IN_COMMENT:
+				stops = m.lm_star & valid & FROM(pos);
+				if (stops == 0) {
+					pos = 64;
+					break;
+				}
+				k = __builtin_ctzll(stops);
+				pos = k + 1;
+				if (base[k + 1] == '/') {
+					state = IN_CODE;
+					pos = k + 2;
+				}
+				break;
+			default:
+				stops = m.lm_newline & valid & FROM(pos);
+				if (stops == 0) {
+					pos = 64;
+					break;
+				}
+				k = __builtin_ctzll(stops);
+				state = IN_CODE;
+				pos = k;
+				break;
+			}
+		}
+		pos -= 64;
+	}
+	si->si_count = n;
+	if (state == IN_COMMENT || depth != 0)
+		status = -1;
+	return status;
+}
@@ -0,0 +1,47 @@
+/* structidx.h - where the braces, parentheses and semicolons are */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+/*
+ *  structidx_build() makes one pass over an input in memory and
+ *  records the offset of each '{', '}', '(', ')', '[', ']', ';' and
+ *  ',' that is not in a comment, a string or character constant, or a
+ *  directive line, without lexing it.  That is enough to find where
+ *  each top level declaration and function body begins and ends.
+ *
+ *  si_offset[i] is the offset of the i'th one, and si_depth[i] the
+ *  number of braces open around it, so that a '{' and the '}' that
+ *  closes it have the same depth, and the ';' that ends a top level
+ *  declaration has depth 0.
+ */
+
+#ifndef structidx_h
+#define structidx_h
+
+#include <stddef.h>
+
+#include "lex_scan.h"
+
+typedef struct {
+	unsigned int *si_offset;
+	unsigned int *si_depth;
+	size_t si_count;
+	size_t si_size;			/* room in each array */
+} structidx_t;
+
+void structidx_init(structidx_t *si);
+void structidx_free(structidx_t *si);
+int structidx_build(structidx_t *si, const char *text, size_t len,
+			const lex_scan_t *ls);
+
+#endif
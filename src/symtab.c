@@ -0,0 +1,270 @@
+/* symtab.c - scoped symbol table */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "c_lex.h"
+#include "symtab.h"
+
+enum {
+	SYMTAB_INITIAL_SIZE = 1024
+};
+
+void
+symtab_init(symtab_t *st)
+{
+	st->st_size = SYMTAB_INITIAL_SIZE;
+	st->st_entries = NEW_ARRAY(symtab_entry_t, st->st_size);
+	st->st_used = 0;
+	list_init(&st->st_scopes);
+	list_init(&st->st_exited);
+	st->st_current = 0;
+	st->st_nsymbols = 0;
+	st->st_nscopes = 0;
+	symtab_enter_scope(st, 0);
+}
+
+static void
+free_scope(scope_t *scope)
+{
+	symbol_t *sym;
+
+	while ((sym = list_pop(&scope->symbols)) != 0)
+		free(sym);
+	free(scope);
+}
+
+void
+symtab_free(symtab_t *st)
+{
+	scope_t *scope;
+
+	while ((scope = list_pop(&st->st_scopes)) != 0)
+		free_scope(scope);
+	while ((scope = list_pop(&st->st_exited)) != 0)
+		free_scope(scope);
+	free(st->st_entries);
+	st->st_entries = 0;
+	st->st_size = st->st_used = 0;
+	st->st_current = 0;
+}
+
+/*  Find the entry for atom, or the empty entry where it would go.
+ *  Entries are never removed; an entry whose name has gone out of
+ *  scope just has a NULL symbol.
+ */
+static symtab_entry_t *
+find_entry(symtab_t *st, const atom_t *atom)
+{
+	symtab_entry_t *se;
+	unsigned int i, mask;
+
+	mask = st->st_size - 1;
+	for (i = atom->at_hash & mask; ; i = (i + 1) & mask) {
+		se = &st->st_entries[i];
+		if (se->se_atom == atom || se->se_atom == 0)
+			return se;
+	}
+}
+
+static void
+grow(symtab_t *st)
+{
+	symtab_entry_t *old, *se;
+	unsigned int i, oldsize;
+
+	old = st->st_entries;
+	oldsize = st->st_size;
+	st->st_size *= 2;
+	st->st_entries = NEW_ARRAY(symtab_entry_t, st->st_size);
+	for (i = 0; i < oldsize; ++i) {
+		if (old[i].se_atom != 0) {
+			se = find_entry(st, old[i].se_atom);
+			*se = old[i];
+		}
+	}
+	free(old);
+}
+
+scope_t *
+symtab_enter_scope(symtab_t *st, int level)
+{
+	scope_t *scope;
+
+	scope = NEW(scope_t);
+	scope->level = level;
+	scope->id = st->st_nscopes++;
+	scope->reentered = 0;
+	scope->kept = 0;
+	list_init(&scope->symbols);
+	list_append(&st->st_scopes, scope);
+	st->st_current = scope;
+	return scope;
+}
+
+/*  Leave the current scope, uncovering whatever its declarations hid.
+ *  The scope is freed with its symbols, unless it has been marked kept
+ *  to be gone back into with symtab_reenter_scope(); then it goes on
+ *  st_exited until symtab_free_exited() or symtab_free().
+ */
+void
+symtab_exit_scope(symtab_t *st)
+{
+	scope_t *scope;
+	symbol_t *sym;
+
+	scope = st->st_current;
+	for (sym = list_last(&scope->symbols);
+		sym != 0;
+		sym = list_prev(&scope->symbols, sym)) {
+		find_entry(st, sym->atom)->se_sym = sym->shadowed;
+	}
+	st->st_current = list_prev(&st->st_scopes, scope);
+	assert(st->st_current != 0);
+	list_remove(&st->st_scopes, scope);
+	if (!scope->kept) {
+		free_scope(scope);
+		return;
+	}
+	if (!scope->reentered)
+		list_append(&st->st_exited, scope);
+	else if (scope->exited_after != 0)
+		list_insert_after(&st->st_exited, scope->exited_after, scope);
+	else
+		list_prepend(&st->st_exited, scope);
+	scope->reentered = 0;
+}
+
+/*  Make scope, which must have been left with symtab_exit_scope(), the
+ *  current scope again, with the declarations it had, as though it had
+ *  just been entered inside the current one and they had been made
+ *  again.  Leaving it again puts it back where it was on st_exited.
+ */
+void
+symtab_reenter_scope(symtab_t *st, scope_t *scope)
+{
+	symtab_entry_t *se;
+	symbol_t *sym;
+
+	for (sym = list_first(&scope->symbols);
+		sym != 0;
+		sym = list_next(&scope->symbols, sym)) {
+		se = find_entry(st, sym->atom);
+		sym->shadowed = se->se_sym;
+		if (se->se_sym == 0 || se->se_sym->scope != scope)
+			se->se_sym = sym;
+	}
+	scope->reentered = 1;
+	scope->exited_after = list_prev(&st->st_exited, scope);
+	list_remove(&st->st_exited, scope);
+	list_append(&st->st_scopes, scope);
+	st->st_current = scope;
+}
+
+/*  Free the symbols declared in scope after mark, or all of them if
+ *  mark is NULL.  The scope must not be current or enclosing.
+ */
+void
+symtab_forget(scope_t *scope, symbol_t *mark)
+{
+	symbol_t *sym;
+
+	while ((sym = list_last(&scope->symbols)) != 0 && sym != mark) {
+		list_remove(&scope->symbols, sym);
+		free(sym);
+	}
+}
+
+/*  Take back the declarations made in the current scope since symbol
+ *  number serial, putting back the ones they hid.
+ */
+void
+symtab_truncate(symtab_t *st, unsigned int serial)
+{
+	scope_t *scope = st->st_current;
+	symbol_t *sym;
+
+	while ((sym = list_last(&scope->symbols)) != 0 &&
+			sym->serial >= serial) {
+		find_entry(st, sym->atom)->se_sym = sym->shadowed;
+		list_remove(&scope->symbols, sym);
+		free(sym);
+	}
+}
+
+/*  Free the scopes numbered id or later that have been left.  Scopes
+ *  go on st_exited in the order they are left, and one that is left
+ *  again after symtab_reenter_scope() goes back to its old place, so
+ *  these are the ones at the end.
+ */
+void
+symtab_free_exited(symtab_t *st, unsigned int id)
+{
+	scope_t *scope;
+
+	while ((scope = list_last(&st->st_exited)) != 0 && scope->id >= id) {
+		list_remove(&st->st_exited, scope);
+		free_scope(scope);
+	}
+}
+
+symbol_t *
+symtab_lookup(symtab_t *st, const atom_t *atom)
+{
+	return find_entry(st, atom)->se_sym;
+}
+
+symbol_t *
+symtab_lookup_current(symtab_t *st, const atom_t *atom)
+{
+	symbol_t *sym;
+
+	sym = find_entry(st, atom)->se_sym;
+	if (sym != 0 && sym->scope == st->st_current)
+		return sym;
+	return 0;
+}
+
+/*  Declare atom in the current scope.  A second declaration in the
+ *  same scope is kept on the scope's list but does not replace the
+ *  first one, so lookups keep finding the original.
+ */
+symbol_t *
+symtab_install(symtab_t *st, const atom_t *atom, int storage_class,
+		int object_type)
+{
+	symtab_entry_t *se;
+	symbol_t *sym;
+
+	sym = NEW(symbol_t);
+	sym->atom = atom;
+	sym->storage_class = storage_class;
+	sym->object_type = object_type;
+	sym->scope = st->st_current;
+	sym->serial = st->st_nsymbols++;
+	list_append(&st->st_current->symbols, sym);
+
+	se = find_entry(st, atom);
+	sym->shadowed = se->se_sym;
+	if (se->se_sym != 0 && se->se_sym->scope == st->st_current)
+		return sym;
+	se->se_sym = sym;
+	if (se->se_atom == 0) {
+		se->se_atom = atom;
+		if (++st->st_used * 4 > st->st_size * 3)
+			grow(st);
+	}
+	return sym;
+}
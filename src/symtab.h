@@ -0,0 +1,80 @@
+/* symtab.h - scoped symbol table */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+/*
+ *  All the names visible at any moment are kept in one open addressed
+ *  hash table keyed on the atom, which maps each name to its innermost
+ *  declaration.  A declaration that hides an outer one remembers it in
+ *  its shadowed field, and each scope keeps a list of the symbols it
+ *  declared; leaving a scope walks that list backwards and puts the
+ *  hidden declarations back.  Lookup is one probe sequence whatever
+ *  the nesting depth or the number of globals.
+ */
+
+#ifndef symtab_h
+#define symtab_h
+
+#include "atom.h"
+#include "list.h"
+
+typedef struct symbol_t {
+	link_t link;			/* on the declaring scope's list */
+	const atom_t *atom;
+	int storage_class;
+	int object_type;
+	struct symbol_t *shadowed;	/* outer declaration of the name */
+	struct scope_t *scope;		/* where it was declared */
+	unsigned int serial;		/* symbols are numbered in order */
+} symbol_t;
+
+typedef struct scope_t {
+	link_t link;
+	int level;		/* nesting level */
+	unsigned int id;	/* scopes are numbered as they are entered */
+	list_t symbols;		/* symbols declared in this scope */
+	int kept;		/* not freed when left */
+	int reentered;		/* by symtab_reenter_scope() */
+	struct scope_t *exited_after;	/* its place on st_exited then */
+} scope_t;
+
+typedef struct {
+	const atom_t *se_atom;
+	symbol_t *se_sym;	/* innermost declaration, or NULL */
+} symtab_entry_t;
+
+typedef struct {
+	symtab_entry_t *st_entries;
+	unsigned int st_size;	/* a power of 2 */
+	unsigned int st_used;	/* entries with an atom */
+	list_t st_scopes;	/* outermost first */
+	list_t st_exited;	/* kept scopes that have been left */
+	scope_t *st_current;
+	unsigned int st_nsymbols;	/* symbols ever declared */
+	unsigned int st_nscopes;	/* scopes ever entered */
+} symtab_t;
+
+void symtab_init(symtab_t *st);
+void symtab_free(symtab_t *st);
+scope_t *symtab_enter_scope(symtab_t *st, int level);
+void symtab_exit_scope(symtab_t *st);
+void symtab_reenter_scope(symtab_t *st, scope_t *scope);
+void symtab_forget(scope_t *scope, symbol_t *mark);
+void symtab_truncate(symtab_t *st, unsigned int serial);
+void symtab_free_exited(symtab_t *st, unsigned int id);
+symbol_t *symtab_lookup(symtab_t *st, const atom_t *atom);
+symbol_t *symtab_lookup_current(symtab_t *st, const atom_t *atom);
+symbol_t *symtab_install(symtab_t *st, const atom_t *atom,
+			int storage_class, int object_type);
+
+#endif
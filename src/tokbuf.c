@@ -0,0 +1,705 @@
+/* tokbuf.c - a whole input lexed into arrays */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "c_lex.h"
+#include "tokbuf.h"
+
+void
+tokbuf_init(tokbuf_t *tb)
+{
+	memset(tb, 0, sizeof *tb);
+}
+
+void
+tokbuf_free(tokbuf_t *tb)
+{
+	free(tb->tb_kind);
+	free(tb->tb_offset);
+	free(tb->tb_length);
+	free(tb->tb_index);
+	free(tb->tb_atoms);
+	free(tb->tb_literals);
+	if (tb->tb_errors != NULL)
+		fclose(tb->tb_errors);
+	free(tb->tb_errtext);
+	free(tb->tb_said);
+	tokbuf_init(tb);
+}
+
+static void
+grow_tokens(tokbuf_t *tb)
+{
+	tb->tb_size = tb->tb_size ? tb->tb_size * 2 : 4096;
+	tb->tb_kind = safe_realloc(tb->tb_kind, tb->tb_size);
+	tb->tb_offset = safe_realloc(tb->tb_offset,
+					tb->tb_size * sizeof *tb->tb_offset);
+	tb->tb_length = safe_realloc(tb->tb_length,
+					tb->tb_size * sizeof *tb->tb_length);
+	tb->tb_index = safe_realloc(tb->tb_index,
+					tb->tb_size * sizeof *tb->tb_index);
+}
+
+/*  Record atom in *tab, a table indexed by at_id of *n entries.
+ */
+static unsigned int
+add_atom(const atom_t ***tab, unsigned int *n, const atom_t *atom)
+{
+	unsigned int size;
+
+	if (atom->at_id >= *n) {
+		size = *n ? *n : 1024;
+		while (size <= atom->at_id)
+			size *= 2;
+		*tab = safe_realloc(*tab, size * sizeof **tab);
+		memset(*tab + *n, 0, (size - *n) * sizeof **tab);
+		*n = size;
+	}
+	(*tab)[atom->at_id] = atom;
+	return atom->at_id;
+}
+
+/*  Record token t, which le has just lexed, at the end of tb.
+ */
+static void
+add_token(tokbuf_t *tb, lex_env_t *le, token_t t)
+{
+	unsigned int i;
+
+	if (tb->tb_count == tb->tb_size)
+		grow_tokens(tb);
+	i = tb->tb_count++;
+	tb->tb_kind[i] = t;
+	tb->tb_offset[i] = le->le_tokstart - tb->tb_text;
+	tb->tb_length[i] = le->le_lptr - le->le_tokstart;
+	tb->tb_index[i] = 0;
+	if (t == IDENTIFIER)
+		tb->tb_index[i] = add_atom(&tb->tb_atoms, &tb->tb_natoms,
+					le->le_identifier.id_atom);
+	else if (t == STRING_CONSTANT)
+		tb->tb_index[i] = add_atom(&tb->tb_literals,
+				&tb->tb_nliterals, le->le_literal);
+}
+
+/*  Hold back what le says from now on in tb, returning where it would
+ *  have gone.
+ */
+static FILE *
+start_holding(tokbuf_t *tb, lex_env_t *le)
+{
+	FILE *errors = le->le_errors;
+
+	if (tb->tb_errors != NULL)
+		fclose(tb->tb_errors);
+	free(tb->tb_errtext);
+	tb->tb_errtext = NULL;
+	tb->tb_errsize = 0;
+	tb->tb_nsaid = 0;
+	tb->tb_nsaid_done = 0;
+	tb->tb_errors = open_memstream(&tb->tb_errtext, &tb->tb_errsize);
+	if (tb->tb_errors != NULL)
+		le->le_errors = tb->tb_errors;
+	return errors;
+}
+
+/*  Note that count messages held back in tb are about token index.
+ */
+static void
+note_held(tokbuf_t *tb, unsigned int index, int count)
+{
+	if (tb->tb_errors == NULL)
+		return;
+	if (tb->tb_nsaid == tb->tb_saidsize) {
+		tb->tb_saidsize = tb->tb_saidsize == 0 ? 16 : tb->tb_saidsize * 2;
+		tb->tb_said = safe_realloc(tb->tb_said,
+					tb->tb_saidsize * sizeof *tb->tb_said);
+	}
+	fflush(tb->tb_errors);
+	tb->tb_said[tb->tb_nsaid].index = index;
+	tb->tb_said[tb->tb_nsaid].end = tb->tb_errsize;
+	tb->tb_said[tb->tb_nsaid].count = count;
+	tb->tb_nsaid++;
+}
+
+/*  Send le's messages back to errors, counting those held back as not
+ *  yet printed.
+ */
+static void
+stop_holding(tokbuf_t *tb, lex_env_t *le, FILE *errors)
+{
+	int i;
+
+	le->le_errors = errors;
+	if (tb->tb_errors == NULL)
+		return;
+	fclose(tb->tb_errors);
+	tb->tb_errors = NULL;
+	for (i = 0; i < tb->tb_nsaid; ++i)
+		le->le_nmessages -= tb->tb_said[i].count;
+}
+
+/*  Print what was held back about tokens up to i that has not been
+ *  printed yet.
+ */
+static void
+pass_on_held(tokbuf_t *tb, unsigned int i, lex_env_t *le)
+{
+	size_t from;
+
+	from = tb->tb_nsaid_done > 0 ?
+			tb->tb_said[tb->tb_nsaid_done - 1].end : 0;
+	while (tb->tb_nsaid_done < tb->tb_nsaid &&
+			tb->tb_said[tb->tb_nsaid_done].index <= i)
+		le->le_nmessages += tb->tb_said[tb->tb_nsaid_done++].count;
+	fwrite(tb->tb_errtext + from, 1,
+		tb->tb_said[tb->tb_nsaid_done - 1].end - from, le->le_errors);
+}
+
+/*
+ *  Lex all of le's input, which must be in memory (le_buf), into tb.
+ *  Bad tokens are kept as BADTOK, so the parser sees exactly what it
+ *  would have reading the input directly.  Returns the number of
+ *  tokens, or -1 if le is not lexing from a buffer or the buffer is
+ *  too big for the offsets in tb.
+ */
+int
+tokbuf_fill(tokbuf_t *tb, lex_env_t *le)
+{
+	token_t (*name_type)(void *arg, const atom_t *atom);
+	FILE *errors;
+	token_t t;
+	int nmessages;
+
+	if (le->le_buf == NULL || le->le_buflen > UINT_MAX)
+		return -1;
+	tb->tb_text = le->le_buf;
+	tb->tb_count = 0;
+
+	name_type = le->le_name_type;
+	le->le_name_type = NULL;
+	errors = start_holding(tb, le);
+	do {
+		nmessages = le->le_nmessages;
+		t = lex_get_token(le);
+		if (le->le_nmessages != nmessages)
+			note_held(tb, tb->tb_count,
+					le->le_nmessages - nmessages);
+		if (t != EOI)
+			add_token(tb, le, t);
+	} while (t != EOI);
+	stop_holding(tb, le, errors);
+	le->le_name_type = name_type;
+	return tb->tb_count;
+}
+
+/*
+ *  Make token i the lexer's current token, as though lex_get_token()
+ *  had just returned it: le_lexeme describes it, and an identifier is
+ *  passed to le_name_type.  What the lexer said about it, and about
+ *  any tokens before it not yet reached, is printed.  Past the last
+ *  token this returns EOI.
+ */
+token_t
+tokbuf_get(tokbuf_t *tb, unsigned int i, lex_env_t *le)
+{
+	token_t t;
+
+	if (tb->tb_nsaid_done < tb->tb_nsaid &&
+			tb->tb_said[tb->tb_nsaid_done].index <= i)
+		pass_on_held(tb, i, le);
+	if (i >= tb->tb_count)
+		return EOI;
+	t = TB_KIND(tb, i);
+	switch (t) {
+	case IDENTIFIER:
+		le->le_identifier.id_atom = tb->tb_atoms[tb->tb_index[i]];
+		le->le_lexeme.identifier = &le->le_identifier;
+		if (le->le_name_type != NULL)
+			t = (*le->le_name_type)(le->le_name_type_arg,
+						le->le_identifier.id_atom);
+		break;
+	case STRING_CONSTANT:
+		le->le_literal = tb->tb_literals[tb->tb_index[i]];
+		le->le_constant.co_val = le->le_literal->at_name;
+		le->le_constant.co_size = le->le_literal->at_len + 1;
+		le->le_lexeme.constant = &le->le_constant;
+		break;
+	case INTEGER_CONSTANT:
+		/* The value is quicker to work out again than to store */
+		lex_number(tb->tb_text + tb->tb_offset[i], &t,
+						&le->le_constant.co_ival);
+		/* FALLTHROUGH */
+	case CHARACTER_CONSTANT:
+	case FLOATING_CONSTANT:
+		le->le_constant.co_val = tb->tb_text + tb->tb_offset[i];
+		le->le_constant.co_size = tb->tb_length[i];
+		le->le_lexeme.constant = &le->le_constant;
+		break;
+	default:
+		break;
+	}
+	le->le_prev_token = t;
+	return t;
+}
+
+/*
+ *  Lexing on several threads.  The input is cut at line starts into
+ *  chunks, and each chunk is lexed on its own, with a lexer and tables
+ *  of its own, into a chain of tokens, taking it to begin outside any
+ *  comment or constant.  If the chunk might begin in a comment, as
+ *  when a "*" "/" comes before any "/" "*", it is also lexed from just
+ *  after the end of the comment.  Cuts are made after lines that end
+ *  in ';', '{' or '}' where there are any, so a constant, which could
+ *  only go on to the next line after a '\\' or before another string,
+ *  is not a state a chunk can begin in.
+ *
+ *  The chains are joined in order by lexing with le itself.  Each token
+ *  le lexes is looked for as the first of a chain of the chunk it is
+ *  in.  A chain that begins with it goes on as a serial lex would, so
+ *  it is taken whole and le moves on to where the chain stopped, just
+ *  past its chunk.  le lexes whatever no chain fits.  The names and
+ *  string constants of a chain taken are put into le's tables in the
+ *  order they first came, and its messages printed, then and there;
+ *  its tokens are copied into tb afterwards, again on all threads.
+ */
+
+enum {
+	SPLIT_CHUNK_MIN = 64 * 1024,	/* the least worth a thread */
+	SPLIT_CHUNKS = 4,		/* chunks for each thread */
+	SPLIT_SEARCH = 16 * 1024	/* how far to look for a good cut */
+};
+
+
+typedef struct {
+	lex_env_t lex;
+	atom_table_t atoms;
+	tokbuf_t tokens;		/* numbered in its own tables */
+	unsigned int natoms;		/* how many names its tokens use */
+	unsigned int nliterals;		/* and string constants */
+	int usable;
+	int eoi;			/* it got to the end of the input */
+	size_t stop;			/* or to a token past its chunk */
+	int lnum0;			/* line number after its first token */
+	int lnum1;			/* and at the start of stop */
+	int nmarkers;			/* line markers between them */
+	const char *filename;		/* as a line marker last set it */
+	FILE *errors;
+	char *errtext;
+	size_t errsize;
+	said_t *said;
+	int nsaid;
+	int saidsize;
+	unsigned int *atommap;		/* its names' numbers in tb */
+	unsigned int *litmap;
+	unsigned int dest;		/* where its second token goes */
+	int taken;
+} chain_t;
+
+typedef struct {
+	size_t start;
+	size_t end;
+	chain_t chains[2];		/* from outside and inside a comment */
+	int nchains;
+} chunk_t;
+
+typedef struct {
+	tokbuf_t *tb;
+	lex_env_t *lex;			/* the caller's lexer */
+	chunk_t *chunks;
+	int nchunks;
+	int copying;			/* the threads' second job */
+	int next;			/* the next chunk for a thread */
+	pthread_mutex_t lock;
+} lexsplit_t;
+
+/*  The start of the first line after offset at that follows a line
+ *  ending in ';', '{' or '}', if there is one soon enough, or else of
+ *  the first line after at, or end.
+ */
+static size_t
+cut_after(const char *text, size_t at, size_t end)
+{
+	const char *s, *nl, *p, *first;
+
+	first = NULL;
+	for (s = text + at; (nl = memchr(s, '\n', text + end - s)) != NULL;
+			s = nl + 1) {
+		if (first == NULL)
+			first = nl + 1;
+		for (p = nl; p > text && (p[-1] == ' ' || p[-1] == '\t' ||
+						p[-1] == '\r'); --p)
+			;
+		if (p > text && (p[-1] == ';' || p[-1] == '{' || p[-1] == '}'))
+			return nl + 1 - text;
+		if ((size_t)(nl - text) > at + SPLIT_SEARCH)
+			break;
+	}
+	return first != NULL ? (size_t)(first - text) : end;
+}
+
+/*  Just past the first comment end from s to end if no comment begins
+ *  before it, as then s may be inside a comment, or NULL.
+ */
+static const char *
+comment_end(const char *s, const char *end)
+{
+	const char *slash;
+
+	for (; (slash = memchr(s, '/', end - s)) != NULL; s = slash + 1) {
+		if (slash[1] == '*')
+			return NULL;
+		if (slash > s && slash[-1] == '*')
+			return slash + 1;
+	}
+	return NULL;
+}
+
+/*  Note that messages were printed while c lexed its token index.
+ */
+static void
+note_said(chain_t *c, unsigned int index, int count)
+{
+	if (c->nsaid == c->saidsize) {
+		c->saidsize = c->saidsize == 0 ? 16 : c->saidsize * 2;
+		c->said = safe_realloc(c->said, c->saidsize * sizeof *c->said);
+	}
+	fflush(c->errors);
+	c->said[c->nsaid].index = index;
+	c->said[c->nsaid].end = c->errsize;
+	c->said[c->nsaid].count = count;
+	c->nsaid++;
+}
+
+/*  Lex the chunk k from offset start into chain c, up to the first
+ *  token that starts past it.
+ */
+static void
+lex_chain(lexsplit_t *sp, chunk_t *k, chain_t *c, size_t start)
+{
+	lex_env_t *le = &c->lex;
+	tokbuf_t *tb = &c->tokens;
+	const char *name;
+	token_t t;
+	int nmessages, nmarkers;
+	unsigned int i;
+
+	lex_init(le);
+	le->le_buf = sp->lex->le_buf;
+	le->le_buflen = sp->lex->le_buflen;
+	le->le_filename = name = sp->lex->le_filename;
+	le->le_scan = sp->lex->le_scan;
+	atom_table_init(&c->atoms);
+	le->le_atoms = &c->atoms;
+	tokbuf_init(tb);
+	tb->tb_text = le->le_buf;
+	if ((c->errors = open_memstream(&c->errtext, &c->errsize)) == NULL)
+		return;
+	le->le_errors = c->errors;
+
+	lex_seek(le, le->le_buf + start, 0);
+	c->usable = 1;
+	for (;;) {
+		nmessages = le->le_nmessages;
+		nmarkers = le->le_nmarkers;
+		t = lex_get_token(le);
+		if (le->le_nmessages != nmessages)
+			note_said(c, tb->tb_count,
+					le->le_nmessages - nmessages);
+		if (t == EOI) {
+			c->eoi = 1;
+			c->lnum1 = le->le_lnum;
+			break;
+		}
+		if ((size_t)(le->le_tokstart - le->le_buf) >= k->end) {
+			/* Messages or line markers met on the way to
+			 * this token would come again when le lexes it.
+			 */
+			if (le->le_nmessages != nmessages ||
+					le->le_nmarkers != nmarkers)
+				c->usable = 0;
+			c->stop = le->le_tokstart - le->le_buf;
+			c->lnum1 = le->le_lnum;
+			for (name = le->le_tokstart; name < le->le_lptr; ++name)
+				c->lnum1 -= *name == '\n';
+			break;
+		}
+		add_token(tb, le, t);
+		i = tb->tb_count - 1;
+		if (t == IDENTIFIER && tb->tb_index[i] >= c->natoms)
+			c->natoms = tb->tb_index[i] + 1;
+		else if (t == STRING_CONSTANT &&
+				tb->tb_index[i] >= c->nliterals)
+			c->nliterals = tb->tb_index[i] + 1;
+		if (i == 0) {
+			c->lnum0 = le->le_lnum;
+			c->nmarkers = le->le_nmarkers;
+		}
+	}
+	c->nmarkers = le->le_nmarkers - c->nmarkers;
+	if (le->le_filename != sp->lex->le_filename)
+		c->filename = le->le_filename;
+	if (tb->tb_count == 0)
+		c->usable = 0;
+}
+
+static void
+free_chain(chain_t *c)
+{
+	lex_free(&c->lex);
+	atom_table_free(&c->atoms);
+	tokbuf_free(&c->tokens);
+	if (c->errors != NULL)
+		fclose(c->errors);
+	free(c->errtext);
+	free(c->said);
+	free(c->atommap);
+	free(c->litmap);
+}
+
+/*  Copy the tokens after the first of chain c, which has been taken,
+ *  into tb, numbering names and constants as le does.
+ */
+static void
+copy_chain(tokbuf_t *tb, chain_t *c)
+{
+	const tokbuf_t *from = &c->tokens;
+	unsigned int i, j;
+
+	for (i = 1, j = c->dest; i < from->tb_count; ++i, ++j) {
+		tb->tb_kind[j] = from->tb_kind[i];
+		tb->tb_offset[j] = from->tb_offset[i];
+		tb->tb_length[j] = from->tb_length[i];
+		switch (TB_KIND(from, i)) {
+		case IDENTIFIER:
+			tb->tb_index[j] = c->atommap[from->tb_index[i]];
+			break;
+		case STRING_CONSTANT:
+			tb->tb_index[j] = c->litmap[from->tb_index[i]];
+			break;
+		default:
+			tb->tb_index[j] = 0;
+			break;
+		}
+	}
+}
+
+/*  A thread's loop: lex the chunks, or copy what was taken of them and
+ *  free them, until there are none left.
+ */
+static void *
+run_chunks(void *arg)
+{
+	lexsplit_t *sp = arg;
+	chunk_t *k;
+	const char *s;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&sp->lock);
+		i = sp->next++;
+		pthread_mutex_unlock(&sp->lock);
+		if (i >= sp->nchunks)
+			return NULL;
+		k = &sp->chunks[i];
+		if (sp->copying) {
+			for (i = 0; i < k->nchains; ++i) {
+				if (k->chains[i].taken)
+					copy_chain(sp->tb, &k->chains[i]);
+				free_chain(&k->chains[i]);
+			}
+			continue;
+		}
+		lex_chain(sp, k, &k->chains[k->nchains++], k->start);
+		s = comment_end(sp->lex->le_buf + k->start,
+					sp->lex->le_buf + k->end);
+		if (s != NULL)
+			lex_chain(sp, k, &k->chains[k->nchains++],
+						s - sp->lex->le_buf);
+	}
+}
+
+/*  Run the job in hand on nthreads threads, this one included.
+ */
+static void
+run_threads(lexsplit_t *sp, int nthreads)
+{
+	pthread_t *threads;
+	int i, n;
+
+	threads = NEW_ARRAY(pthread_t, nthreads);
+	sp->next = 0;
+	for (n = 0; n < nthreads - 1; ++n) {
+		if (pthread_create(&threads[n], NULL, run_chunks, sp) != 0)
+			break;
+	}
+	run_chunks(sp);
+	for (i = 0; i < n; ++i)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+/*  Take chain c as le's tokens from its second on, le having lexed its
+ *  first, and carry on from where c stopped.
+ */
+static void
+take_chain(tokbuf_t *tb, lex_env_t *le, chain_t *c)
+{
+	const atom_t *at;
+	unsigned int i;
+	size_t from;
+
+	c->atommap = NEW_ARRAY(unsigned int, c->natoms + 1);
+	for (i = 0; i < c->natoms; ++i) {
+		if ((at = c->tokens.tb_atoms[i]) == NULL)
+			continue;
+		at = atom_intern(le->le_atoms, at->at_name, at->at_len,
+						at->at_hash);
+		c->atommap[i] = add_atom(&tb->tb_atoms, &tb->tb_natoms, at);
+	}
+	c->litmap = NEW_ARRAY(unsigned int, c->nliterals + 1);
+	if (c->nliterals > 0 && le->le_literals.atab_buckets == NULL)
+		atom_table_init(&le->le_literals);
+	for (i = 0; i < c->nliterals; ++i) {
+		if ((at = c->tokens.tb_literals[i]) == NULL)
+			continue;
+		at = atom_intern(&le->le_literals, at->at_name, at->at_len,
+						at->at_hash);
+		c->litmap[i] = add_atom(&tb->tb_literals, &tb->tb_nliterals,
+						at);
+	}
+
+	/* What was said about the first token, le has said already; the
+	 * rest is held back with the token it was about.
+	 */
+	c->dest = tb->tb_count;
+	from = 0;
+	for (i = 0; i < (unsigned int)c->nsaid; ++i) {
+		if (c->said[i].index != 0) {
+			fwrite(c->errtext + from, 1, c->said[i].end - from,
+							le->le_errors);
+			le->le_nmessages += c->said[i].count;
+			note_held(tb, c->dest + c->said[i].index - 1,
+							c->said[i].count);
+		}
+		from = c->said[i].end;
+	}
+
+	tb->tb_count += c->tokens.tb_count - 1;
+	while (tb->tb_size < tb->tb_count)
+		grow_tokens(tb);
+	c->taken = 1;
+
+	if (c->nmarkers == 0)
+		c->lnum1 += le->le_lnum - c->lnum0;
+	le->le_nmarkers += c->nmarkers;
+	if (c->filename != NULL)
+		le->le_filename = lex_filename(le, c->filename);
+	lex_seek(le, le->le_buf + (c->eoi ? le->le_buflen : c->stop),
+								c->lnum1);
+}
+
+/*
+ *  tokbuf_fill() on up to nthreads threads.  The tokens, the tables of
+ *  names and constants, the messages and the state le is left in are
+ *  all as tokbuf_fill() would have made them.
+ */
+int
+tokbuf_fill_split(tokbuf_t *tb, lex_env_t *le, int nthreads)
+{
+	token_t (*name_type)(void *arg, const atom_t *atom);
+	lexsplit_t sp;
+	chunk_t *k;
+	chain_t *c;
+	FILE *errors;
+	size_t start, len, at;
+	token_t t;
+	int i, n, nmessages;
+
+	if (le->le_buf == NULL || le->le_buflen > UINT_MAX)
+		return -1;
+	if (nthreads < 2 || le->le_debug || le->le_nahead > 0)
+		return tokbuf_fill(tb, le);
+	start = le->le_lptr != NULL ? le->le_lptr - le->le_buf : 0;
+	len = le->le_buflen - start;
+	n = nthreads * SPLIT_CHUNKS;
+	if (len / SPLIT_CHUNK_MIN < (size_t)n)
+		n = len / SPLIT_CHUNK_MIN;
+	if (n < 2)
+		return tokbuf_fill(tb, le);
+
+	memset(&sp, 0, sizeof sp);
+	sp.tb = tb;
+	sp.lex = le;
+	sp.chunks = NEW_ARRAY(chunk_t, n);
+	pthread_mutex_init(&sp.lock, NULL);
+	/* A fresh lexer takes a directive on the first line as one, but
+	 * one set going there does not.
+	 */
+	at = start;
+	if (le->le_line == NULL && *le->le_buf == '#')
+		at = cut_after(le->le_buf, 0, le->le_buflen);
+	for (i = 0; i < n && at < le->le_buflen; ++i) {
+		sp.chunks[sp.nchunks].start = at;
+		at = cut_after(le->le_buf, start + len / n * (i + 1),
+							le->le_buflen);
+		if (at > sp.chunks[sp.nchunks].start) {
+			sp.chunks[sp.nchunks].end = at;
+			sp.nchunks++;
+		}
+	}
+	sp.chunks[sp.nchunks - 1].end = le->le_buflen;
+	run_threads(&sp, nthreads);
+
+	tb->tb_text = le->le_buf;
+	tb->tb_count = 0;
+	name_type = le->le_name_type;
+	le->le_name_type = NULL;
+	errors = start_holding(tb, le);
+	i = 0;
+	for (;;) {
+		nmessages = le->le_nmessages;
+		t = lex_get_token(le);
+		if (le->le_nmessages != nmessages)
+			note_held(tb, tb->tb_count,
+					le->le_nmessages - nmessages);
+		if (t == EOI)
+			break;
+		add_token(tb, le, t);
+		at = le->le_tokstart - le->le_buf;
+		while (i + 1 < sp.nchunks && at >= sp.chunks[i + 1].start)
+			++i;
+		k = &sp.chunks[i];
+		for (n = 0; n < k->nchains; ++n) {
+			c = &k->chains[n];
+			if (c->usable && !c->taken &&
+					c->tokens.tb_offset[0] == at) {
+				take_chain(tb, le, c);
+				break;
+			}
+		}
+	}
+	stop_holding(tb, le, errors);
+	le->le_name_type = name_type;
+
+	sp.copying = 1;
+	run_threads(&sp, nthreads);
+	pthread_mutex_destroy(&sp.lock);
+	free(sp.chunks);
+	return tb->tb_count;
+}
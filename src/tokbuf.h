@@ -0,0 +1,74 @@
+/* tokbuf.h - a whole input lexed into arrays */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+/*
+ *  tokbuf_fill() runs the lexer over the whole of an in-memory input
+ *  and records each token in four parallel arrays, so the parser can
+ *  walk the tokens without going back into the lexer and can look at,
+ *  or go back to, any token by number.
+ *
+ *  For token i, tb_kind[i] is its token_t, and tb_offset[i] and
+ *  tb_length[i] give its text in tb_text.  tb_index[i] is the at_id
+ *  of an IDENTIFIER, or for a STRING_CONSTANT that of its value in the
+ *  lexer's literal pool, so the buffer is only good until lex_free().
+ *  The text of a string constant runs from its first quote to the last
+ *  quote of any literals joined to it.  Names are recorded as
+ *  IDENTIFIER; whether one is a typedef name is decided when the parser
+ *  reaches it, since only then is the symbol table right.  For the same
+ *  reason of order, what the lexer says about a token is held back and
+ *  printed when tokbuf_get() first reaches that token or one after it.
+ */
+
+#ifndef tokbuf_h
+#define tokbuf_h
+
+#include "c_lex.h"
+
+/* Messages the lexer printed while it lexed one token */
+typedef struct {
+	unsigned int index;		/* which token */
+	size_t end;			/* where they end in the text */
+	int count;
+} said_t;
+
+typedef struct {
+	unsigned char *tb_kind;
+	unsigned int *tb_offset;
+	unsigned int *tb_length;
+	unsigned int *tb_index;
+	unsigned int tb_count;
+	unsigned int tb_size;		/* room in each array */
+	const char *tb_text;		/* the input, le_buf of the lexer */
+	const atom_t **tb_atoms;	/* indexed by at_id */
+	unsigned int tb_natoms;
+	const atom_t **tb_literals;	/* from le_literals, by at_id */
+	unsigned int tb_nliterals;
+	FILE *tb_errors;		/* the lexer's messages, while filling */
+	char *tb_errtext;		/* and what they were */
+	size_t tb_errsize;
+	said_t *tb_said;		/* which token each was about */
+	int tb_nsaid;
+	int tb_saidsize;
+	int tb_nsaid_done;		/* how many tokbuf_get() passed on */
+} tokbuf_t;
+
+#define TB_KIND(tb, i)		((token_t)(tb)->tb_kind[i])
+
+void tokbuf_init(tokbuf_t *tb);
+void tokbuf_free(tokbuf_t *tb);
+int tokbuf_fill(tokbuf_t *tb, lex_env_t *le);
+int tokbuf_fill_split(tokbuf_t *tb, lex_env_t *le, int nthreads);
+token_t tokbuf_get(tokbuf_t *tb, unsigned int i, lex_env_t *le);
+
+#endif